@@ -0,0 +1,751 @@
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <functional>
+#include <cstring>
+#include <map>
+
+#include "libcplot.hpp"
+
+//cplot-bench [--quick] [--reps n] [--jit] [--json out.json] [--compare baseline.json] [--threshold percent]
+//renders a fixed corpus and reports each phase separately. every metric is the best of --reps runs
+
+namespace
+{
+    struct Result
+    {
+        std::string name;
+        double value;
+        std::string unit;
+        bool higher_is_better;
+    };
+
+    struct Options
+    {
+        bool quick = false, jit = false;
+        int reps = 3;
+        std::string json, compare;
+        double threshold = 10;
+    };
+
+    const std::pair<const char*, const char*> corpus[] =
+    {
+        {"poly",     "z^5-3*z^3+z-2"},
+        {"poly12",   "z^12+z^7-z^2+1"},
+        {"rational", "(z^3-1)/(z^2+1)"},
+        {"poles",    "1/(z^4-1)+1/z"},
+        {"exp_sin",  "exp(sin(z))"},
+        {"sin_exp",  "sin(exp(z)/3)*cos(z)"},
+        {"nested",   "exp(sin(cos(exp(sin(z/2)))))"},
+        {"horner",   "((((z+1)*z+1)*z+1)*z+1)/((((z-1)*z-1)*z-1)*z-1)"},
+    };
+
+    //the rational maps of the corpus again, as kernels compiled from the same text
+    struct Poly { static constexpr std::string_view source = "z^5-3*z^3+z-2"; };
+    struct Rational { static constexpr std::string_view source = "(z^3-1)/(z^2+1)"; };
+    struct Poles { static constexpr std::string_view source = "1/(z^4-1)+1/z"; };
+    struct Horner { static constexpr std::string_view source = "((((z+1)*z+1)*z+1)*z+1)/((((z-1)*z-1)*z-1)*z-1)"; };
+    struct Negated { static constexpr std::string_view source = "-z^2+2*-z^2+-2^2"; };
+
+    double elapsed_ms(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //fastest of reps runs of f, in milliseconds
+    double best_of(int reps, const std::function<void()>& f)
+    {
+        double best = 1e300;
+        for(int i = 0; i < reps; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            f();
+            best = std::min(best, elapsed_ms(start));
+        }
+        return best;
+    }
+
+    class Bench
+    {
+        Options opt;
+        std::vector<Result> results;
+        std::filesystem::path scratch;
+
+        void report(std::string name, double value, std::string unit, bool higher_is_better)
+        {
+            std::printf("  %-40s %12.3f %s\n", name.c_str(), value, unit.c_str());
+            results.push_back({std::move(name), value, std::move(unit), higher_is_better});
+        }
+
+        std::vector<int> sizes() const
+        {
+            return opt.quick ? std::vector<int>{256} : std::vector<int>{256, 512, 1024};
+        }
+
+        std::vector<unsigned> thread_counts() const
+        {
+            unsigned hw = std::max(1u, std::thread::hardware_concurrency());
+            return hw == 1 ? std::vector<unsigned>{1} : std::vector<unsigned>{1, hw};
+        }
+
+    public:
+        Bench(Options opt) : opt(std::move(opt)), scratch(std::filesystem::temp_directory_path() / "cplot-bench")
+        {
+            std::filesystem::create_directories(scratch);
+        }
+
+        ~Bench()
+        {
+            std::error_code ignored;
+            std::filesystem::remove_all(scratch, ignored);
+        }
+
+        const std::vector<Result>& all() const { return results; }
+
+        //single pass parse and compile, against the tokenizer and shunting yard it replaced (which stop at RPN)
+        void parse()
+        {
+            std::printf("parse\n");
+            check_negation();
+
+            const int n = 2000;
+            for(auto& [name, expr] : corpus)
+            {
+                double ms = best_of(opt.reps, [&]()
+                {
+                    for(int i = 0; i < n; i++)
+                        Parsing::Expression<std::complex<double>> e(expr);
+                });
+                report(std::string("parse/") + name, 1000 * ms / n, "us", false);
+                report(std::string("parse/single-pass/") + name, n / ms * 1e3, "expr/s", true);
+
+                double legacy = best_of(opt.reps, [&]()
+                {
+                    for(int i = 0; i < n; i++)
+                    {
+                        auto tokens = Parsing::Token::tokenize(expr);
+                        Parsing::ParsingShunt().convert_to_rpn(tokens);
+                    }
+                });
+                report(std::string("parse/legacy/") + name, n / legacy * 1e3, "expr/s", true);
+            }
+        }
+
+        //a prefix minus binds looser than ^, in literals and otherwise, at run time and at compile time alike
+        void check_negation()
+        {
+            const std::pair<const char*, double> cases[] =
+            {
+                {"-z^2", -4}, {"-2^2", -4}, {"-sin(z)^2", -std::pow(std::sin(2.0), 2)}, {"2*-z^2", -8}, {"2^-z^2", 1.0 / 16},
+                {"-(z+1)^2", -9}, {"-2", -2}, {"-z*3", -6}, {"3-2^2", -1},
+            };
+            Parsing::Expression<std::complex<double>>::VarTable vars{};
+            vars['z'] = 2;
+            for(auto& [expr, expected] : cases)
+                if(std::abs(Parsing::Expression<std::complex<double>>(expr).evaluate_table(vars) - expected) > 1e-12)
+                    throw std::runtime_error(std::string("parse check failed for ") + expr);
+            if(std::abs(Parsing::StaticExpression<Negated>().evaluate_table(vars) - -16.0) > 1e-12)
+                throw std::runtime_error(std::string("parse check failed for static ") + std::string(Negated::source));
+        }
+
+        //single threaded interpreter throughput over a 1000x1000 sweep of the plot region
+        void evaluate()
+        {
+            std::printf("evaluate\n");
+            const int n = opt.quick ? 300 : 1000;
+            for(auto& [name, expr] : corpus)
+            {
+                Parsing::Expression<std::complex<double>> e(expr);
+                Parsing::Expression<std::complex<double>>::VarTable vars{};
+                std::complex<double> sum;
+
+                double ms = best_of(opt.reps, [&]()
+                {
+                    for(int i = 0; i < n; i++)
+                        for(int j = 0; j < n; j++)
+                        {
+                            vars['z'] = {(j - n / 2) * 20.0 / n, (n / 2 - i) * 20.0 / n};
+                            sum += e.evaluate_table(vars);
+                        }
+                });
+                report(std::string("evaluate/") + name, n * n / ms / 1e3, "Meval/s", true);
+
+                if(!opt.jit)
+                    continue;
+
+                auto start = std::chrono::steady_clock::now();
+                auto kernel = ComplexPlot::JitKernel::compile(e);
+                if(!kernel)
+                    continue;
+                report(std::string("jit-compile/") + name, elapsed_ms(start), "ms", false);
+
+                std::vector<std::complex<double>> row(n), out(n);
+                ms = best_of(opt.reps, [&]()
+                {
+                    for(int i = 0; i < n; i++)
+                    {
+                        for(int j = 0; j < n; j++)
+                            row[j] = {(j - n / 2) * 20.0 / n, (n / 2 - i) * 20.0 / n};
+                        kernel->evaluate(row.data(), out.data(), n, vars.data());
+                        sum += out[0];
+                    }
+                });
+                report(std::string("jit-evaluate/") + name, n * n / ms / 1e3, "Meval/s", true);
+            }
+        }
+
+        void colour()
+        {
+            std::printf("colour\n");
+            const int n = 1 << 20;
+            std::vector<std::complex<double>> values(n);
+            for(int i = 0; i < n; i++)
+                values[i] = std::polar(std::ldexp(1.0, i % 16 - 8), i * 0.001);
+            std::vector<unsigned char> out(3 * n);
+
+            double ms = best_of(opt.reps, [&]()
+            {
+                for(int i = 0; i < n; i++)
+                    ComplexPlot::cmplx_to_colour(out.data() + 3 * i, values[i]);
+            });
+            report("colour", n / ms / 1e3, "Mpix/s", true);
+        }
+
+        void render()
+        {
+            std::printf("render\n");
+            for(int size : sizes())
+            {
+                BitMap bitmap(size, size);
+                for(unsigned threads : thread_counts())
+                    for(auto& [name, expr] : corpus)
+                    {
+                        double ms = best_of(opt.reps, [&](){ bitmap.plot_complex_func(expr, 10, true, threads); });
+                        report("render/" + std::string(name) + "/" + std::to_string(size) + "/t" + std::to_string(threads),
+                               double(size) * size / ms / 1e3, "Mpix/s", true);
+                    }
+
+                //where a render's time goes, summed over threads
+                unsigned threads = thread_counts().back();
+                bitmap.set_instrumentation(true);
+                for(auto& [name, expr] : corpus)
+                {
+                    bitmap.plot_complex_func(expr, 10, true, threads);
+                    ComplexPlot::RenderStats render = bitmap.render_stats();
+                    ComplexPlot::ThreadStats total = render.total();
+                    std::string suffix = "/" + std::string(name) + "/" + std::to_string(size);
+                    report("phase-setup" + suffix, render.setup_ms, "ms", false);
+                    report("phase-evaluate" + suffix, total.evaluate_ms, "ms", false);
+                    report("phase-colour" + suffix, total.colour_ms, "ms", false);
+                    report("phase-grid" + suffix, total.grid_ms, "ms", false);
+                }
+                bitmap.set_instrumentation(false);
+
+                //tile-contiguous storage against the default rows, both 4 bytes per pixel
+                for(auto order : {ComplexPlot::PixelOrder::RowMajor, ComplexPlot::PixelOrder::Tiled})
+                {
+                    BitMap rgbx(size, size, ComplexPlot::PixelLayout::RGBX, false, order);
+                    std::string label = order == ComplexPlot::PixelOrder::Tiled ? "render-rgbx-tiled/" : "render-rgbx-rows/";
+                    for(auto& [name, expr] : corpus)
+                    {
+                        double ms = best_of(opt.reps, [&](){ rgbx.plot_complex_func(expr, 10, true, threads); });
+                        report(label + name + "/" + std::to_string(size), double(size) * size / ms / 1e3, "Mpix/s", true);
+                    }
+                }
+
+                //interpolating smooth tiles, at the interactive tolerance
+                bitmap.set_tile_culling(3);
+                for(auto& [name, expr] : corpus)
+                {
+                    double ms = best_of(opt.reps, [&](){ bitmap.plot_complex_func(expr, 10, true, threads); });
+                    report("render-cull/" + std::string(name) + "/" + std::to_string(size),
+                           double(size) * size / ms / 1e3, "Mpix/s", true);
+                }
+            }
+        }
+
+        //expressions with per-frame and per-row/column parts, with and without hoisting them out of the pixel loop
+        void hoist()
+        {
+            std::printf("hoist\n");
+            const std::pair<const char*, const char*> invariant[] =
+            {
+                {"frame", "sin(t)*cos(c)*z^2+exp(sin(t)+c)*z+sqrt(c*t)"},
+                {"row_column", "exp(imag(z))*sin(real(z))+z"},
+            };
+
+            for(int size : sizes())
+                for(auto& [name, expr] : invariant)
+                {
+                    BitMap bitmap(size, size);
+                    bitmap.set_variable('t', {0.3, 0.1});
+                    bitmap.set_variable('c', {1, -0.5});
+                    std::string suffix = std::string(name) + "/" + std::to_string(size);
+
+                    for(bool enabled : {false, true})
+                    {
+                        bitmap.set_hoisting(enabled);
+                        double ms = best_of(opt.reps, [&](){ bitmap.plot_complex_func(expr, 10, true, thread_counts().back()); });
+                        report(std::string(enabled ? "hoist-on/" : "hoist-off/") + suffix, double(size) * size / ms / 1e3, "Mpix/s", true);
+                    }
+                    report("hoist-ops-eliminated/" + suffix, bitmap.hoisting_stats().ops_eliminated / 1e6, "Mop", true);
+                }
+        }
+
+        //compile-time kernels against the interpreter on the same expression, per evaluation and per render
+        template<typename Source>
+        void static_kernel(const char* name)
+        {
+            const int n = opt.quick ? 300 : 1000;
+            Parsing::Expression<std::complex<double>> e{std::string(Source::source)};
+            Parsing::StaticExpression<Source> kernel;
+            Parsing::Expression<std::complex<double>>::VarTable vars{};
+            std::complex<double> sum;
+
+            auto sweep = [&](const auto& f)
+            {
+                return best_of(opt.reps, [&]()
+                {
+                    for(int i = 0; i < n; i++)
+                        for(int j = 0; j < n; j++)
+                        {
+                            vars['z'] = {(j - n / 2) * 20.0 / n, (n / 2 - i) * 20.0 / n};
+                            sum += f.evaluate_table(vars);
+                        }
+                });
+            };
+            double interpreted = sweep(e), compiled = sweep(kernel);
+            report(std::string("static-eval/") + name, n * n / compiled / 1e3, "Meval/s", true);
+            report(std::string("static-eval-speedup/") + name, interpreted / compiled, "x", true);
+
+            for(int size : sizes())
+            {
+                BitMap bitmap(size, size);
+                ComplexPlot::Viewport view{{0, 0}, 3};
+                std::string suffix = std::string(name) + "/" + std::to_string(size);
+
+                interpreted = best_of(opt.reps, [&](){ bitmap.plot_complex_func(std::string(Source::source), view, true, thread_counts().back()); });
+                compiled = best_of(opt.reps, [&](){ bitmap.plot_static<Parsing::StaticExpression<Source>>(view, true, thread_counts().back()); });
+                report("static-render/" + suffix, double(size) * size / compiled / 1e3, "Mpix/s", true);
+                report("static-render-speedup/" + suffix, interpreted / compiled, "x", true);
+            }
+        }
+
+        void kernels()
+        {
+            std::printf("static kernels\n");
+            static_kernel<Poly>("poly");
+            static_kernel<Rational>("rational");
+            static_kernel<Poles>("poles");
+            static_kernel<Horner>("horner");
+        }
+
+        //a report panel of related functions, as separate renders and as one fused pass
+        void fused()
+        {
+            std::printf("fused\n");
+            const std::string f = "(z^3-1)/(z^2+i)";
+            const std::vector<std::string> panel = {f, "real(" + f + ")", "abs(" + f + ")", "1/(" + f + ")"};
+
+            for(int size : sizes())
+            {
+                std::vector<std::unique_ptr<BitMap>> bitmaps;
+                std::vector<BitMap*> outputs;
+                for(std::size_t k = 0; k < panel.size(); k++)
+                {
+                    bitmaps.push_back(std::make_unique<BitMap>(size, size));
+                    outputs.push_back(bitmaps.back().get());
+                }
+                ComplexPlot::Viewport view{{0, 0}, 3};
+
+                double separate = best_of(opt.reps, [&]()
+                {
+                    for(std::size_t k = 0; k < panel.size(); k++)
+                        outputs[k]->plot_complex_func(panel[k], view, true, thread_counts().back());
+                });
+                double fused = best_of(opt.reps, [&](){ BitMap::plot_complex_funcs(panel, outputs, view, true, thread_counts().back()); });
+
+                std::string suffix = "panel4/" + std::to_string(size);
+                report("fused/" + suffix, double(size) * size * panel.size() / fused / 1e3, "Mpix/s", true);
+                report("fused-speedup/" + suffix, separate / fused, "x", true);
+            }
+        }
+
+        //perturbation renders next to plain ones over the same view, then far past where doubles give out
+        void deep()
+        {
+            std::printf("deep\n");
+            for(int size : sizes())
+                for(const char* expr : {"(z^3-1)/(z^2+i)", "sin(z)/z"})
+                {
+                    BitMap bitmap(size, size);
+                    std::string suffix = std::string(expr) + "/" + std::to_string(size);
+                    ComplexPlot::DeepViewport view{ComplexPlot::ComplexDD(std::complex<double>{0.3, 0.7}), 2};
+
+                    double plain = best_of(opt.reps, [&](){ bitmap.plot_complex_func(expr, ComplexPlot::Viewport{{0.3, 0.7}, 2}, false, thread_counts().back()); });
+                    double deep = best_of(opt.reps, [&](){ bitmap.plot_complex_deep(expr, view, thread_counts().back()); });
+                    report("deep/" + suffix, double(size) * size / deep / 1e3, "Mpix/s", true);
+                    report("deep-slowdown/" + suffix, deep / plain, "x", false);
+
+                    view = {{ComplexPlot::DoubleDouble::from_string("0.300000000000000000001"), 0.7}, 1e-20};
+                    double zoomed = best_of(opt.reps, [&](){ bitmap.plot_complex_deep(expr, view, thread_counts().back()); });
+                    report("deep-1e-20/" + suffix, double(size) * size / zoomed / 1e3, "Mpix/s", true);
+                }
+        }
+
+        //time until the tiles around the centre are done, taken centre first and in memory order
+        void focus()
+        {
+            std::printf("focus\n");
+            for(int size : sizes())
+            {
+                BitMap bitmap(size, size);
+                ComplexPlot::Focus centre;
+                centre.radius = size / 8.0;
+                for(auto& [name, expr] : corpus)
+                {
+                    std::string suffix = std::string(name) + "/" + std::to_string(size);
+
+                    bitmap.set_instrumentation(true);
+                    double memory_order = 1e300;
+                    for(int r = 0; r < opt.reps; r++)
+                    {
+                        bitmap.plot_complex_func(expr, 10, true, thread_counts().back());
+                        double done = 0;
+                        for(const auto& t : bitmap.render_stats().tiles)
+                            if(std::hypot(std::max({t.col - size / 2.0, size / 2.0 - (t.col + 32), 0.0}),
+                                          std::max({t.row - size / 2.0, size / 2.0 - (t.row + 32), 0.0})) <= centre.radius)
+                                done = std::max(done, t.end_ms);
+                        memory_order = std::min(memory_order, done);
+                    }
+                    bitmap.set_instrumentation(false);
+
+                    bitmap.set_focus(centre);
+                    double focused = 1e300;
+                    for(int r = 0; r < opt.reps; r++)
+                    {
+                        bitmap.plot_complex_func(expr, 10, true, thread_counts().back());
+                        focused = std::min(focused, bitmap.last_focus_ms());
+                    }
+                    bitmap.clear_focus();
+
+                    report("focus-memory-order/" + suffix, memory_order, "ms", false);
+                    report("focus-centre-first/" + suffix, focused, "ms", false);
+                }
+            }
+        }
+
+        //a window widened by an eighth at the same scale, rendered fresh and taking over the previous frame's samples
+        void resize()
+        {
+            std::printf("resize\n");
+            for(int size : sizes())
+                for(auto& [name, expr] : corpus)
+                {
+                    std::string suffix = std::string(name) + "/" + std::to_string(size);
+                    BitMap fresh(size + size / 8, size), reusing(size, size);
+                    reusing.set_sample_reuse(true);
+
+                    double from_scratch = best_of(opt.reps, [&](){ fresh.plot_complex_func(expr, 10, true, thread_counts().back()); });
+                    double reused = 1e300, fraction = 0;
+                    for(int r = 0; r < opt.reps; r++)
+                    {
+                        reusing.resize(size, size);
+                        reusing.plot_complex_func(expr, 10, true, thread_counts().back());
+                        reusing.resize(size + size / 8, size);
+                        reusing.plot_complex_func(expr, 10, true, thread_counts().back());
+                        reused = std::min(reused, reusing.last_frame_ms());
+                        fraction = reusing.reused_fraction();
+                    }
+                    report("resize-fresh/" + suffix, from_scratch, "ms", false);
+                    report("resize-reusing/" + suffix, reused, "ms", false);
+                    report("resize-reused-fraction/" + suffix, 100 * fraction, "%", true);
+                }
+        }
+
+        //the zero and pole locator as a share of the render it runs inside
+        void roots()
+        {
+            std::printf("roots\n");
+            for(int size : sizes())
+                for(const char* expr : {"(z^3-1)/(z^2+i)", "1/(z^4-1)+1/z", "z^2*(z-1)^3/(z+1)^2"})
+                {
+                    BitMap bitmap(size, size);
+                    ComplexPlot::Viewport view{{0, 0}, 3};
+                    std::string suffix = std::string(expr) + "/" + std::to_string(size);
+
+                    double plain = best_of(opt.reps, [&](){ bitmap.plot_complex_func(expr, view, true, thread_counts().back()); });
+                    bitmap.set_root_finding(true);
+                    double locate = 1e300;
+                    double located = best_of(opt.reps, [&]()
+                    {
+                        bitmap.plot_complex_func(expr, view, true, thread_counts().back());
+                        locate = std::min(locate, bitmap.last_roots_ms());
+                    });
+                    report("roots/" + suffix, locate, "ms", false);
+                    report("roots-overhead/" + suffix, 100 * (located - plain) / plain, "%", false);
+                }
+        }
+
+        //the histogram pass before each render, and what it adds to the frame
+        void exposure()
+        {
+            std::printf("exposure\n");
+            for(int size : sizes())
+                for(const char* expr : {"exp(z)", "z^8*1000"})
+                {
+                    BitMap bitmap(size, size);
+                    ComplexPlot::Viewport view{{0, 0}, 4};
+                    std::string suffix = std::string(expr) + "/" + std::to_string(size);
+
+                    double plain = best_of(opt.reps, [&](){ bitmap.plot_complex_func(expr, view, true, thread_counts().back()); });
+                    bitmap.set_auto_exposure(true);
+                    double histogram = 1e300;
+                    double exposed = best_of(opt.reps, [&]()
+                    {
+                        bitmap.plot_complex_func(expr, view, true, thread_counts().back());
+                        histogram = std::min(histogram, bitmap.last_exposure_ms());
+                    });
+                    report("exposure-histogram/" + suffix, histogram, "ms", false);
+                    report("exposure-overhead/" + suffix, 100 * (exposed - plain) / plain, "%", false);
+                }
+        }
+
+        //contour tracing over the rendered field, the parts timed separately and as a share of the plain render
+        void contours()
+        {
+            std::printf("contours\n");
+            for(int size : sizes())
+                for(const char* expr : {"(z^3-1)/(z^2+i)", "exp(sin(z))", "sqrt(z)"})
+                {
+                    BitMap bitmap(size, size);
+                    ComplexPlot::Viewport view{{0, 0}, 3};
+                    std::string suffix = std::string(expr) + "/" + std::to_string(size);
+
+                    double plain = best_of(opt.reps, [&](){ bitmap.plot_complex_func(expr, view, true, thread_counts().back()); });
+                    bitmap.set_contours(true);
+                    ComplexPlot::ContourStats best;
+                    best.extract_ms = best.stitch_ms = best.draw_ms = 1e300;
+                    double traced = best_of(opt.reps, [&]()
+                    {
+                        bitmap.plot_complex_func(expr, view, true, thread_counts().back());
+                        ComplexPlot::ContourStats stats = bitmap.contours().stats;
+                        best.extract_ms = std::min(best.extract_ms, stats.extract_ms);
+                        best.stitch_ms = std::min(best.stitch_ms, stats.stitch_ms);
+                        best.draw_ms = std::min(best.draw_ms, stats.draw_ms);
+                    });
+                    report("contours-extract/" + suffix, best.extract_ms, "ms", false);
+                    report("contours-stitch/" + suffix, best.stitch_ms, "ms", false);
+                    report("contours-draw/" + suffix, best.draw_ms, "ms", false);
+                    report("contours-overhead/" + suffix, 100 * (traced - plain) / plain, "%", false);
+                }
+        }
+
+        //sustained rate with encoding overlapped, and the same frames rendered then saved one after another
+        void animate()
+        {
+            std::printf("animate\n");
+            const char* expr = "z^2+c*exp(i*t)";
+            ComplexPlot::AnimationOptions options;
+            options.frames = opt.quick ? 8 : 30;
+            options.t_end = 6.28;
+            options.nthreads = thread_counts().back();
+
+            for(int size : sizes())
+            {
+                BitMap bitmap(size, size);
+                bitmap.set_variable('c', {0.5, 0.5});
+                std::string file = (scratch / "anim").string();
+
+                double pipelined = 1e300;
+                for(int i = 0; i < opt.reps; i++)
+                    pipelined = std::min(pipelined, bitmap.animate(expr, file, options).wall_ms);
+
+                double sequential = best_of(opt.reps, [&]()
+                {
+                    for(int frame = 0; frame < options.frames; frame++)
+                    {
+                        bitmap.set_variable('t', options.t_end * frame / (options.frames - 1));
+                        bitmap.plot_complex_func(expr, options.maxval, options.grid, options.nthreads);
+                        bitmap.save_jpeg(file + "_" + std::to_string(frame));
+                    }
+                });
+
+                report("animate/pipelined/" + std::to_string(size), 1000 * options.frames / pipelined, "fps", true);
+                report("animate/sequential/" + std::to_string(size), 1000 * options.frames / sequential, "fps", true);
+            }
+        }
+
+        void encode()
+        {
+            std::printf("encode\n");
+            const std::pair<const char*, ComplexPlot::JpegOptions> jpeg_modes[] =
+            {
+                {"jpeg",             {}},
+                {"jpeg-q90-420",     {90, true, false, false}},
+                {"jpeg-optimized",   {90, true, true, false}},
+                {"jpeg-progressive", {90, true, true, true}},
+            };
+
+            for(int size : sizes())
+            {
+                BitMap bitmap(size, size);
+                bitmap.plot_complex_func(corpus[2].second, 10, true, thread_counts().back());
+                std::string suffix = "/" + std::to_string(size);
+                std::string file = (scratch / "frame").string();
+
+                //time and bytes written per format, the writers return the size except save_jpeg
+                for(auto& [name, options] : jpeg_modes)
+                {
+                    report("encode/" + std::string(name) + suffix, best_of(opt.reps, [&](){ bitmap.save_jpeg(file, options); }), "ms", false);
+                    report("encode-bytes/" + std::string(name) + suffix, (double)std::filesystem::file_size(file + ".jpg"), "bytes", false);
+                }
+
+                std::size_t bytes = 0;
+                report("encode/png-fast" + suffix, best_of(opt.reps, [&](){ bytes = bitmap.save_png(file, true); }), "ms", false);
+                report("encode-bytes/png-fast" + suffix, (double)bytes, "bytes", false);
+                report("encode/png-adaptive" + suffix, best_of(opt.reps, [&](){ bytes = bitmap.save_png(file, false); }), "ms", false);
+                report("encode-bytes/png-adaptive" + suffix, (double)bytes, "bytes", false);
+                report("encode/ppm" + suffix, best_of(opt.reps, [&](){ bytes = bitmap.save_ppm(file); }), "ms", false);
+                report("encode-bytes/ppm" + suffix, (double)bytes, "bytes", false);
+                report("encode/raw" + suffix, best_of(opt.reps, [&](){ bytes = bitmap.save_raw(file); }), "ms", false);
+                report("encode-bytes/raw" + suffix, (double)bytes, "bytes", false);
+            }
+        }
+    };
+
+    void write_json(const std::string& filename, const std::vector<Result>& results)
+    {
+        std::ofstream out(filename);
+        if(!out)
+            throw std::runtime_error("Cannot write " + filename);
+
+        out << "{\n  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n  \"results\": [\n";
+        for(std::size_t i = 0; i < results.size(); i++)
+        {
+            const Result& r = results[i];
+            out << "    {\"name\": \"" << r.name << "\", \"value\": " << r.value << ", \"unit\": \"" << r.unit
+                << "\", \"better\": \"" << (r.higher_is_better ? "higher" : "lower") << "\"}" << (i + 1 < results.size() ? ",\n" : "\n");
+        }
+        out << "  ]\n}\n";
+    }
+
+    //reads back what write_json produced, one result per line
+    std::map<std::string, Result> read_json(const std::string& filename)
+    {
+        std::ifstream in(filename);
+        if(!in)
+            throw std::runtime_error("Cannot read " + filename);
+
+        auto field = [](const std::string& line, const std::string& key) -> std::string
+        {
+            std::size_t pos = line.find("\"" + key + "\": ");
+            if(pos == std::string::npos)
+                return "";
+            pos += key.size() + 4;
+            if(line[pos] == '"')
+                return line.substr(pos + 1, line.find('"', pos + 1) - pos - 1);
+            return line.substr(pos, line.find_first_of(",}", pos) - pos);
+        };
+
+        std::map<std::string, Result> results;
+        for(std::string line; std::getline(in, line);)
+        {
+            std::string name = field(line, "name");
+            if(!name.empty())
+                results[name] = {name, std::stod(field(line, "value")), field(line, "unit"), field(line, "better") == "higher"};
+        }
+        return results;
+    }
+
+    //number of metrics more than threshold percent worse than the baseline. overheads in % and ratios in x are
+    //derived from two timings and carry the noise of both, so they are left out rather than gated on a relative change
+    int compare(const std::vector<Result>& results, const std::map<std::string, Result>& baseline, double threshold)
+    {
+        int regressions = 0, derived = 0;
+        std::printf("\ncompared with baseline (threshold %.1f%%)\n", threshold);
+        for(const Result& r : results)
+        {
+            auto it = baseline.find(r.name);
+            if(it == baseline.end() || it->second.value <= 0)
+                continue;
+            if(r.unit == "%" || r.unit == "x")
+            {
+                derived++;
+                continue;
+            }
+
+            double change = 100 * (r.value - it->second.value) / it->second.value;
+            double worse = r.higher_is_better ? -change : change;
+            if(worse > threshold)
+            {
+                std::printf("  REGRESSION %-40s %12.3f -> %12.3f %s (%+.1f%%)\n", r.name.c_str(), it->second.value, r.value, r.unit.c_str(), change);
+                regressions++;
+            }
+        }
+        std::printf("  %d regression%s, %d derived metric%s not gated\n", regressions, regressions == 1 ? "" : "s", derived, derived == 1 ? "" : "s");
+        return regressions;
+    }
+
+    Options parse_args(int argc, char** argv)
+    {
+        Options opt;
+        for(int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string
+            {
+                if(i + 1 >= argc)
+                    throw std::invalid_argument(arg + " needs a value");
+                return argv[++i];
+            };
+
+            if(arg == "--quick") opt.quick = true;
+            else if(arg == "--jit") opt.jit = true;
+            else if(arg == "--reps") opt.reps = std::max(1, std::stoi(value()));
+            else if(arg == "--json") opt.json = value();
+            else if(arg == "--compare") opt.compare = value();
+            else if(arg == "--threshold") opt.threshold = std::stod(value());
+            else throw std::invalid_argument("Unknown option " + arg);
+        }
+        return opt;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        Options opt = parse_args(argc, argv);
+        Bench bench(opt);
+
+        bench.parse();
+        bench.evaluate();
+        bench.colour();
+        bench.render();
+        bench.encode();
+        bench.hoist();
+        bench.kernels();
+        bench.fused();
+        bench.deep();
+        bench.focus();
+        bench.resize();
+        bench.roots();
+        bench.contours();
+        bench.exposure();
+        bench.animate();
+
+        if(!opt.json.empty())
+            write_json(opt.json, bench.all());
+
+        if(!opt.compare.empty())
+            return compare(bench.all(), read_json(opt.compare), opt.threshold) ? 1 : 0;
+    }
+    catch(std::exception& e)
+    {
+        std::fprintf(stderr, "cplot-bench: %s\n"
+                             "usage: cplot-bench [--quick] [--reps n] [--jit] [--json out.json] [--compare baseline.json] [--threshold percent]\n", e.what());
+        return 2;
+    }
+    return 0;
+}
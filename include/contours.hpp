@@ -0,0 +1,72 @@
+#ifndef CONTOURS_HPP
+#define CONTOURS_HPP
+
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "sampled_field.hpp"
+
+namespace ComplexPlot
+{
+    struct ContourOptions
+    {
+        std::vector<double> magnitudes = {0.125, 0.25, 0.5, 1, 2, 4, 8}; //lines of |f| = each
+        int phases = 8;             //lines of arg f = 2 pi k / phases, 0 for none
+        bool overlay = true;        //draw the lines into the frame
+        double line_width = 1.2;    //pixels
+        double opacity = 0.8;
+        std::array<unsigned char, 3> magnitude_colour = {255, 255, 255}, phase_colour = {0, 0, 0};
+    };
+
+    struct ContourPoint
+    {
+        double x, y; //column and row in the frame, fractional
+    };
+
+    struct Contour
+    {
+        bool phase;   //arg f = level, otherwise |f| = level
+        double level; //phases in (-pi, pi]
+        bool closed;
+        std::vector<ContourPoint> points;
+    };
+
+    //contour work of one frame, apart from evaluating f
+    struct ContourStats
+    {
+        double fill_ms = 0;    //evaluating pixels the render skipped, grid lines and interpolated tiles
+        double extract_ms = 0; //marching squares and joining the pieces within each tile
+        double stitch_ms = 0;  //joining pieces across tile borders
+        double draw_ms = 0;
+        std::size_t segments = 0;
+    };
+
+    struct ContourSet
+    {
+        std::vector<Contour> contours;
+        ContourStats stats;
+        int width = 0, height = 0;
+    };
+
+    //level curves through a field with no NaN samples left, by marching squares over log |f| and f / |f|.
+    //square blocks of cell x cell pixels are traced in parallel on nthreads, each joining its own segments
+    //into polylines, and the pieces ending on block borders are joined afterwards. fills extract_ms, stitch_ms
+    //and segments of stats
+    std::vector<Contour> extract_contours(const SampledField& field, const ContourOptions& options, int cell,
+                                          unsigned int nthreads, ContourStats& stats);
+
+    //antialiased lines for each pixel they cover, in blocks of cell x cell pixels on nthreads.
+    //blend(row, col, magnitude_coverage, phase_coverage) is called once per covered pixel
+    using ContourBlend = std::function<void(int row, int col, float magnitude_coverage, float phase_coverage)>;
+
+    void rasterize_contours(const std::vector<Contour>& contours, int width, int height, double line_width, int cell,
+                            unsigned int nthreads, const ContourBlend& blend);
+
+    //the contours as SVG paths, over a PNG of the frame when png isn't empty
+    std::string contours_svg(const ContourSet& set, const ContourOptions& options, const std::vector<unsigned char>& png);
+}
+
+#endif
@@ -0,0 +1,410 @@
+#ifndef DEEP_ZOOM_HPP
+#define DEEP_ZOOM_HPP
+
+#include <array>
+#include <cmath>
+#include <complex>
+#include <string>
+#include <vector>
+
+#include "expr_parsing_cpp/parsing.hpp"
+
+namespace ComplexPlot
+{
+namespace DeepZoom //kept apart so sqrt etc. here don't hide the std overloads used by the renderer
+{
+    //unevaluated sum hi + lo with |lo| <= ulp(hi) / 2, about 32 significant digits
+    struct DoubleDouble
+    {
+        double hi = 0, lo = 0;
+
+        DoubleDouble() = default;
+        DoubleDouble(double v) : hi(v) {}
+        DoubleDouble(double hi, double lo) : hi(hi), lo(lo) {}
+
+        explicit operator double() const { return hi + lo; }
+
+        //decimal notation as in strtod, e.g. "-0.7436438870371587522" or "1.25e-3". throws std::invalid_argument
+        static DoubleDouble from_string(const std::string& text);
+    };
+
+    inline DoubleDouble quick_two_sum(double a, double b) //needs |a| >= |b|
+    {
+        double s = a + b;
+        return {s, b - (s - a)};
+    }
+
+    inline DoubleDouble two_sum(double a, double b)
+    {
+        double s = a + b, bb = s - a;
+        return {s, (a - (s - bb)) + (b - bb)};
+    }
+
+    inline DoubleDouble operator-(DoubleDouble a) { return {-a.hi, -a.lo}; }
+
+    inline DoubleDouble operator+(DoubleDouble a, DoubleDouble b)
+    {
+        DoubleDouble s = two_sum(a.hi, b.hi), t = two_sum(a.lo, b.lo);
+        s = quick_two_sum(s.hi, s.lo + t.hi);
+        return quick_two_sum(s.hi, s.lo + t.lo);
+    }
+
+    inline DoubleDouble operator-(DoubleDouble a, DoubleDouble b) { return a + -b; }
+
+    inline DoubleDouble operator*(DoubleDouble a, DoubleDouble b)
+    {
+        double p = a.hi * b.hi;
+        double e = std::fma(a.hi, b.hi, -p) + (a.hi * b.lo + a.lo * b.hi);
+        return quick_two_sum(p, e);
+    }
+
+    inline DoubleDouble operator/(DoubleDouble a, DoubleDouble b)
+    {
+        double q1 = a.hi / b.hi;
+        DoubleDouble r = a - b * q1;
+        double q2 = r.hi / b.hi;
+        r = r - b * q2;
+        return quick_two_sum(q1, q2) + r.hi / b.hi;
+    }
+
+    inline DoubleDouble sqrt(DoubleDouble a)
+    {
+        if(a.hi <= 0) return std::sqrt(a.hi);
+        double x = std::sqrt(a.hi);
+        return DoubleDouble(x) + (a - DoubleDouble(x) * x).hi / (2 * x); //one newton step doubles the digits
+    }
+
+    inline DoubleDouble DoubleDouble::from_string(const std::string& text)
+    {
+        std::size_t i = 0;
+        bool negative = false;
+        if(i < text.size() && (text[i] == '-' || text[i] == '+'))
+            negative = text[i++] == '-';
+
+        DoubleDouble value;
+        int digits = 0, scale = 0;
+        bool point = false;
+        for(; i < text.size(); ++i)
+        {
+            if(text[i] == '.' && !point)
+                point = true;
+            else if(text[i] >= '0' && text[i] <= '9')
+            {
+                value = value * 10.0 + double(text[i] - '0');
+                digits++;
+                scale -= point;
+            }
+            else
+                break;
+        }
+        if(i < text.size() && (text[i] == 'e' || text[i] == 'E'))
+        {
+            std::size_t used = 0;
+            try { scale += std::stoi(text.substr(i + 1), &used); } catch(std::exception&) { used = 0; }
+            i += 1 + used;
+            if(!used) digits = 0;
+        }
+        if(!digits || i != text.size())
+            throw std::invalid_argument("Bad number " + text);
+
+        DoubleDouble power = 1.0;
+        for(int k = 0; k < std::abs(scale); ++k)
+            power = power * 10.0;
+        value = scale < 0 ? value / power : value * power;
+        return negative ? -value : value;
+    }
+
+    struct ComplexDD
+    {
+        DoubleDouble re, im;
+
+        ComplexDD() = default;
+        ComplexDD(DoubleDouble re, DoubleDouble im = 0.0) : re(re), im(im) {}
+        ComplexDD(std::complex<double> v) : re(v.real()), im(v.imag()) {}
+
+        std::complex<double> rounded() const { return {double(re), double(im)}; }
+    };
+
+    inline ComplexDD operator+(ComplexDD a, ComplexDD b) { return {a.re + b.re, a.im + b.im}; }
+
+    inline ComplexDD operator-(ComplexDD a, ComplexDD b) { return {a.re - b.re, a.im - b.im}; }
+
+    inline ComplexDD operator*(ComplexDD a, ComplexDD b) { return {a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re}; }
+
+    inline ComplexDD operator/(ComplexDD a, ComplexDD b)
+    {
+        DoubleDouble d = b.re * b.re + b.im * b.im;
+        return {(a.re * b.re + a.im * b.im) / d, (a.im * b.re - a.re * b.im) / d};
+    }
+
+    //exp(w) - 1 and log(1 + w) without the cancellation of computing them directly for small w
+    inline std::complex<double> expm1(std::complex<double> w)
+    {
+        double s = std::sin(w.imag() / 2);
+        return {std::expm1(w.real()) * std::cos(w.imag()) - 2 * s * s, std::exp(w.real()) * std::sin(w.imag())};
+    }
+
+    inline std::complex<double> log1p(std::complex<double> w)
+    {
+        return {0.5 * std::log1p(2 * w.real() + std::norm(w)), std::atan2(w.imag(), 1 + w.real())};
+    }
+
+    //f(centre + dz) for small dz. the centre is held to double-double precision and the value of every
+    //subexpression there is computed once per frame, in double-double for + - * / and integer powers. a pixel
+    //only evaluates how far each subexpression moves from its reference value, in double, so pixel spacing
+    //can go far below the centre's ulp without neighbouring pixels collapsing onto the same value
+    class Perturbation
+    {
+    public:
+        Perturbation(const Parsing::Expression<std::complex<double>>& expr, ComplexDD centre,
+                     const Parsing::Expression<std::complex<double>>::VarTable& vars, char var = 'z')
+        {
+            std::vector<ComplexDD> refs;
+            std::vector<bool> varying, valid;
+            std::vector<std::size_t> stack;
+            const auto& program = expr.instructions();
+            steps.reserve(program.size());
+            ComplexDD base = {centre.re.hi, centre.im.hi}; //the rest of the centre is added to every pixel's dz
+            offset = {centre.re.lo, centre.im.lo};
+
+            for(const auto& ins : program)
+            {
+                Step s = {ins.op};
+                ComplexDD ref;
+                bool moves = false, ok = true;
+
+                if(ins.op == Parsing::Op::Number)
+                    ref = ins.value;
+                else if(ins.op == Parsing::Op::Variable)
+                {
+                    moves = ins.var == var;
+                    ref = moves ? base : ComplexDD(vars[(unsigned char)ins.var]);
+                }
+                else if(Parsing::is_unary(ins.op))
+                {
+                    std::size_t a = stack.back();
+                    stack.pop_back();
+                    s.ra = refs[a].rounded();
+                    moves = varying[a];
+                    ok = valid[a];
+
+                    if(ins.op == Parsing::Op::Real) ref = refs[a].re;
+                    else if(ins.op == Parsing::Op::Imag) ref = refs[a].im;
+                    else if(ins.op == Parsing::Op::Abs) ref = sqrt(refs[a].re * refs[a].re + refs[a].im * refs[a].im);
+                    else ref = Parsing::apply_unary(ins.op, s.ra);
+
+                    if(ins.op == Parsing::Op::Exp) s.aux = ref.rounded();
+                    if(ins.op == Parsing::Op::Tan) s.aux = std::cos(s.ra);
+                }
+                else
+                {
+                    std::size_t b = stack.back();
+                    stack.pop_back();
+                    std::size_t a = stack.back();
+                    stack.pop_back();
+                    s.ra = refs[a].rounded();
+                    s.rb = refs[b].rounded();
+                    moves = varying[a] || varying[b];
+                    ok = valid[a] && valid[b];
+
+                    switch(ins.op)
+                    {
+                        case Parsing::Op::Add: ref = refs[a] + refs[b]; break;
+                        case Parsing::Op::Sub: ref = refs[a] - refs[b]; break;
+                        case Parsing::Op::Mul: ref = refs[a] * refs[b]; break;
+                        case Parsing::Op::Div: ref = refs[a] / refs[b]; break;
+                        default: ref = power(s, refs[a], varying[b]); break;
+                    }
+                }
+
+                s.r = ref.rounded();
+                s.varying = moves;
+                s.valid = ok && std::isfinite(s.r.real()) && std::isfinite(s.r.imag());
+                steps.push_back(s);
+                refs.push_back(ref);
+                varying.push_back(moves);
+                valid.push_back(s.valid);
+                stack.push_back(refs.size() - 1);
+            }
+            depth = program.size();
+        }
+
+        std::complex<double> reference() const { return steps.back().valid ? steps.back().r : std::complex<double>(NAN, NAN); }
+
+        //f(centre + dz)
+        std::complex<double> evaluate(std::complex<double> dz) const
+        {
+            if(depth <= 32)
+            {
+                std::array<Entry, 32> stack;
+                return run(stack.data(), dz + offset);
+            }
+            std::vector<Entry> stack(depth);
+            return run(stack.data(), dz + offset);
+        }
+
+    private:
+        using C = std::complex<double>;
+
+        struct Step
+        {
+            Parsing::Op op;
+            C ra{}, rb{}, r{}, aux{}; //operand and result references, aux holds what a step needs besides them
+            bool varying = false, valid = true;
+            int exponent = 0; //integer power by binomial expansion when nonzero
+            std::vector<C> coeffs{};
+        };
+
+        //a step's value as its offset from the reference, or the value itself where the reference is
+        //invalid, e.g. the centre sits on a pole
+        struct Entry
+        {
+            C v;
+            bool delta;
+        };
+
+        std::vector<Step> steps;
+        C offset;
+        std::size_t depth = 0;
+
+        ComplexDD power(Step& s, const ComplexDD& a, bool exponent_varies)
+        {
+            double n = s.rb.real();
+            if(!exponent_varies && s.rb.imag() == 0 && n == std::round(n) && std::abs(n) <= 64 && n != 0)
+            {
+                //(R + d)^m - R^m = sum over k of C(m, k) R^(m-k) d^k, coefficients fixed per frame
+                int m = (int)std::abs(n);
+                s.exponent = (int)n;
+                s.coeffs.resize(m);
+                double binomial = 1;
+                for(int k = 1; k <= m; ++k)
+                {
+                    binomial = binomial * (m - k + 1) / k;
+                    s.coeffs[k - 1] = binomial * std::pow(s.ra, m - k);
+                }
+
+                ComplexDD result = DoubleDouble(1.0), square = a;
+                for(int e = m; e; e >>= 1, square = square * square)
+                    if(e & 1) result = result * square;
+                s.aux = result.rounded(); //R^m
+                return n < 0 ? ComplexDD(DoubleDouble(1.0)) / result : result;
+            }
+
+            s.aux = std::log(s.ra);
+            return C(std::pow(s.ra, s.rb));
+        }
+
+        //log(r + d) - log(r), on the branch std::log takes even where r + d is across the cut from r
+        static C log_offset(C r, C d)
+        {
+            C l = log1p(d / r);
+            double direct = std::arg(r + d) - std::arg(r);
+            if(std::abs(l.imag() - direct) > M_PI)
+                l.imag(l.imag() + 2 * M_PI * std::round((direct - l.imag()) / (2 * M_PI)));
+            return l;
+        }
+
+        static C unary_delta(const Step& s, C d)
+        {
+            C full = s.ra + d;
+            switch(s.op)
+            {
+                case Parsing::Op::Real: return d.real();
+                case Parsing::Op::Imag: return d.imag();
+                case Parsing::Op::Exp: return s.aux * expm1(d);
+                case Parsing::Op::Sin: return 2.0 * std::cos(s.ra + d / 2.0) * std::sin(d / 2.0);
+                case Parsing::Op::Cos: return -2.0 * std::sin(s.ra + d / 2.0) * std::sin(d / 2.0);
+                case Parsing::Op::Tan: return std::sin(d) / (std::cos(full) * s.aux);
+                case Parsing::Op::Sqrt:
+                {
+                    C sum = std::sqrt(full) + s.r;
+                    return std::abs(sum) >= std::abs(s.r) ? d / sum : std::sqrt(full) - s.r; //the second across the branch cut
+                }
+                case Parsing::Op::Abs:
+                {
+                    double sum = std::abs(full) + std::abs(s.ra);
+                    return sum > 0 ? (2 * (s.ra.real() * d.real() + s.ra.imag() * d.imag()) + std::norm(d)) / sum : 0.0;
+                }
+                case Parsing::Op::Ln:
+                case Parsing::Op::Log:
+                case Parsing::Op::Arg:
+                {
+                    C l = log_offset(s.ra, d);
+                    if(s.op == Parsing::Op::Arg) return l.imag();
+                    return s.op == Parsing::Op::Ln ? l : l / std::log(10.0);
+                }
+                default: //inverse trig: plain difference
+                    return Parsing::apply_unary(s.op, full) - s.r;
+            }
+        }
+
+        static C binary_delta(const Step& s, C da, C db)
+        {
+            switch(s.op)
+            {
+                case Parsing::Op::Add: return da + db;
+                case Parsing::Op::Sub: return da - db;
+                case Parsing::Op::Mul: return s.ra * db + da * s.rb + da * db;
+                case Parsing::Op::Div: return (da * s.rb - s.ra * db) / (s.rb * (s.rb + db));
+                default: break;
+            }
+
+            if(s.exponent)
+            {
+                C p = s.coeffs.back();
+                for(std::size_t k = s.coeffs.size() - 1; k-- > 0;)
+                    p = p * da + s.coeffs[k];
+                p *= da;
+                return s.exponent > 0 ? p : -p / (s.aux * (s.aux + p));
+            }
+            if(s.ra == 0.0)
+                return std::pow(s.ra + da, s.rb + db) - s.r;
+
+            //a^b = exp(b log a), so the offset is r (exp(dL) - 1) with dL the offset of b log a
+            C dlog = log_offset(s.ra, da);
+            return s.r * expm1(db * s.aux + s.rb * dlog + db * dlog);
+        }
+
+        C run(Entry* stack, C dz) const
+        {
+            Entry* top = stack;
+            for(const auto& s : steps)
+            {
+                if(s.op == Parsing::Op::Number || s.op == Parsing::Op::Variable)
+                {
+                    *top++ = s.valid ? Entry{s.varying ? dz : 0.0, true} : Entry{s.r, false};
+                    continue;
+                }
+
+                bool unary = Parsing::is_unary(s.op);
+                Entry a = unary ? top[-1] : top[-2], b = unary ? Entry{0.0, true} : top[-1];
+                if(!unary) --top;
+
+                if(!s.varying)
+                    top[-1] = s.valid ? Entry{0.0, true} : Entry{s.r, false};
+                else if(s.valid)
+                    top[-1] = {unary ? unary_delta(s, a.v) : binary_delta(s, a.v, b.v), true};
+                else
+                {
+                    C x = a.delta ? s.ra + a.v : a.v;
+                    top[-1] = {unary ? Parsing::apply_unary(s.op, x) : Parsing::apply_binary(s.op, x, b.delta ? s.rb + b.v : b.v), false};
+                }
+            }
+            return stack[0].delta ? steps.back().r + stack[0].v : stack[0].v;
+        }
+    };
+}
+
+    using DeepZoom::DoubleDouble;
+    using DeepZoom::ComplexDD;
+    using DeepZoom::Perturbation;
+
+    //a viewport for zooming past the ~1e-13 scale where a double centre runs out of digits
+    struct DeepViewport
+    {
+        ComplexDD centre;
+        double extent = 10; //plane units from the centre to the nearest edge, may be as small as 1e-28
+    };
+};
+
+#endif
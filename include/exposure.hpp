@@ -0,0 +1,83 @@
+#ifndef EXPOSURE_HPP
+#define EXPOSURE_HPP
+
+#include <array>
+#include <complex>
+#include <cstdint>
+#include <cstring>
+
+namespace ComplexPlot
+{
+    struct ExposureOptions
+    {
+        int subsample = 8;     //histogram of every subsample-th pixel across and down, 1 / subsample^2 of the evaluations
+        double clip = 3;       //no bin takes more than clip times the average share of the magnitudes the frame spans
+        double floor = 0.05;   //share of brightness spread over every magnitude, so those the frame barely shows still grade
+        double smoothing = 0;  //weight of the previous frame's tone map, above 0 steadies brightness while panning
+    };
+
+    struct MagnitudeHistogram;
+
+    //brightness in [0, 1] as a function of |f|, what 1 - 5 / (|f| + 5) is without exposure. bins are eighths of an
+    //octave of |f|^2 from 2^-64 to 2^64, read straight from the bits of the double, so looking up costs no log or
+    //square root. below and above the range, including 0 and infinity, are the first and last levels
+    class ToneMap
+    {
+    public:
+        static constexpr int octaves = 64; //of |f|^2 either side of 1
+        static constexpr int steps = 8;    //bins per octave
+        static constexpr int bins = 2 * octaves * steps;
+
+        ToneMap(); //the fixed curve
+
+        //equalises the histogram, clipped and floored as options say
+        ToneMap(const MagnitudeHistogram& histogram, const ExposureOptions& options);
+
+        //weight of previous, 0 keeps this map unchanged
+        void blend(const ToneMap& previous, double weight);
+
+        //brightness of a value with |f|^2 = norm
+        double operator()(double norm) const
+        {
+            std::uint64_t bits;
+            std::memcpy(&bits, &norm, sizeof bits);
+            int octave = int(bits >> 52 & 0x7ff) - 1023 + octaves;
+            if(octave < 0) return levels.front();
+            if(octave >= 2 * octaves) return levels.back();
+
+            std::uint64_t mantissa = bits & ((std::uint64_t(1) << 52) - 1);
+            int k = octave * steps + int(mantissa >> 49);
+            double t = double(mantissa & ((std::uint64_t(1) << 49) - 1)) * 0x1p-49;
+            return levels[k] + t * (levels[k + 1] - levels[k]);
+        }
+
+        //clamped into the histogram
+        static int bin(double norm)
+        {
+            std::uint64_t bits;
+            std::memcpy(&bits, &norm, sizeof bits);
+            int octave = int(bits >> 52 & 0x7ff) - 1023 + octaves;
+            if(octave < 0) return 0;
+            if(octave >= 2 * octaves) return bins - 1;
+            return octave * steps + int((bits >> 49) & (steps - 1));
+        }
+
+        double midpoint() const; //|f| shown at half brightness
+
+    private:
+        std::array<float, bins + 1> levels; //brightness at the lower edge of each bin, and at the top of the last
+    };
+
+    //how many samples fell in each of ToneMap's bins. threads fill their own and add them up after
+    struct MagnitudeHistogram
+    {
+        std::array<std::uint64_t, ToneMap::bins> counts{};
+        std::uint64_t total = 0;
+
+        void add(std::complex<double> v) { counts[ToneMap::bin(std::norm(v))]++; total++; }
+
+        MagnitudeHistogram& operator+=(const MagnitudeHistogram& other);
+    };
+}
+
+#endif
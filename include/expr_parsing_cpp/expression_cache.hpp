@@ -0,0 +1,120 @@
+#ifndef EXPRESSION_CACHE_HPP
+#define EXPRESSION_CACHE_HPP
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "parsing.hpp"
+
+namespace Parsing
+{
+    // LRU cache of compiled expressions keyed by their source text with insignificant whitespace removed.
+    // entries are handed out as shared, immutable expressions, so one instance can serve
+    // several threads (e.g. a GUI and a batch renderer) at once
+    template <typename T>
+    class ExpressionCache
+    {
+    public:
+        struct Stats
+        {
+            std::size_t hits = 0;
+            std::size_t misses = 0;
+            std::size_t evictions = 0;
+            std::size_t size = 0;
+
+            double hit_rate() const
+            {
+                return hits + misses ? (double)hits / (hits + misses) : 0.0;
+            }
+        };
+
+        explicit ExpressionCache(std::size_t capacity = 64) : capacity(capacity) {}
+
+        // drops whitespace (the characters the parser skips) except between two characters that would
+        // otherwise read as one token, which keep a single space: "z + 1" and "z+1" share a key, "2 3" and "23" don't
+        static std::string normalize(const std::string &source)
+        {
+            auto joins = [](char c) { return (c >= '0' && c <= '9') || c == '.' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); };
+            std::string key;
+            key.reserve(source.size());
+            bool gap = false;
+            for (auto &c : source)
+            {
+                if (c < 33)
+                {
+                    gap = true;
+                    continue;
+                }
+                if (gap && !key.empty() && joins(key.back()) && joins(c))
+                    key.push_back(' ');
+                key.push_back(c);
+                gap = false;
+            }
+            return key;
+        }
+
+        // parses on a miss; invalid expressions throw like the Expression constructor and are not cached
+        std::shared_ptr<const Expression<T>> get(const std::string &source)
+        {
+            std::string key = normalize(source);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                auto it = index.find(key);
+                if (it != index.end())
+                {
+                    ++counters.hits;
+                    entries.splice(entries.begin(), entries, it->second); // mark as most recently used
+                    return it->second->second;
+                }
+                ++counters.misses;
+            }
+
+            // parse without holding the lock so other lookups are not blocked
+            auto expr = std::make_shared<const Expression<T>>(source);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = index.find(key);
+            if (it != index.end()) // another thread parsed the same text meanwhile
+                return it->second->second;
+
+            entries.emplace_front(key, expr);
+            index[key] = entries.begin();
+            while (entries.size() > capacity)
+            {
+                index.erase(entries.back().first);
+                entries.pop_back();
+                ++counters.evictions;
+            }
+            return expr;
+        }
+
+        Stats stats() const
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Stats result = counters;
+            result.size = entries.size();
+            return result;
+        }
+
+        void clear()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            entries.clear();
+            index.clear();
+        }
+
+    private:
+        using Entry = std::pair<std::string, std::shared_ptr<const Expression<T>>>;
+
+        const std::size_t capacity;
+        mutable std::mutex mutex;
+        std::list<Entry> entries; // most recently used first
+        std::unordered_map<std::string, typename std::list<Entry>::iterator> index;
+        Stats counters;
+    };
+}
+
+#endif
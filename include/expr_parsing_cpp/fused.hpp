@@ -0,0 +1,139 @@
+#ifndef FUSED_HPP
+#define FUSED_HPP
+
+#include <map>
+#include <tuple>
+#include <vector>
+
+#include "parsing.hpp"
+
+namespace Parsing
+{
+    // several expressions merged into one program in which every distinct subexpression appears once, so a panel of
+    // f, real(f), abs(f) and 1/f computes f a single time. each instruction writes its own register and reads earlier
+    // ones. instructions that don't depend on var run once through bind(), the rest per point through evaluate()
+    template <typename T>
+    class FusedExpression
+    {
+    public:
+        struct Instruction
+        {
+            Op op;
+            char var;     // Op::Variable only
+            T value;      // Op::Number only
+            unsigned a, b; // operand registers
+        };
+
+        explicit FusedExpression(const std::vector<const Expression<T> *> &expressions, char var = 'z') : var(var)
+        {
+            std::map<std::tuple<Op, char, double, double, unsigned, unsigned>, unsigned> seen;
+            std::vector<Instruction> program;
+            std::vector<bool> varying;
+            std::vector<unsigned> stack;
+
+            for (const Expression<T> *expr : expressions)
+            {
+                for (const auto &ins : expr->instructions())
+                {
+                    Instruction node = {ins.op, 0, T(), 0, 0};
+                    if (ins.op == Op::Number)
+                        node.value = ins.value;
+                    else if (ins.op == Op::Variable)
+                        node.var = ins.var;
+                    else if (is_unary(ins.op))
+                    {
+                        node.a = stack.back();
+                        stack.pop_back();
+                        unshared++;
+                    }
+                    else
+                    {
+                        node.b = stack.back();
+                        stack.pop_back();
+                        node.a = stack.back();
+                        stack.pop_back();
+                        if ((ins.op == Op::Add || ins.op == Op::Mul) && node.a > node.b) // a + b and b + a round the same
+                            std::swap(node.a, node.b);
+                        unshared++;
+                    }
+
+                    auto key = std::make_tuple(node.op, node.var, (double)std::real(node.value), (double)std::imag(node.value), node.a, node.b);
+                    auto found = seen.find(key);
+                    if (found != seen.end())
+                    {
+                        stack.push_back(found->second);
+                        continue;
+                    }
+
+                    bool moves = node.op == Op::Variable ? node.var == var
+                               : node.op == Op::Number ? false
+                               : is_unary(node.op) ? varying[node.a] : varying[node.a] || varying[node.b];
+                    seen[key] = program.size();
+                    stack.push_back(program.size());
+                    program.push_back(node);
+                    varying.push_back(moves);
+                }
+                outputs.push_back(stack.back());
+                stack.pop_back();
+            }
+
+            for (unsigned i = 0; i < program.size(); ++i)
+                (varying[i] ? per_point : invariant).push_back(i);
+            instructions = std::move(program);
+        }
+
+        std::size_t size() const { return outputs.size(); }
+
+        std::size_t registers() const { return instructions.size(); }
+
+        // operators across the separate expressions, and what is left of them after sharing
+        std::size_t ops_unshared() const { return unshared; }
+
+        std::size_t ops() const
+        {
+            std::size_t count = 0;
+            for (const auto &ins : instructions)
+                count += is_unary(ins.op) || is_binary(ins.op);
+            return count;
+        }
+
+        // fill the registers that are the same at every point, regs holds registers() values
+        void bind(const typename Expression<T>::VarTable &vars, T *regs) const
+        {
+            for (unsigned i : invariant)
+                regs[i] = step(instructions[i], vars, regs);
+        }
+
+        // every expression at var = value, out holds size() values
+        void evaluate(const typename Expression<T>::VarTable &vars, T *regs, T *out) const
+        {
+            for (unsigned i : per_point)
+                regs[i] = step(instructions[i], vars, regs);
+            for (std::size_t k = 0; k < outputs.size(); ++k)
+                out[k] = regs[outputs[k]];
+        }
+
+    private:
+        char var;
+        std::vector<Instruction> instructions;
+        std::vector<unsigned> invariant, per_point, outputs;
+        std::size_t unshared = 0;
+
+        static T step(const Instruction &ins, const typename Expression<T>::VarTable &vars, const T *regs)
+        {
+            switch (ins.op)
+            {
+            case Op::Number:
+                return ins.value;
+            case Op::Variable:
+                return vars[(unsigned char)ins.var];
+            default:
+                if (is_unary(ins.op))
+                    return apply_unary(ins.op, regs[ins.a]);
+                return apply_binary(ins.op, regs[ins.a], regs[ins.b]);
+            }
+        }
+    };
+}
+
+#endif
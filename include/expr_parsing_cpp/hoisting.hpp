@@ -0,0 +1,131 @@
+#ifndef HOISTING_HPP
+#define HOISTING_HPP
+
+#include <array>
+#include <vector>
+
+#include "parsing.hpp"
+
+namespace Parsing
+{
+    // how often a subexpression has to be recomputed when plotting over a grid of var = x + iy
+    enum class Stage : unsigned char
+    {
+        Constant, // numbers only
+        Frame,    // variables other than var, fixed for a render
+        Row,      // imag(var) and what is built from it
+        Column,   // real(var) and what is built from it
+        Pixel
+    };
+
+    constexpr Stage combine(Stage a, Stage b)
+    {
+        if (a == b) return a;
+        if ((a == Stage::Row && b == Stage::Column) || (a == Stage::Column && b == Stage::Row)) return Stage::Pixel;
+        return std::max(a, b);
+    }
+
+    // splits an expression into subexpressions that only change per frame, row or column, and a per-pixel
+    // program that reads their values back as variables. the hoisted values go in VarTable slots 1 to 31,
+    // which no letter uses, so the per-pixel program runs on the ordinary interpreter (or any other backend)
+    template <typename T>
+    class StagedExpression
+    {
+    public:
+        struct Hoisted
+        {
+            Stage stage;
+            char slot;
+            Expression<T> expr;
+        };
+
+        static constexpr int max_slots = 31;
+
+        StagedExpression(const Expression<T> &expr, char var = 'z') : pixel(expr)
+        {
+            const auto &program = expr.instructions();
+            std::size_t n = program.size();
+            std::vector<Stage> stage(n);
+            std::vector<std::size_t> start(n), parent(n, n);
+            std::vector<std::size_t> stack;
+
+            // subtrees are contiguous in RPN: [start[i], i]
+            for (std::size_t i = 0; i < n; ++i)
+            {
+                const auto &ins = program[i];
+                start[i] = i;
+                if (ins.op == Op::Number)
+                    stage[i] = Stage::Constant;
+                else if (ins.op == Op::Variable)
+                    stage[i] = ins.var == var ? Stage::Pixel : Stage::Frame;
+                else if (is_unary(ins.op))
+                {
+                    std::size_t a = stack.back();
+                    stack.pop_back();
+                    parent[a] = i;
+                    start[i] = start[a];
+                    bool of_var = program[a].op == Op::Variable && program[a].var == var;
+                    stage[i] = of_var && ins.op == Op::Real ? Stage::Column
+                             : of_var && ins.op == Op::Imag ? Stage::Row
+                             : stage[a];
+                }
+                else
+                {
+                    std::size_t b = stack.back();
+                    stack.pop_back();
+                    std::size_t a = stack.back();
+                    stack.pop_back();
+                    parent[a] = parent[b] = i;
+                    start[i] = start[a];
+                    stage[i] = combine(stage[a], stage[b]);
+                }
+                stack.push_back(i);
+            }
+
+            for (std::size_t i = 0; i < n; ++i)
+                if (is_unary(program[i].op) || is_binary(program[i].op))
+                    ops[(std::size_t)stage[i]]++;
+
+            // hoist the largest subtrees below pixel stage, single leaves are already as cheap as a slot
+            std::vector<Instruction<T>> remaining;
+            for (std::size_t i = 0; i < n;)
+            {
+                std::size_t root = i;
+                while (parent[root] < n && start[parent[root]] == i && stage[parent[root]] != Stage::Pixel)
+                    root = parent[root];
+
+                if (stage[root] != Stage::Pixel && root > i && (int)hoisted.size() < max_slots)
+                {
+                    char slot = (char)(hoisted.size() + 1);
+                    hoisted.push_back({stage[root], slot, Expression<T>(std::vector<Instruction<T>>(program.begin() + i, program.begin() + root + 1))});
+                    remaining.push_back({Op::Variable, slot, T()});
+                    i = root + 1;
+                }
+                else
+                    remaining.push_back(program[i++]);
+            }
+
+            if (!hoisted.empty())
+                pixel = Expression<T>(std::move(remaining));
+        }
+
+        Expression<T> pixel; // what is left to evaluate per pixel
+        std::vector<Hoisted> hoisted;
+
+        // operators in the original expression by the stage of their result
+        std::size_t ops_in_stage(Stage s) const { return ops[(std::size_t)s]; }
+
+        std::size_t ops_per_pixel() const
+        {
+            std::size_t count = 0;
+            for (const auto &ins : pixel.instructions())
+                count += is_unary(ins.op) || is_binary(ins.op);
+            return count;
+        }
+
+    private:
+        std::array<std::size_t, 5> ops{};
+    };
+}
+
+#endif
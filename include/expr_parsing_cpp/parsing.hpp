@@ -11,13 +11,49 @@
 #include <stdexcept>
 #include <complex>
 #include <iostream>
+#include <array>
+#include <cstdlib>
+#include <string_view>
+#include <limits>
+#include <unordered_map>
 
 #include "sstream_convert.hpp"
 
 namespace Parsing
 {
 
-    const static std::vector<std::string> operators = //duplicate of unordered_map below, needs to be integrated
+    // every operator and function, binary operators first. the order matches op_names,
+    // binary_ops<T> and unary_funcs<T> below
+    enum class Op : unsigned char
+    {
+        Add,
+        Sub,
+        Mul,
+        Div,
+        Pow,
+        Sqrt,
+        Exp,
+        Sin,
+        Cos,
+        Tan,
+        Asin,
+        Acos,
+        Atan,
+        Ln,
+        Log,
+        Abs,
+        Real,
+        Imag,
+        Arg,
+        Number,   // operand: literal value
+        Variable, // operand: single letter
+        None
+    };
+
+    constexpr std::size_t num_binary_ops = (std::size_t)Op::Sqrt;
+    constexpr std::size_t num_unary_funcs = (std::size_t)Op::Number - num_binary_ops;
+
+    constexpr std::array<std::string_view, (std::size_t)Op::Number> op_names =
     {
         "+",
         "-",
@@ -32,43 +68,70 @@ namespace Parsing
         "asin(",
         "acos(",
         "atan(",
-        "log(",
-        "log2(",
         "ln(",
+        "log(",
+        "abs(",
         "real(",
         "imag(",
-        "arg(",
-        "abs("
+        "arg("
     };
 
+    constexpr Op op_from_name(std::string_view name)
+    {
+        for (std::size_t i = 0; i < op_names.size(); ++i)
+        {
+            if (op_names[i] == name)
+                return (Op)i;
+        }
+        return Op::None;
+    }
+
+    constexpr bool is_binary(Op op) { return op < Op::Sqrt; }
+
+    constexpr bool is_unary(Op op) { return op >= Op::Sqrt && op < Op::Number; }
+
+    // read-only function registry, built at compile time and shared by all threads.
+    // unary_funcs<T> is indexed by (op - Op::Sqrt), binary_ops<T> by op
     template<typename T>
-    static std::unordered_map<std::string, std::function<T(T)>> unary_funcs(
-        {
-            {"sqrt(", [](T input){return std::sqrt(input);}},
-            {"exp(", [](T input){return std::exp(input);}},
-            {"sin(", [](T input){return std::sin(input);}},
-            {"cos(", [](T input){return std::cos(input);}},
-            {"tan(", [](T input){return std::tan(input);}},
-            {"asin(", [](T input){return std::asin(input);}},
-            {"acos(", [](T input){return std::acos(input);}},
-            {"atan(", [](T input){return std::atan(input);}},
-            {"ln(", [](T input){return std::log(input);}},
-            //{"log2(", [](T input){return std::log2(input);}},
-            {"log(", [](T input){return std::log10(input);}},
-            {"abs(", [](T input){return std::abs(input);}},
-        }
-    );
+    inline constexpr std::array<T (*)(T), num_unary_funcs> unary_funcs =
+    {
+        [](T input){return T(std::sqrt(input));},
+        [](T input){return T(std::exp(input));},
+        [](T input){return T(std::sin(input));},
+        [](T input){return T(std::cos(input));},
+        [](T input){return T(std::tan(input));},
+        [](T input){return T(std::asin(input));},
+        [](T input){return T(std::acos(input));},
+        [](T input){return T(std::atan(input));},
+        [](T input){return T(std::log(input));},
+        [](T input){return T(std::log10(input));},
+        [](T input){return T(std::abs(input));},
+        [](T input){return T(std::real(input));},
+        [](T input){return T(std::imag(input));},
+        [](T input){return T(std::arg(input));},
+    };
 
     template<typename T>
-    static std::unordered_map<std::string, std::function<T(T,T)>> binary_ops(
-        {
-            {"+", [](T left, T right){return left + right;}},
-            {"-", [](T left, T right){return left - right;}},
-            {"*", [](T left, T right){return left * right;}},
-            {"/", [](T left, T right){return left / right;}},
-            {"^", [](T left, T right){return std::pow(left, right);}},
-        }
-    );
+    inline constexpr std::array<T (*)(T, T), num_binary_ops> binary_ops =
+    {
+        [](T left, T right){return left + right;},
+        [](T left, T right){return left - right;},
+        [](T left, T right){return left * right;},
+        [](T left, T right){return left / right;},
+        [](T left, T right){return T(std::pow(left, right));},
+    };
+
+    template<typename T>
+    T apply_unary(Op op, T input)
+    {
+        return unary_funcs<T>[(std::size_t)op - num_binary_ops](input);
+    }
+
+    template<typename T>
+    T apply_binary(Op op, T left, T right)
+    {
+        return binary_ops<T>[(std::size_t)op](left, right);
+    }
 
     const static std::vector<std::string> basic_operators =
     {
@@ -144,12 +207,7 @@ namespace Parsing
 
         static bool is_operator(std::string &self)
         {
-            for (auto &op : operators)
-            {
-                if (self == op)
-                    return true;
-            }
-            return false;
+            return op_from_name(self) != Op::None;
         }
 
     public:
@@ -197,12 +255,12 @@ namespace Parsing
 
         bool is_operator()
         {
-            for (auto &op : operators)
-            {
-                if (self == op)
-                    return true;
-            }
-            return false;
+            return op_from_name(self) != Op::None;
+        }
+
+        Op op_code()
+        {
+            return op_from_name(self);
         }
 
         const int op_precedence()
@@ -305,7 +363,8 @@ namespace Parsing
         template <typename T>
         T function_eval(T& input)
         {
-            if(unary_funcs<T>.find(self) != unary_funcs<T>.end()) return (unary_funcs<T>[self])(input);
+            Op op = op_code();
+            if(is_unary(op)) return apply_unary(op, input);
             
             throw std::invalid_argument("Unknown function token");
         }
@@ -313,8 +372,8 @@ namespace Parsing
         template <typename T>
         T function_eval(T left, T right)
         {
-
-            if(binary_ops<T>.find(self) != binary_ops<T>.end()) return (binary_ops<T>[self])(left, right);
+            Op op = op_code();
+            if(is_binary(op)) return apply_binary(op, left, right);
             throw std::invalid_argument("Unknown operator token");
         }
 
@@ -471,80 +530,685 @@ namespace Parsing
         }
     };
 
+    // compact parse result: one node per operand / operator in RPN order.
+    // numbers keep a view into the source text and are converted when compiled
+    struct Node
+    {
+        Op op;
+        char var;              // Op::Variable only
+        std::string_view text; // Op::Number only
+    };
+
+    // single-pass precedence-climbing grammar over a string_view, shared by Parser and StaticParser and usable in
+    // constant expressions. emit receives the program in RPN order through emit.number(text), emit.variable(letter)
+    // and emit.op(op). precedence and associativity follow the Token / ParsingShunt table, including / binding
+    // looser than *. a '-' in prefix position negates what follows it up to any ^, so -z^2 is -(z^2) and -2^2 is -4;
+    // a '-' before a literal that isn't raised to a power is part of the literal
+    template <typename Emit>
+    class Grammar
+    {
+        std::string_view src;
+        std::size_t pos = 0;
+        Emit &emit;
+
+        static constexpr bool is_numerical(char c) { return (c <= '9' && c >= '0') || c == '.'; }
+
+        static constexpr bool is_alpha(char c) { return (c <= 'z' && c >= 'a') || (c <= 'Z' && c >= 'A'); }
+
+        static constexpr bool is_valid_char(char c)
+        {
+            return is_numerical(c) || is_alpha(c) || c == '(' || c == ')' || c == '+' || c == '-' || c == '*' || c == '/' || c == '^';
+        }
+
+        static constexpr int precedence(Op op)
+        {
+            switch (op)
+            {
+            case Op::Add:
+            case Op::Sub:
+                return 2;
+            case Op::Div:
+                return 3;
+            case Op::Mul:
+                return 4;
+            case Op::Pow:
+                return 5;
+            default:
+                return 0;
+            }
+        }
+
+        static constexpr Op binary_from_char(char c)
+        {
+            switch (c)
+            {
+            case '+': return Op::Add;
+            case '-': return Op::Sub;
+            case '*': return Op::Mul;
+            case '/': return Op::Div;
+            case '^': return Op::Pow;
+            default: return Op::None;
+            }
+        }
+
+        static constexpr Op function_from_name(std::string_view name)
+        {
+            for (std::size_t i = num_binary_ops; i < op_names.size(); ++i)
+            {
+                if (op_names[i].substr(0, op_names[i].size() - 1) == name)
+                    return (Op)i;
+            }
+            return Op::None;
+        }
+
+        constexpr char peek()
+        {
+            while (pos < src.size() && src[pos] < 33)
+                ++pos;
+            return pos < src.size() ? src[pos] : '\0';
+        }
+
+        constexpr void expect_r_bracket()
+        {
+            if (peek() != ')')
+                throw std::invalid_argument("Mismatched parentheses\n");
+            ++pos;
+        }
+
+        constexpr void parse_expression(int min_precedence)
+        {
+            parse_operand();
+            while (true)
+            {
+                Op op = binary_from_char(peek());
+                if (op == Op::None || precedence(op) < min_precedence)
+                    return;
+                ++pos;
+                parse_expression(op == Op::Pow ? precedence(op) : precedence(op) + 1); // ^ is right associative
+                emit.op(op);
+            }
+        }
+
+        constexpr void parse_operand()
+        {
+            char c = peek();
+
+            if (c == '-')
+            {
+                std::size_t start = pos++;
+                if (pos < src.size() && is_numerical(src[pos]))
+                {
+                    std::size_t end = pos;
+                    while (end < src.size() && is_numerical(src[end]))
+                        ++end;
+                    std::size_t after = pos;
+                    pos = end;
+                    bool raised = peek() == '^';
+                    pos = after;
+                    if (!raised)
+                        return parse_number(start);
+                }
+                emit.number("0"); // -x is compiled as 0 - x
+                parse_expression(precedence(Op::Pow));
+                emit.op(Op::Sub);
+            }
+            else if (is_numerical(c))
+                parse_number(pos);
+            else if (is_alpha(c))
+            {
+                std::size_t start = pos;
+                while (pos < src.size() && is_alpha(src[pos]))
+                    ++pos;
+                std::string_view name = src.substr(start, pos - start);
+
+                if (name.size() == 1 && peek() != '(')
+                    return emit.variable(name[0]);
+
+                Op op = function_from_name(name);
+                if (op == Op::None || peek() != '(')
+                    throw std::invalid_argument("Unknown function token");
+                ++pos;
+                parse_expression(0);
+                expect_r_bracket();
+                emit.op(op);
+            }
+            else if (c == '(')
+            {
+                ++pos;
+                parse_expression(0);
+                expect_r_bracket();
+            }
+            else if (c == '\0' || c == ')' || is_valid_char(c))
+                throw std::invalid_argument("Malformed expression");
+            else
+                throw std::invalid_argument("Invalid character detected\n");
+        }
+
+        constexpr void parse_number(std::size_t start)
+        {
+            pos = start + 1;
+            while (pos < src.size() && is_numerical(src[pos]))
+                ++pos;
+            emit.number(src.substr(start, pos - start));
+        }
+
+    public:
+        constexpr Grammar(std::string_view src, Emit &emit) : src(src), emit(emit) {}
+
+        constexpr void parse()
+        {
+            parse_expression(0);
+            char c = peek();
+            if (c == ')')
+                throw std::invalid_argument("Mismatched parentheses\n");
+            if (c != '\0')
+                throw std::invalid_argument("Malformed expression");
+        }
+    };
+
+    // the runtime side of Grammar: nodes in a vector
+    class Parser
+    {
+        std::string_view src;
+        std::vector<Node> &out;
+
+    public:
+        Parser(std::string_view src, std::vector<Node> &out) : src(src), out(out) {}
+
+        void number(std::string_view text) { out.push_back({Op::Number, 0, text}); }
+
+        void variable(char name) { out.push_back({Op::Variable, name, {}}); }
+
+        void op(Op op) { out.push_back({op, 0, {}}); }
+
+        void parse() { Grammar<Parser>(src, *this).parse(); }
+    };
+
+    inline std::vector<Node> parse(std::string_view expression)
+    {
+        std::vector<Node> out;
+        out.reserve(expression.size());
+        Parser(expression, out).parse();
+        return out;
+    }
+
+    // numbers are plain decimals, read them without a stream
+    template <typename T>
+    T parse_number(std::string_view text)
+    {
+        char buf[64];
+        if (text.size() >= sizeof(buf))
+            return convert_to<T>(std::string(text));
+        text.copy(buf, text.size());
+        buf[text.size()] = '\0';
+
+        long double value = std::strtold(buf, nullptr);
+        if constexpr (is_complex<T>())
+            return T((typename T::value_type)value);
+        else
+            return T(value);
+    }
+
+    // one step of a compiled expression, evaluated on a value stack
+    template <typename T>
+    struct Instruction
+    {
+        Op op;
+        char var; // Op::Variable only
+        T value;  // Op::Number only
+    };
+
     template <typename T>
     class Expression
     {
 
     private:
-        std::vector<Token> self;
-        std::vector<Token> self_rpn;
+        std::vector<Instruction<T>> program;
         std::string variables;
+        std::size_t max_depth = 0;
 
-    public:
-        Expression(std::string expr)
+        // resolve every node once so evaluation never touches strings or shared state
+        void compile(const std::vector<Node> &nodes)
         {
-            variables = "";
-            self = Token::tokenize(expr);
-            self_rpn = ParsingShunt().convert_to_rpn(self);
+            program.reserve(nodes.size());
+            for (auto &n : nodes)
+            {
+                if (n.op == Op::Variable && is_complex<T>() && n.var == 'i') // i is the imaginary unit for complex expressions
+                    program.push_back({Op::Number, 0, imaginary_unit()});
+                else if (n.op == Op::Number)
+                    program.push_back({Op::Number, 0, parse_number<T>(n.text)});
+                else
+                    program.push_back({n.op, n.var, T()});
+            }
+            link();
+        }
 
-            for (auto &t : self) // add variables to list
+        // check the program is well formed, collect its variables and the stack depth it needs
+        void link()
+        {
+            std::size_t depth = 0;
+            for (auto &ins : program)
+            {
+                if (ins.op == Op::Variable || ins.op == Op::Number)
+                {
+                    if (ins.op == Op::Variable && variables.find(ins.var) == std::string::npos)
+                        variables.push_back(ins.var);
+                    max_depth = std::max(max_depth, ++depth);
+                }
+                else if (is_unary(ins.op))
+                {
+                    if (depth < 1) throw std::invalid_argument("Malformed expression");
+                }
+                else
+                {
+                    if (depth < 2) throw std::invalid_argument("Malformed expression");
+                    --depth;
+                }
+            }
+            if (depth != 1) throw std::invalid_argument("Extra operator, malformed expression");
+        }
+
+        // expression tree used for symbolic differentiation, operands are indices into the same vector
+        struct Term
+        {
+            Op op;
+            char var;
+            T value;
+            int left, right;
+        };
+
+        class Differentiator
+        {
+            std::vector<Term> terms;
+            std::vector<int> derivatives; // memoised d/dvar of each term, -1 until computed
+            char var;
+
+            bool is_number(int t, T v) const { return terms[t].op == Op::Number && terms[t].value == v; }
+
+            int add(Term t)
+            {
+                terms.push_back(t);
+                return (int)terms.size() - 1;
+            }
+
+            int number(T v) { return add({Op::Number, 0, v, -1, -1}); }
+
+            // build op(a), folding constants
+            int unary(Op op, int a)
+            {
+                if (terms[a].op == Op::Number) return number(apply_unary(op, terms[a].value));
+                return add({op, 0, T(), a, -1});
+            }
+
+            // build a op b, folding constants and the identities that differentiation produces
+            int binary(Op op, int a, int b)
+            {
+                if (terms[a].op == Op::Number && terms[b].op == Op::Number)
+                    return number(apply_binary(op, terms[a].value, terms[b].value));
+
+                switch (op)
+                {
+                case Op::Add:
+                    if (is_number(a, T(0))) return b;
+                    if (is_number(b, T(0))) return a;
+                    break;
+                case Op::Sub:
+                    if (is_number(b, T(0))) return a;
+                    break;
+                case Op::Mul:
+                    if (is_number(a, T(0)) || is_number(b, T(0))) return number(T(0));
+                    if (is_number(a, T(1))) return b;
+                    if (is_number(b, T(1))) return a;
+                    break;
+                case Op::Div:
+                    if (is_number(a, T(0))) return number(T(0));
+                    if (is_number(b, T(1))) return a;
+                    break;
+                case Op::Pow:
+                    if (is_number(b, T(0))) return number(T(1));
+                    if (is_number(b, T(1))) return a;
+                    break;
+                default:
+                    break;
+                }
+                return add({op, 0, T(), a, b});
+            }
+
+            int negate(int a) { return binary(Op::Sub, number(T(0)), a); }
+
+            int derive(int t)
             {
-                if (t.is_variable())
+                if (derivatives[t] >= 0) return derivatives[t];
+
+                Term term = terms[t];
+                int a = term.left, b = term.right, result;
+                switch (term.op)
+                {
+                case Op::Number:
+                    result = number(T(0));
+                    break;
+                case Op::Variable:
+                    result = number(T(term.var == var ? 1 : 0));
+                    break;
+                case Op::Add:
+                case Op::Sub:
+                    result = binary(term.op, derive(a), derive(b));
+                    break;
+                case Op::Mul:
+                    result = binary(Op::Add, binary(Op::Mul, derive(a), b), binary(Op::Mul, a, derive(b)));
+                    break;
+                case Op::Div:
+                    result = binary(Op::Div,
+                                    binary(Op::Sub, binary(Op::Mul, derive(a), b), binary(Op::Mul, a, derive(b))),
+                                    binary(Op::Mul, b, b));
+                    break;
+                case Op::Pow:
+                    if (is_number(derive(b), T(0))) // b a^(b-1) a'
+                        result = binary(Op::Mul, binary(Op::Mul, b, binary(Op::Pow, a, binary(Op::Sub, b, number(T(1))))), derive(a));
+                    else // a^b (b' ln a + b a' / a)
+                        result = binary(Op::Mul, t,
+                                        binary(Op::Add, binary(Op::Mul, derive(b), unary(Op::Ln, a)),
+                                               binary(Op::Div, binary(Op::Mul, b, derive(a)), a)));
+                    break;
+                default:
+                    result = derive_unary(term.op, a);
+                }
+
+                derivatives.resize(terms.size(), -1);
+                derivatives[t] = result;
+                return result;
+            }
+
+            int derive_unary(Op op, int a)
+            {
+                int da = derive(a);
+                if (is_number(da, T(0))) return da;
+
+                int one = number(T(1));
+                switch (op)
                 {
-                    variables.push_back(t.string_val()[0]);
+                case Op::Sqrt:
+                    return binary(Op::Div, da, binary(Op::Mul, number(T(2)), unary(Op::Sqrt, a)));
+                case Op::Exp:
+                    return binary(Op::Mul, unary(Op::Exp, a), da);
+                case Op::Sin:
+                    return binary(Op::Mul, unary(Op::Cos, a), da);
+                case Op::Cos:
+                    return binary(Op::Mul, negate(unary(Op::Sin, a)), da);
+                case Op::Tan:
+                    return binary(Op::Div, da, binary(Op::Pow, unary(Op::Cos, a), number(T(2))));
+                case Op::Asin:
+                    return binary(Op::Div, da, unary(Op::Sqrt, binary(Op::Sub, one, binary(Op::Mul, a, a))));
+                case Op::Acos:
+                    return binary(Op::Div, negate(da), unary(Op::Sqrt, binary(Op::Sub, one, binary(Op::Mul, a, a))));
+                case Op::Atan:
+                    return binary(Op::Div, da, binary(Op::Add, one, binary(Op::Mul, a, a)));
+                case Op::Ln:
+                    return binary(Op::Div, da, a);
+                case Op::Log:
+                    return binary(Op::Div, da, binary(Op::Mul, a, number(T(std::log(10.0)))));
+                default:
+                    break;
+                }
+
+                // abs, real, imag and arg are not holomorphic, over the reals they are piecewise smooth
+                if constexpr (is_complex<T>())
+                    throw std::invalid_argument(std::string(op_names[(std::size_t)op]) + ") is not holomorphic, cannot differentiate");
+                else
+                {
+                    if (op == Op::Abs) return binary(Op::Mul, da, binary(Op::Div, a, unary(Op::Abs, a)));
+                    if (op == Op::Real) return da;
+                    return number(T(0));
                 }
             }
 
-            if(is_complex<T>())
+            void emit(int t, std::vector<Instruction<T>> &out) const
             {
-                unary_funcs<T>["real("] = [](T input){return std::real(input);};
-                unary_funcs<T>["imag("] = [](T input){return std::imag(input);};
-                unary_funcs<T>["arg("]  = [](T input){return std::arg(input);};
-                variables.push_back('i');
-            } 
+                const Term &term = terms[t];
+                if (term.left >= 0) emit(term.left, out);
+                if (term.right >= 0) emit(term.right, out);
+                out.push_back({term.op, term.var, term.value});
+            }
 
+        public:
+            Differentiator(const std::vector<Instruction<T>> &program, char var) : var(var)
+            {
+                std::vector<int> stack;
+                for (auto &ins : program)
+                {
+                    Term term = {ins.op, ins.var, ins.value, -1, -1};
+                    if (is_binary(ins.op))
+                    {
+                        term.right = stack.back();
+                        stack.pop_back();
+                    }
+                    if (is_binary(ins.op) || is_unary(ins.op))
+                    {
+                        term.left = stack.back();
+                        stack.pop_back();
+                    }
+                    stack.push_back(add(term));
+                }
+                derivatives.assign(terms.size(), -1);
+                root = stack.back();
+            }
+
+            int root;
+
+            std::vector<Instruction<T>> derivative()
+            {
+                std::vector<Instruction<T>> out;
+                emit(derive(root), out);
+                return out;
+            }
+        };
+
+        // value and derivative carried together through the program
+        struct Dual
+        {
+            T value, slope;
+        };
+
+        static Dual apply_dual(Op op, Dual a)
+        {
+            T v = apply_unary(op, a.value);
+            if (a.slope == T(0)) return {v, T(0)};
+
+            switch (op)
+            {
+            case Op::Sqrt: return {v, a.slope / (T(2) * v)};
+            case Op::Exp: return {v, v * a.slope};
+            case Op::Sin: return {v, T(std::cos(a.value)) * a.slope};
+            case Op::Cos: return {v, -T(std::sin(a.value)) * a.slope};
+            case Op::Tan: return {v, (T(1) + v * v) * a.slope};
+            case Op::Asin: return {v, a.slope / T(std::sqrt(T(1) - a.value * a.value))};
+            case Op::Acos: return {v, -a.slope / T(std::sqrt(T(1) - a.value * a.value))};
+            case Op::Atan: return {v, a.slope / (T(1) + a.value * a.value)};
+            case Op::Ln: return {v, a.slope / a.value};
+            case Op::Log: return {v, a.slope / (a.value * T(std::log(10.0)))};
+            default: break;
+            }
+
+            if constexpr (is_complex<T>())
+                return {v, T(std::numeric_limits<double>::quiet_NaN())}; // not holomorphic, derivative() throws for these
+            else
+            {
+                if (op == Op::Abs) return {v, a.slope * a.value / v};
+                if (op == Op::Real) return {v, a.slope};
+                return {v, T(0)};
+            }
         }
 
-        T evaluate(std::unordered_map<char, T> vars)
+        static Dual apply_dual(Op op, Dual a, Dual b)
         {
-            if(is_complex<T>()) vars['i'] = {0,1};
-            for(const auto& v : variables)
+            switch (op)
             {
-                if(vars.find(v) == vars.end()) throw std::invalid_argument("Missing variable value\n");
+            case Op::Add: return {a.value + b.value, a.slope + b.slope};
+            case Op::Sub: return {a.value - b.value, a.slope - b.slope};
+            case Op::Mul: return {a.value * b.value, a.slope * b.value + a.value * b.slope};
+            case Op::Div: return {a.value / b.value, (a.slope * b.value - a.value * b.slope) / (b.value * b.value)};
+            default: break;
             }
-            
-            std::vector<T> retval;
 
+            T v = apply_binary(Op::Pow, a.value, b.value);
+            if (b.slope == T(0))
+                return {v, a.slope == T(0) ? T(0) : b.value * T(std::pow(a.value, b.value - T(1))) * a.slope};
+            return {v, v * (b.slope * T(std::log(a.value)) + b.value * a.slope / a.value)};
+        }
 
-            auto it = self_rpn.begin();
-            while (it != self_rpn.end())
+        std::pair<T, T> run_dual(Dual *stack, const std::array<T, 128> &vars, char var) const
+        {
+            Dual *top = stack;
+            for (const auto &ins : program)
             {
-                if (!it->is_operator())
+                switch (ins.op)
                 {
-                    if(it->is_variable())
+                case Op::Number:
+                    *top++ = {ins.value, T(0)};
+                    break;
+                case Op::Variable:
+                    *top++ = {vars[(unsigned char)ins.var], T(ins.var == var ? 1 : 0)};
+                    break;
+                default:
+                    if (is_unary(ins.op))
+                        top[-1] = apply_dual(ins.op, top[-1]);
+                    else
                     {
-                        retval.push_back(vars[it->string_val()[0]]);
+                        --top;
+                        top[-1] = apply_dual(ins.op, top[-1], top[0]);
                     }
-                    else retval.push_back(convert_to<T>(it->string_val())); //may not work with custom types
                 }
-                else
+            }
+            return {stack[0].value, stack[0].slope};
+        }
+
+        static T imaginary_unit()
+        {
+            if constexpr (is_complex<T>())
+                return T(0, 1);
+            else
+                return T();
+        }
+
+        T run(T *stack, const std::array<T, 128> &vars) const
+        {
+            T *top = stack; // one past the top of the stack
+            for (const auto &ins : program)
+            {
+                switch (ins.op)
                 {
-                    if(it->is_unary_func())
+                case Op::Number:
+                    *top++ = ins.value;
+                    break;
+                case Op::Variable:
+                    *top++ = vars[(unsigned char)ins.var];
+                    break;
+                default:
+                    if (is_unary(ins.op))
+                        top[-1] = apply_unary(ins.op, top[-1]);
+                    else
                     {
-                        if(!(retval.size() > 0)) throw std::invalid_argument("Malformed expression");
-                        retval.back() = it->function_eval(retval.back());
+                        --top;
+                        top[-1] = apply_binary(ins.op, top[-1], top[0]);
                     }
-                    else
+                }
+            }
+            return stack[0];
+        }
+
+    public:
+        using VarTable = std::array<T, 128>; // variable values indexed by their letter
+
+        Expression(std::string expr)
+        {
+            compile(parse(expr));
+        }
+
+        // from an already compiled program, e.g. part of another expression's instructions()
+        explicit Expression(std::vector<Instruction<T>> instructions) : program(std::move(instructions))
+        {
+            link();
+        }
+
+        const std::vector<Instruction<T>> &instructions() const
+        {
+            return program;
+        }
+
+        const std::string &variable_names() const
+        {
+            return variables;
+        }
+
+        // fast path: no lookups, no allocation for typical expressions, safe to call from many threads
+        T evaluate_table(const VarTable &vars) const
+        {
+            if (max_depth <= 16)
+            {
+                std::array<T, 16> stack;
+                return run(stack.data(), vars);
+            }
+            std::vector<T> stack(max_depth);
+            return run(stack.data(), vars);
+        }
+
+        // f and df/dvar in one pass, every intermediate value is computed once and shared by both.
+        // the derivative is NaN where abs, real, imag or arg of a varying complex value is taken
+        std::pair<T, T> evaluate_with_derivative(const VarTable &vars, char var = 'z') const
+        {
+            if (max_depth <= 16)
+            {
+                std::array<Dual, 16> stack;
+                return run_dual(stack.data(), vars, var);
+            }
+            std::vector<Dual> stack(max_depth);
+            return run_dual(stack.data(), vars, var);
+        }
+
+        // d/dvar as a new simplified expression. throws std::invalid_argument for complex expressions
+        // taking abs, real, imag or arg of something that depends on var
+        Expression derivative(char var = 'z') const
+        {
+            return Expression(Differentiator(program, var).derivative());
+        }
+
+        // throws like derivative(var) for abs, real, imag or arg of something that depends on var, without building
+        // the derivative, for callers that only need f and f' from evaluate_with_derivative
+        void check_differentiable(char var = 'z') const
+        {
+            if constexpr (is_complex<T>())
+            {
+                std::vector<bool> varies;
+                for (auto &ins : program)
+                {
+                    bool v = ins.op == Op::Variable && ins.var == var;
+                    if (is_binary(ins.op))
                     {
-                        if(!(retval.size() > 1)) throw std::invalid_argument("Malformed expression");
-                        retval[retval.size() - 2] = it->function_eval(retval[retval.size() - 2], retval.back());
-                        retval.pop_back();
+                        v = varies.back();
+                        varies.pop_back();
                     }
+                    if (is_binary(ins.op) || is_unary(ins.op))
+                    {
+                        v = v || varies.back();
+                        varies.pop_back();
+                    }
+                    if (v && (ins.op == Op::Abs || ins.op == Op::Real || ins.op == Op::Imag || ins.op == Op::Arg))
+                        throw std::invalid_argument(std::string(op_names[(std::size_t)ins.op]) + ") is not holomorphic, cannot differentiate");
+                    varies.push_back(v);
                 }
-                ++it;
             }
-            if (!(retval.size() == 1)) throw std::invalid_argument("Extra operator, malformed expression");
-            return retval.back();
+        }
+
+        T evaluate(const std::unordered_map<char, T> &vars) const
+        {
+            VarTable table{};
+            for (const auto &v : variables)
+            {
+                auto it = vars.find(v);
+                if (it == vars.end()) throw std::invalid_argument("Missing variable value\n");
+                table[(unsigned char)v] = it->second;
+            }
+            return evaluate_table(table);
         }
     };
 
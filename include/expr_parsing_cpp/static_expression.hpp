@@ -0,0 +1,179 @@
+#ifndef STATIC_EXPRESSION_HPP
+#define STATIC_EXPRESSION_HPP
+
+#include <array>
+#include <string_view>
+
+#include "parsing.hpp"
+
+namespace Parsing
+{
+    // one node of a program parsed at compile time, operands are indices of earlier nodes
+    struct StaticNode
+    {
+        Op op = Op::None;
+        char var = 0;        // Op::Variable only
+        double value = 0;    // Op::Number only
+        std::size_t a = 0, b = 0;
+    };
+
+    template <std::size_t N>
+    struct StaticProgram
+    {
+        std::array<StaticNode, N> nodes{};
+        std::size_t size = 0;
+        std::array<char, 128> variables{}; // in order of first use, 0 terminated
+    };
+
+    // the compile-time side of Grammar: nodes in a fixed array, operands resolved to node indices.
+    // errors throw, which stops compilation
+    template <std::size_t N>
+    class StaticParser
+    {
+        std::string_view src;
+        StaticProgram<N> out;
+        std::array<std::size_t, N> stack{};
+        std::size_t depth = 0;
+
+        // as strtod for the plain decimals the grammar accepts
+        static constexpr double to_number(std::string_view text)
+        {
+            bool negative = text[0] == '-';
+            long double mantissa = 0, scale = 1;
+            bool point = false;
+            for (std::size_t i = negative; i < text.size(); ++i)
+            {
+                if (text[i] == '.')
+                {
+                    if (point) break;
+                    point = true;
+                    continue;
+                }
+                mantissa = mantissa * 10 + (text[i] - '0');
+                if (point) scale *= 10;
+            }
+            return double(negative ? -mantissa / scale : mantissa / scale);
+        }
+
+        constexpr void push(StaticNode n)
+        {
+            if (out.size == N) throw std::invalid_argument("Expression too long");
+
+            if (n.op == Op::Variable)
+            {
+                std::size_t k = 0;
+                while (out.variables[k] && out.variables[k] != n.var) ++k;
+                out.variables[k] = n.var;
+            }
+            if (is_unary(n.op))
+                n.a = stack[depth - 1], --depth;
+            else if (is_binary(n.op))
+                n.b = stack[depth - 1], n.a = stack[depth - 2], depth -= 2;
+
+            out.nodes[out.size] = n;
+            stack[depth++] = out.size++;
+        }
+
+    public:
+        constexpr StaticParser(std::string_view src) : src(src) {}
+
+        constexpr void number(std::string_view text) { push({Op::Number, 0, to_number(text)}); }
+
+        constexpr void variable(char name) { push({Op::Variable, name}); }
+
+        constexpr void op(Op op) { push({op}); }
+
+        constexpr StaticProgram<N> parse()
+        {
+            Grammar<StaticParser>(src, *this).parse();
+            return out;
+        }
+    };
+
+    // an expression parsed while compiling, evaluated by code generated for it alone: no opcode dispatch,
+    // no value stack, integer powers unrolled into multiplications. the source is a type holding the text,
+    //     struct Rational { static constexpr std::string_view source = "(z^3-1)/(z^2+1)"; };
+    //     Parsing::StaticExpression<Rational> kernel;
+    // and a malformed expression is a compile error. evaluate_table matches Expression<T>'s, so templates
+    // written against Expression<T> can take either
+    template <typename Source, typename T = std::complex<double>>
+    class StaticExpression
+    {
+        static constexpr std::size_t capacity = 2 * Source::source.size() + 1; // a prefix '-' adds two nodes
+        static constexpr StaticProgram<capacity> program = StaticParser<capacity>(Source::source).parse();
+
+    public:
+        using VarTable = std::array<T, 128>;
+
+        T evaluate_table(const VarTable &vars) const
+        {
+            return node<program.size - 1>(vars);
+        }
+
+        static std::string variable_names()
+        {
+            std::string names;
+            for (char v : program.variables)
+                if (v && !(is_complex<T>() && v == 'i')) names.push_back(v);
+                else if (!v) break;
+            return names;
+        }
+
+        static constexpr std::size_t size() { return program.size; }
+
+    private:
+        template <long E>
+        static T power(T x)
+        {
+            if constexpr (E < 0)
+                return T(1) / power<-E>(x);
+            else if constexpr (E == 0)
+                return T(1);
+            else if constexpr (E == 1)
+                return x;
+            else
+            {
+                T half = power<E / 2>(x);
+                if constexpr (E % 2) return half * half * x;
+                else return half * half;
+            }
+        }
+
+        static constexpr bool small_integer(const StaticNode &n)
+        {
+            return n.op == Op::Number && n.value == (double)(long)n.value && n.value <= 64 && n.value >= -64;
+        }
+
+        template <std::size_t I>
+        static T node(const VarTable &vars)
+        {
+            constexpr StaticNode n = program.nodes[I];
+
+            if constexpr (n.op == Op::Number)
+                return T(n.value);
+            else if constexpr (n.op == Op::Variable)
+            {
+                if constexpr (is_complex<T>() && n.var == 'i')
+                    return T(0, 1);
+                else
+                    return vars[(unsigned char)n.var];
+            }
+            else if constexpr (n.op == Op::Add)
+                return node<n.a>(vars) + node<n.b>(vars);
+            else if constexpr (n.op == Op::Sub)
+                return node<n.a>(vars) - node<n.b>(vars);
+            else if constexpr (n.op == Op::Mul)
+                return node<n.a>(vars) * node<n.b>(vars);
+            else if constexpr (n.op == Op::Div)
+                return node<n.a>(vars) / node<n.b>(vars);
+            else if constexpr (n.op == Op::Pow && small_integer(program.nodes[n.b]))
+                return power<(long)program.nodes[n.b].value>(node<n.a>(vars));
+            else if constexpr (n.op == Op::Pow)
+                return T(std::pow(node<n.a>(vars), node<n.b>(vars)));
+            else
+                return unary_funcs<T>[(std::size_t)n.op - num_binary_ops](node<n.a>(vars));
+        }
+    };
+}
+
+#endif
@@ -0,0 +1,257 @@
+#ifndef INTERVAL_HPP
+#define INTERVAL_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <limits>
+#include <vector>
+
+#include "expr_parsing_cpp/parsing.hpp"
+
+namespace ComplexPlot
+{
+namespace IntervalMath //kept apart so sin, exp etc. here don't hide the std overloads used by the renderer
+{
+    //Bounds of an expression over a rectangle of the complex plane. Used to prove that a tile
+    //is smooth enough to be interpolated; results are not rounded outward, which is fine for
+    //colour tolerances of a level or more. Anything that cannot be bounded becomes unbounded.
+    struct Interval
+    {
+        double lo, hi;
+
+        bool contains(double v) const { return lo <= v && v <= hi; }
+        double width() const { return hi - lo; }
+    };
+
+    struct ComplexInterval
+    {
+        Interval re, im;
+
+        bool bounded() const { return std::isfinite(re.lo) && std::isfinite(re.hi) && std::isfinite(im.lo) && std::isfinite(im.hi); }
+        bool contains_zero() const { return re.contains(0) && im.contains(0); }
+    };
+
+    constexpr double unbounded_value = std::numeric_limits<double>::infinity();
+    constexpr Interval unbounded_interval = {-unbounded_value, unbounded_value};
+    constexpr ComplexInterval unbounded = {unbounded_interval, unbounded_interval};
+
+    inline Interval operator+(Interval a, Interval b) { return {a.lo + b.lo, a.hi + b.hi}; }
+
+    inline Interval operator-(Interval a, Interval b) { return {a.lo - b.hi, a.hi - b.lo}; }
+
+    inline Interval operator*(Interval a, Interval b)
+    {
+        double p[4] = {a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi};
+        for(double v : p) if(std::isnan(v)) return unbounded_interval;
+        return {*std::min_element(p, p + 4), *std::max_element(p, p + 4)};
+    }
+
+    inline Interval scale(Interval a, double k) { return k >= 0 ? Interval{a.lo * k, a.hi * k} : Interval{a.hi * k, a.lo * k}; }
+
+    inline Interval sqr(Interval a)
+    {
+        double l = a.lo * a.lo, h = a.hi * a.hi;
+        if(a.contains(0)) return {0, std::max(l, h)};
+        return {std::min(l, h), std::max(l, h)};
+    }
+
+    //is phase + 2k*pi inside [lo, hi] for some integer k
+    inline bool hits_phase(Interval a, double phase)
+    {
+        double k = std::ceil((a.lo - phase) / (2 * M_PI));
+        return phase + 2 * M_PI * k <= a.hi;
+    }
+
+    inline Interval sin(Interval a)
+    {
+        if(!std::isfinite(a.lo) || !std::isfinite(a.hi) || a.width() >= 2 * M_PI) return {-1, 1};
+        double l = std::sin(a.lo), h = std::sin(a.hi);
+        return {hits_phase(a, -M_PI / 2) ? -1 : std::min(l, h), hits_phase(a, M_PI / 2) ? 1 : std::max(l, h)};
+    }
+
+    inline Interval cos(Interval a) { return sin(a + Interval{M_PI / 2, M_PI / 2}); }
+
+    inline Interval exp(Interval a) { return {std::exp(a.lo), std::exp(a.hi)}; }
+
+    inline Interval sinh(Interval a) { return {std::sinh(a.lo), std::sinh(a.hi)}; }
+
+    inline Interval cosh(Interval a)
+    {
+        double l = std::cosh(a.lo), h = std::cosh(a.hi);
+        return {a.contains(0) ? 1 : std::min(l, h), std::max(l, h)};
+    }
+
+    //range of |z| over the rectangle
+    inline Interval magnitude(const ComplexInterval& z)
+    {
+        double near_re = z.re.contains(0) ? 0 : std::min(std::abs(z.re.lo), std::abs(z.re.hi));
+        double near_im = z.im.contains(0) ? 0 : std::min(std::abs(z.im.lo), std::abs(z.im.hi));
+        double far_re = std::max(std::abs(z.re.lo), std::abs(z.re.hi));
+        double far_im = std::max(std::abs(z.im.lo), std::abs(z.im.hi));
+        return {std::hypot(near_re, near_im), std::hypot(far_re, far_im)};
+    }
+
+    //range of std::arg, unbounded where the rectangle touches the branch cut on the negative real axis
+    inline Interval argument(const ComplexInterval& z)
+    {
+        if(z.re.lo <= 0 && z.im.contains(0)) return unbounded_interval;
+
+        double a[4] = {std::atan2(z.im.lo, z.re.lo), std::atan2(z.im.lo, z.re.hi), std::atan2(z.im.hi, z.re.lo), std::atan2(z.im.hi, z.re.hi)};
+        return {*std::min_element(a, a + 4), *std::max_element(a, a + 4)};
+    }
+
+    //angle subtended by the rectangle as seen from the origin, wrapping is fine here
+    inline double angular_span(const ComplexInterval& z)
+    {
+        if(z.contains_zero()) return 2 * M_PI;
+
+        double centre = std::atan2((z.im.lo + z.im.hi) / 2, (z.re.lo + z.re.hi) / 2), lo = 0, hi = 0;
+        for(double x : {z.re.lo, z.re.hi})
+            for(double y : {z.im.lo, z.im.hi})
+            {
+                double d = std::remainder(std::atan2(y, x) - centre, 2 * M_PI);
+                lo = std::min(lo, d);
+                hi = std::max(hi, d);
+            }
+        return hi - lo;
+    }
+
+    inline ComplexInterval operator+(const ComplexInterval& a, const ComplexInterval& b) { return {a.re + b.re, a.im + b.im}; }
+
+    inline ComplexInterval operator-(const ComplexInterval& a, const ComplexInterval& b) { return {a.re - b.re, a.im - b.im}; }
+
+    inline ComplexInterval operator*(const ComplexInterval& a, const ComplexInterval& b)
+    {
+        return {a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re};
+    }
+
+    inline ComplexInterval operator/(const ComplexInterval& a, const ComplexInterval& b)
+    {
+        Interval denom = sqr(b.re) + sqr(b.im);
+        if(denom.lo <= 0) return unbounded;
+
+        Interval inv = {1 / denom.hi, 1 / denom.lo};
+        ComplexInterval num = a * ComplexInterval{b.re, Interval{-b.im.hi, -b.im.lo}};
+        return {num.re * inv, num.im * inv};
+    }
+
+    //r * (cos t + i sin t)
+    inline ComplexInterval from_polar(Interval r, Interval t) { return {r * cos(t), r * sin(t)}; }
+
+    inline ComplexInterval log(const ComplexInterval& z)
+    {
+        Interval arg = argument(z), mag = magnitude(z);
+        if(!std::isfinite(arg.lo) || mag.lo <= 0) return unbounded;
+        return {{std::log(mag.lo), std::log(mag.hi)}, arg};
+    }
+
+    inline ComplexInterval exp(const ComplexInterval& z) { return from_polar(exp(z.re), z.im); }
+
+    inline ComplexInterval sin(const ComplexInterval& z) { return {sin(z.re) * cosh(z.im), cos(z.re) * sinh(z.im)}; }
+
+    inline ComplexInterval cos(const ComplexInterval& z)
+    {
+        Interval s = sin(z.re) * sinh(z.im);
+        return {cos(z.re) * cosh(z.im), {-s.hi, -s.lo}};
+    }
+
+    inline ComplexInterval real_interval(Interval a) { return {a, {0, 0}}; }
+
+    inline ComplexInterval apply_unary(Parsing::Op op, const ComplexInterval& z)
+    {
+        using Parsing::Op;
+        switch(op)
+        {
+            case Op::Sqrt:
+            {
+                Interval arg = argument(z), mag = magnitude(z);
+                if(!std::isfinite(arg.lo)) return unbounded;
+                return from_polar({std::sqrt(mag.lo), std::sqrt(mag.hi)}, scale(arg, 0.5));
+            }
+            case Op::Exp: return exp(z);
+            case Op::Sin: return sin(z);
+            case Op::Cos: return cos(z);
+            case Op::Tan: return sin(z) / cos(z);
+            case Op::Ln: return log(z);
+            case Op::Log:
+            {
+                ComplexInterval l = log(z);
+                return {scale(l.re, 1 / M_LN10), scale(l.im, 1 / M_LN10)};
+            }
+            case Op::Abs: return real_interval(magnitude(z));
+            case Op::Real: return real_interval(z.re);
+            case Op::Imag: return real_interval(z.im);
+            case Op::Arg: return real_interval(argument(z));
+            default: return unbounded; //inverse trigonometric functions are not bounded
+        }
+    }
+
+    inline ComplexInterval apply_binary(Parsing::Op op, const ComplexInterval& a, const ComplexInterval& b)
+    {
+        using Parsing::Op;
+        switch(op)
+        {
+            case Op::Add: return a + b;
+            case Op::Sub: return a - b;
+            case Op::Mul: return a * b;
+            case Op::Div: return a / b;
+            default:
+            {
+                //constant small integer powers by repeated squaring, everything else as exp(b log a)
+                bool integer = b.re.lo == b.re.hi && b.im.lo == 0 && b.im.hi == 0 && b.re.lo == std::floor(b.re.lo) && std::abs(b.re.lo) <= 64;
+                if(!integer) return exp(b * log(a));
+
+                int n = (int)std::abs(b.re.lo);
+                ComplexInterval result = {{1, 1}, {0, 0}}, base = a;
+                for(; n; n >>= 1)
+                {
+                    if(n & 1) result = result * base;
+                    base = base * base;
+                }
+                return b.re.lo < 0 ? ComplexInterval{{1, 1}, {0, 0}} / result : result;
+            }
+        }
+    }
+
+    //bounds of expr for z anywhere in the rectangle, other variables fixed at vars
+    template<typename T>
+    ComplexInterval evaluate_interval(const Parsing::Expression<std::complex<T>>& expr, const ComplexInterval& z,
+                                      const typename Parsing::Expression<std::complex<T>>::VarTable& vars)
+    {
+        std::vector<ComplexInterval> stack;
+        stack.reserve(expr.instructions().size());
+
+        for(const auto& ins : expr.instructions())
+        {
+            if(ins.op == Parsing::Op::Number || ins.op == Parsing::Op::Variable)
+            {
+                std::complex<T> v = ins.op == Parsing::Op::Number ? ins.value : vars[(unsigned char)ins.var];
+                if(ins.op == Parsing::Op::Variable && ins.var == 'z')
+                    stack.push_back(z);
+                else
+                    stack.push_back({{(double)v.real(), (double)v.real()}, {(double)v.imag(), (double)v.imag()}});
+            }
+            else if(Parsing::is_unary(ins.op))
+                stack.back() = apply_unary(ins.op, stack.back());
+            else
+            {
+                ComplexInterval right = stack.back();
+                stack.pop_back();
+                stack.back() = apply_binary(ins.op, stack.back(), right);
+            }
+
+            if(!stack.back().bounded()) return unbounded;
+        }
+        return stack.back();
+    }
+}
+
+    using IntervalMath::Interval;
+    using IntervalMath::ComplexInterval;
+    using IntervalMath::evaluate_interval;
+    using IntervalMath::magnitude;
+    using IntervalMath::angular_span;
+};
+
+#endif
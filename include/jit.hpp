@@ -0,0 +1,41 @@
+#ifndef JIT_HPP
+#define JIT_HPP
+
+#include <complex>
+#include <memory>
+#include <string>
+
+#include "expr_parsing_cpp/parsing.hpp"
+
+namespace ComplexPlot
+{
+    //Native tier for Parsing::Expression<std::complex<double>>. The RPN is turned into
+    //straight-line C++ (one local per stack slot, so the compiler does the register
+    //allocation), built into a shared object by the local compiler and loaded with dlopen.
+    //compile() returns nullptr whenever that is not possible and callers keep using the interpreter.
+    class JitKernel
+    {
+    public:
+        //z and out hold n values, vars holds one value per ASCII code and is read for every variable other than z
+        using KernelFn = void (*)(const double* z, double* out, int n, const double* vars);
+
+        static std::unique_ptr<JitKernel> compile(const Parsing::Expression<std::complex<double>>& expr);
+
+        static std::string generate_source(const Parsing::Expression<std::complex<double>>& expr);
+
+        void evaluate(const std::complex<double>* z, std::complex<double>* out, int n, const std::complex<double>* vars) const
+        {
+            fn((const double*)z, (double*)out, n, (const double*)vars);
+        }
+
+        ~JitKernel();
+
+    private:
+        JitKernel(void* handle, KernelFn fn) : handle(handle), fn(fn) {}
+
+        void* handle;
+        KernelFn fn;
+    };
+};
+
+#endif
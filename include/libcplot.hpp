@@ -2,11 +2,27 @@
 #define LIBCPLOT_HPP
 
 #include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
 #include <cassert>
 #include <vector>
 #include <complex>
+#include <string>
+#include <array>
+#include <functional>
 
 #include "expr_parsing_cpp/parsing.hpp"
+#include "expr_parsing_cpp/expression_cache.hpp"
+#include "expr_parsing_cpp/hoisting.hpp"
+#include "expr_parsing_cpp/static_expression.hpp"
+#include "expr_parsing_cpp/fused.hpp"
+#include "jit.hpp"
+#include "interval.hpp"
+#include "deep_zoom.hpp"
+#include "root_finding.hpp"
+#include "contours.hpp"
+#include "exposure.hpp"
 
 
 namespace ComplexPlot
@@ -22,7 +38,144 @@ namespace ComplexPlot
         }
     }
 
+    //the same hues, brightness from an exposure's tone map instead of the fixed curve
+    template<typename T>
+    static void cmplx_to_colour(unsigned char* pix, std::complex<T> num, const ToneMap& tone)
+    {
+        T mag = tone((double)std::norm(num)), arg = std::arg(num);
+        for(int i = 0; i < 3; ++i)
+        {
+            pix[i] = (unsigned char)(mag*(127.5*sin(arg + (M_PI * i) / 2) + 127.5));
+        }
+    }
+
+    //process-wide cache of parsed expressions, shared by every BitMap
+    Parsing::ExpressionCache<std::complex<double>>& expression_cache();
+
+    enum class ImageFormat
+    {
+        JPEG,
+        PPM, //binary P6, header + pixels in one write
+        PNG,
+        RAW  //bare RGB bytes, no header
+    };
+
+    ImageFormat format_from_extension(const std::string& filename); //defaults to JPEG when unknown
+
+    struct JpegOptions
+    {
+        int quality = 100;             //1 to 100
+        bool downsample = false;       //YCbCr 4:2:0 instead of 4:4:4
+        bool optimize_huffman = false; //tables built from the image in a first statistics pass
+        bool progressive = false;      //DC scan first, then AC bands per channel
+    };
+
+    enum class PixelLayout
+    {
+        RGB, //3 bytes per pixel, matches the output formats directly
+        RGBX //4 bytes per pixel, X is padding so each pixel is one aligned store
+    };
+
+    enum class PixelOrder
+    {
+        RowMajor, //rows one after another, what the output formats and wxImage expect
+        Tiled     //each render tile contiguous, tiles in Morton order. converted to rows on output
+    };
+
+    //work done by one render thread, accumulated in the thread's own copy and merged after the join
+    struct ThreadStats
+    {
+        double evaluate_ms = 0, colour_ms = 0, grid_ms = 0;
+        double busy_ms = 0, idle_ms = 0; //inside tiles, and waiting between the first tile starting and the last finishing
+        unsigned long evaluations = 0, interval_evaluations = 0, tiles = 0, tiles_culled = 0;
+
+        ThreadStats& operator+=(const ThreadStats& other);
+    };
+
+    struct TileTiming
+    {
+        int row, col;
+        unsigned thread;
+        double start_ms, end_ms; //since the render began
+        bool culled;
+    };
+
+    struct EncodeTiming
+    {
+        std::string format;
+        double start_ms, end_ms;
+    };
+
+    //region of the plane a render covers
+    struct Viewport
+    {
+        std::complex<double> centre{0, 0};
+        double extent = 10; //plane units from the centre to the nearest edge
+    };
+
+    struct PixelRect
+    {
+        int col, row, width, height;
+    };
+
+    //where the viewer is looking during interactive renders. tiles overlapping the exposed rectangles go first, then
+    //the rest nearest the focus point first; those and the tiles within radius of the point make up the focus region
+    struct Focus
+    {
+        double col = -1, row = -1;      //pixel, negative for the centre of the frame
+        double radius = 128;            //pixels
+        std::vector<PixelRect> exposed; //parts of the frame nothing is shown for yet, e.g. uncovered by a resize
+    };
+
+    //loop-invariant work taken out of the per-pixel loop in the last interpreted render
+    struct HoistingStats
+    {
+        std::size_t ops_per_pixel_before = 0, ops_per_pixel_after = 0;
+        std::size_t constant_ops = 0, frame_ops = 0, row_ops = 0, column_ops = 0; //now evaluated once, per row or per column
+        double ops_eliminated = 0; //operator applications saved over the whole frame
+    };
+
+    //how much a fused render shared between its expressions
+    struct FusionStats
+    {
+        std::size_t expressions = 0;
+        std::size_t ops_separate = 0, ops_fused = 0; //operators per pixel rendered one by one, and in the merged program
+    };
+
+    struct AnimationOptions
+    {
+        double t_start = 0, t_end = 1; //t goes from t_start on the first frame to t_end on the last
+        int frames = 60;
+        int maxval = 10;
+        bool grid = true;
+        unsigned int nthreads = std::thread::hardware_concurrency();
+        bool mjpeg = false; //one .mjpeg stream of concatenated frames instead of output_0000.jpg, output_0001.jpg, ...
+        JpegOptions jpeg;
+    };
+
+    struct AnimationStats
+    {
+        int frames = 0;
+        double wall_ms = 0, render_ms = 0, encode_ms = 0; //render and encode overlap, so they add up to more than wall
+        double fps = 0;
+    };
+
+    //instrumentation of the last render and whatever was encoded from it since
+    struct RenderStats
+    {
+        double wall_ms = 0;
+        double setup_ms = 0; //before the tiles start: expression lookup, JIT compile, hoisting, auto-exposure
+        std::vector<ThreadStats> threads;
+        std::vector<TileTiming> tiles;
+        std::vector<EncodeTiming> encodes;
+
+        ThreadStats total() const;
 
+        double encode_ms() const;
+
+        //trace-event JSON for chrome://tracing or Perfetto: one event per tile per thread, plus encodes
+        void write_trace(const std::string& filename) const;
+    };
 };
 
 /*
@@ -54,90 +207,1026 @@ struct BMPHeader {
 */
 
 
-static FILE* jpeg_out;
+static thread_local FILE* jpeg_out;
 class BitMap
 {
-    const int width, height;
-    unsigned char* pixels;
+    //non-owning view of a 64-byte aligned block, BitMap frees them.
+    //capacity only ever grows so resizing back to a seen size allocates nothing
+    struct PixelBuffer
+    {
+        unsigned char* data = nullptr;
+        std::size_t capacity = 0;
+        int width = 0, height = 0;
+        std::size_t stride = 0; //bytes per row, including padding. within a tile for tiled order
+        std::size_t size = 0;   //bytes in use
+
+        //tiled order only: byte offset of each tile (indexed row-major by tile), and the tiles in Morton order
+        std::vector<std::size_t> tile_offset;
+        std::vector<int> tile_sequence;
+    };
+
+    int width, height;
+    const ComplexPlot::PixelLayout layout;
+    const int bytes_per_pixel;
+    const bool pad_rows; //round each row up to a whole number of cache lines
+    const bool tiled;
+
+    PixelBuffer pixels;  //back buffer, the renderer writes here
+    PixelBuffer front;   //last completed frame, read by display and save paths
+    PixelBuffer packed;  //scratch for converting padded / RGBX frames to packed RGB on output
+
+    //while a render at a new size is under way: the front resampled to that size with the finished focus region drawn
+    //over it, packed RGB. guarded by front_mutex, emptied when a render begins or is published
+    std::vector<unsigned char> preview;
+    int preview_width = 0, preview_height = 0;
+    std::mutex front_mutex;
+    std::size_t allocations = 0;
+
+    //values of variables other than z, indexed by letter
+    std::array<std::complex<double>, 128> bindings{};
+    std::string bound_names;
+
+    void check_variables(const std::string& names) const; //throws for unbound variables, names as in variable_names()
+
+    template<typename T>
+    typename Parsing::Expression<std::complex<T>>::VarTable variable_table() const
+    {
+        typename Parsing::Expression<std::complex<T>>::VarTable vars{};
+        for(std::size_t i = 0; i < vars.size(); i++)
+            vars[i] = std::complex<T>(bindings[i]);
+        return vars;
+    }
+
+    void write_jpeg(FILE* out, const ComplexPlot::JpegOptions& options); //front as JPEG, call with front_mutex held
+
+    std::vector<unsigned char> png_bytes(bool fast); //locks front_mutex itself
+
+    bool hoist = true;
+    ComplexPlot::HoistingStats hoisting;
+
+    //an expression split by Parsing::StagedExpression, with its per-frame values already in frame_vars
+    //and its per-row and per-column values tabulated for the whole frame
+    template<typename T>
+    struct StagedFrame
+    {
+        Parsing::StagedExpression<std::complex<T>> staged;
+        typename Parsing::Expression<std::complex<T>>::VarTable frame_vars;
+        std::vector<char> row_slots, column_slots;
+        std::vector<std::complex<T>> row_values, column_values; //height x row_slots, width x column_slots
+    };
+
+    bool use_jit = false;
+    std::string jit_expr; //expression the cached kernel was built from
+    std::unique_ptr<ComplexPlot::JitKernel> jit_kernel;
+
+    void reserve(PixelBuffer& buf, std::size_t bytes);
+
+    void fit_to_size(PixelBuffer& buf); //give buf the current geometry, reusing its capacity
+
+    const unsigned char* packed_front(); //front as packed RGB rows, call with front_mutex held
+
+    std::atomic<double> last_render_ms{0};
+    std::atomic<unsigned long> frames{0};
+
+    void publish_frame(); //swap back and front once a render completes
+
+    void begin_frame(); //size the back buffer and reset the geometry to the whole bitmap
+
+    static constexpr int tile_size = 32; //tiles are handed to threads one at a time from a shared counter
+
+    double cull_tolerance = 0; //colour levels, 0 renders every pixel
+    std::atomic<int> tiles_total{0}, tiles_culled{0};
+
+    bool instrument = false;
+    std::mutex stats_mutex;
+    ComplexPlot::RenderStats stats;
+    std::chrono::steady_clock::time_point render_origin; //stats times are relative to this
+
+    using Clock = std::chrono::steady_clock;
+
+    static double ms_between(Clock::time_point a, Clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); }
+
+    void record_encode(const char* format, Clock::time_point start);
+
+    //plane coordinates of a pixel, maxval plane units from the centre to the nearest edge.
+    //the centre pixel and the scale come from the full image, which is larger than this bitmap when rendering a region
+    std::complex<double> centre{0, 0};
+    int origin_col = 0, origin_row = 0, scale_pixels = 0;
+
+    double plane_x(int column, double pixel_per_int) const { return (column - origin_col) / pixel_per_int + centre.real(); }
+
+    double plane_y(int row, double pixel_per_int) const { return (-row + origin_row) / pixel_per_int + centre.imag(); }
+
+    double pixel_scale(double maxval) const { return scale_pixels / (2.0 * maxval); }
+
+    //f at every pixel of the frame being rendered, for the root locator and contours. field_out is null unless they want them
+    std::vector<std::complex<double>> field;
+    std::complex<double>* field_out = nullptr;
+    static constexpr std::complex<double> unsampled{std::numeric_limits<double>::quiet_NaN(), 0};
+
+    void fill_field(const Parsing::Expression<std::complex<double>>& f, double maxval, unsigned int nthreads); //evaluate the unsampled pixels
+
+    bool find_roots = false, mark_roots = true;
+    std::vector<ComplexPlot::Root> back_roots, front_roots; //swapped along with the pixel buffers
+    std::atomic<double> roots_ms{0};
+
+    void locate_frame_roots(const Parsing::Expression<std::complex<double>>& f, double maxval, unsigned int nthreads);
+
+    void draw_root_marker(const ComplexPlot::Root& root, double pixel_per_int);
 
+    bool trace_contours = false;
+    ComplexPlot::ContourOptions contour_options;
+    ComplexPlot::ContourSet back_contours, front_contours; //swapped along with the pixel buffers
+
+    void contour_frame(const Parsing::Expression<std::complex<double>>& f, double maxval, unsigned int nthreads);
+
+    //f at every pixel of the previous plot_complex_func or plot_complex_region, for the next one to take over wherever a
+    //pixel lands on exactly the same point of the plane, bit for bit, under the same expression and variables
+    struct SampleCache
+    {
+        std::vector<std::complex<double>> values; //unsampled on grid lines and interpolated tiles
+        int width = 0, height = 0, origin_col = 0, origin_row = 0;
+        std::complex<double> centre;
+        double pixel_per_int = 0;
+        std::string expr;
+        std::array<std::complex<double>, 128> bindings{};
+        bool jit = false;
+    };
+
+    bool reuse_samples = false;
+    SampleCache sample_cache;
+    std::vector<int> reuse_rows, reuse_cols; //of the frame being rendered, the cached row or column at the same y or x, or -1
+    std::atomic<unsigned long> samples_reused{0};
+
+    void map_cached_samples(const std::string& expr, double maxval); //fills reuse_rows and reuse_cols
+
+    void cache_samples(const std::string& expr, double maxval); //keeps field for the next frame
+
+    const std::complex<double>* cached_sample(int row, int col) const
+    {
+        if(reuse_rows.empty() || reuse_rows[row] < 0 || reuse_cols[col] < 0) return nullptr;
+        const std::complex<double>& v = sample_cache.values[(std::size_t)reuse_rows[row] * sample_cache.width + reuse_cols[col]];
+        return std::isnan(v.real()) ? nullptr : &v;
+    }
+
+    bool auto_exposure = false;
+    ComplexPlot::ExposureOptions exposure_options;
+    ComplexPlot::ToneMap tone_map;   //of the frame being rendered, or the last one
+    bool tone_map_fresh = false;     //tone_map came from a histogram, so the next frame may blend with it
+    std::atomic<double> exposure_ms{0};
+    int image_width = 0, image_height = 0; //of the full image this bitmap is a region of, the histogram samples all of it
+
+    //histogram of |f| on every exposure_options.subsample-th pixel of the full image, each thread counting into
+    //its own before they are added up, and the tone map of the frame built from it
+    template<typename T, typename E>
+    void expose(const E& expr, const ComplexPlot::JitKernel* jit, double maxval, unsigned int nthreads)
+    {
+        auto start = Clock::now();
+        nthreads = std::max(1u, std::min(nthreads, std::thread::hardware_concurrency()));
+        double pixel_per_int = pixel_scale(maxval);
+        int step = exposure_options.subsample;
+        int col_shift = origin_col - image_width / 2, row_shift = origin_row - image_height / 2; //full image to this bitmap
+
+        std::vector<ComplexPlot::MagnitudeHistogram> histograms(nthreads);
+        std::vector<std::thread> threads;
+        for(unsigned int i = 0; i < nthreads; i++)
+            threads.emplace_back([&, i]()
+            {
+                auto vars = variable_table<T>();
+                std::vector<std::complex<T>> row_z, row_values;
+                for(int row = step / 2 + i * step; row < image_height; row += nthreads * step)
+                {
+                    row_z.clear();
+                    for(int col = step / 2; col < image_width; col += step)
+                        row_z.push_back({plane_x(col + col_shift, pixel_per_int), plane_y(row + row_shift, pixel_per_int)});
+                    row_values.resize(row_z.size());
+
+                    bool native = false;
+                    if constexpr(std::is_same<T, double>::value)
+                        if(jit)
+                        {
+                            jit->evaluate(row_z.data(), row_values.data(), (int)row_z.size(), bindings.data());
+                            native = true;
+                        }
+                    if(!native)
+                        for(std::size_t k = 0; k < row_z.size(); k++)
+                        {
+                            vars['z'] = row_z[k];
+                            row_values[k] = expr.evaluate_table(vars);
+                        }
+
+                    for(const auto& v : row_values)
+                        histograms[i].add(std::complex<double>(v));
+                }
+            });
+        for(auto& t : threads)
+            t.join();
+
+        for(unsigned int i = 1; i < nthreads; i++)
+            histograms[0] += histograms[i];
+        ComplexPlot::ToneMap fresh(histograms[0], exposure_options);
+        if(tone_map_fresh && exposure_options.smoothing > 0)
+            fresh.blend(tone_map, exposure_options.smoothing);
+        tone_map = fresh;
+        tone_map_fresh = true;
+        exposure_ms = ms_between(start, Clock::now());
+    }
+
+    void draw_grid_pixel(unsigned char* pix)
+    {
+        for(int i = 0; i < 3; ++i)
+            pix[i] = 30;
+    }
+
+    //bound f over the tile with interval arithmetic, and if no pixel can differ from its neighbours
+    //by more than the tolerance, colour it by bilinear interpolation of the four corner samples
     template<typename T>
-    void plot_complex_sector
-    (Parsing::Expression<std::complex<T>> expr, int start_row, int num_rows, int maxval, bool grid)
+    bool interpolate_tile
+    (const Parsing::Expression<std::complex<T>>& expr, typename Parsing::Expression<std::complex<T>>::VarTable& vars,
+     int r0, int c0, int r1, int c1, double pixel_per_int, double maxval, bool grid, ComplexPlot::ThreadStats* stats)
     {
-        T x, y;
-        double pixel_per_int = std::min(height, width) / (2.0 * maxval);
+        if(r1 == r0 || c1 == c0) return false;
 
-        for(int row = 0; row < num_rows && row + start_row < height; row++)
+        Clock::time_point t0, t1;
+        if(stats) t0 = Clock::now();
+
+        ComplexPlot::ComplexInterval box = {
+            {plane_x(c0, pixel_per_int), plane_x(c1, pixel_per_int)},
+            {plane_y(r1, pixel_per_int), plane_y(r0, pixel_per_int)}
+        };
+        ComplexPlot::ComplexInterval f = ComplexPlot::evaluate_interval(expr, box, vars);
+
+        double variation = cull_tolerance + 1;
+        if(f.bounded() && !f.contains_zero())
         {
+            //each channel is mag' * (127.5 sin(arg + phase) + 127.5) with mag' = 1 - 5 / (|f| + 5), or the tone map's
+            //level for |f|. both rise with |f|
+            ComplexPlot::Interval mag = ComplexPlot::magnitude(f);
+            double mag_lo = 1 - 5 / (mag.lo + 5), mag_hi = 1 - 5 / (mag.hi + 5);
+            if(auto_exposure)
+            {
+                mag_lo = tone_map(mag.lo * mag.lo);
+                mag_hi = tone_map(mag.hi * mag.hi);
+            }
+            variation = 255 * (mag_hi - mag_lo) + 127.5 * mag_hi * ComplexPlot::angular_span(f) + 1; //+1 for truncation
+        }
 
-            for(int j = 0; j < width; j++)
+        if(variation > cull_tolerance)
+        {
+            if(stats)
             {
-                x = (j - width / 2) / pixel_per_int;
-                y = (-(row + start_row) + height / 2) / pixel_per_int;
+                stats->interval_evaluations++;
+                stats->evaluate_ms += ms_between(t0, Clock::now());
+            }
+            return false;
+        }
+
+        unsigned char corner[4][3];
+        int rows[2] = {r0, r1}, cols[2] = {c0, c1};
+        for(int k = 0; k < 4; ++k)
+        {
+            vars['z'] = {plane_x(cols[k & 1], pixel_per_int), plane_y(rows[k >> 1], pixel_per_int)};
+            if(auto_exposure)
+                ComplexPlot::cmplx_to_colour(corner[k], expr.evaluate_table(vars), tone_map);
+            else
+                ComplexPlot::cmplx_to_colour(corner[k], expr.evaluate_table(vars));
+        }
+
+        if(stats) t1 = Clock::now();
 
-                if(grid && maxval <= 50 && (std::abs(y - std::floor(y)) < 0.002 || std::abs(x - std::floor(x)) < 0.002)) 
+        for(int row = r0; row <= r1; row++)
+        {
+            T y = plane_y(row, pixel_per_int);
+            double v = double(row - r0) / (r1 - r0);
+
+            for(int j = c0; j <= c1; j++)
+            {
+                T x = plane_x(j, pixel_per_int);
+                double u = double(j - c0) / (c1 - c0);
+                unsigned char* pix = pixels.data + at_pos_index(row, j);
+
+                if(grid && maxval <= 50 && (std::abs(y - std::floor(y)) < 0.002 || std::abs(x - std::floor(x)) < 0.002))
+                    draw_grid_pixel(pix);
+                else
                     for(int i = 0; i < 3; ++i)
+                        pix[i] = (unsigned char)((1 - v) * ((1 - u) * corner[0][i] + u * corner[1][i]) + v * ((1 - u) * corner[2][i] + u * corner[3][i]) + 0.5);
+
+                if(bytes_per_pixel == 4)
+                    pix[3] = 255;
+            }
+        }
+
+        if(stats)
+        {
+            stats->interval_evaluations++;
+            stats->evaluations += 4;
+            stats->tiles_culled++;
+            stats->evaluate_ms += ms_between(t0, t1);
+            stats->colour_ms += ms_between(t1, Clock::now());
+        }
+        return true;
+    }
+
+    //each row of the tile goes through three phases: grid lines are drawn (and the pixels under them skipped),
+    //the rest are evaluated into row_values, then coloured. stats, when given, gets the time spent in each
+    //E is Parsing::Expression or a Parsing::StaticExpression kernel. hoisting, culling and the JIT only apply to the first
+    template<typename T, typename E>
+    void plot_complex_tile
+    (const E& expr, const ComplexPlot::JitKernel* jit, const StagedFrame<T>* staged,
+     int start_row, int start_col, double maxval, bool grid, ComplexPlot::ThreadStats* stats)
+    {
+        constexpr bool interpreted = std::is_same<E, Parsing::Expression<std::complex<T>>>::value;
+        auto vars = staged ? staged->frame_vars : variable_table<T>();
+        const E& pixel_expr = [&]() -> const E&
+        {
+            if constexpr(interpreted)
+                if(staged) return staged->staged.pixel;
+            return expr;
+        }();
+        double pixel_per_int = pixel_scale(maxval);
+        int end_row = std::min(start_row + tile_size, height), end_col = std::min(start_col + tile_size, width);
+        int n = end_col - start_col;
+        std::array<std::complex<T>, tile_size> row_z, row_values;
+        std::array<bool, tile_size> on_grid;
+
+        if constexpr(interpreted)
+        {
+            if(cull_tolerance > 0 && interpolate_tile(expr, vars, start_row, start_col, end_row - 1, end_col - 1, pixel_per_int, maxval, grid, stats))
+            {
+                tiles_culled++;
+                if(field_out)
+                    for(int row = start_row; row < end_row; row++)
+                        std::fill_n(field_out + (std::size_t)row * width + start_col, n, unsampled);
+                return;
+            }
+        }
+
+        Clock::time_point t0, t1, t2;
+        unsigned long evaluations = 0;
+
+        for(int row = start_row; row < end_row; row++)
+        {
+            T y = plane_y(row, pixel_per_int);
+            bool grid_row = std::abs(y - std::floor(y)) < 0.002;
+            unsigned char* row_pix = pixels.data + at_pos_index(row, start_col);
+
+            if(stats) t0 = Clock::now();
+
+            for(int k = 0; k < n; k++)
+            {
+                T x = plane_x(start_col + k, pixel_per_int);
+                row_z[k] = {x, y};
+                on_grid[k] = grid && maxval <= 50 && (grid_row || std::abs(x - std::floor(x)) < 0.002);
+                if(on_grid[k])
+                    draw_grid_pixel(row_pix + k * bytes_per_pixel);
+            }
+
+            if(stats) t1 = Clock::now();
+
+            //samples the previous frame took at exactly these points, if any
+            int cached = 0;
+            if(!reuse_rows.empty() && reuse_rows[row] >= 0)
+                for(int k = 0; k < n; k++)
+                    if(!on_grid[k] && cached_sample(row, start_col + k))
+                        cached++;
+
+            //the native kernel evaluates the tile's part of a row per call, unless all of it is cached
+            bool native = false;
+            if constexpr(std::is_same<T, double>::value)
+            {
+                if(jit && cached < n - (int)std::count(on_grid.begin(), on_grid.begin() + n, true))
+                {
+                    jit->evaluate(row_z.data(), row_values.data(), n, bindings.data());
+                    evaluations += n;
+                    native = true;
+                    cached = 0;
+                }
+            }
+            if(!native)
+            {
+                std::size_t nr = staged ? staged->row_slots.size() : 0, nc = staged ? staged->column_slots.size() : 0;
+                for(std::size_t s = 0; s < nr; s++)
+                    vars[staged->row_slots[s]] = staged->row_values[row * nr + s];
+
+                for(int k = 0; k < n; k++)
+                    if(!on_grid[k])
                     {
-                        pixels[at_pos_index(row + start_row, j) + i] = 30;
+                        if(cached)
+                            if(const std::complex<double>* v = cached_sample(row, start_col + k))
+                            {
+                                row_values[k] = std::complex<T>(*v);
+                                continue;
+                            }
+                        for(std::size_t s = 0; s < nc; s++)
+                            vars[staged->column_slots[s]] = staged->column_values[(start_col + k) * nc + s];
+                        vars['z'] = row_z[k];
+                        row_values[k] = pixel_expr.evaluate_table(vars);
+                        evaluations++;
                     }
-                    
-                else 
-                    ComplexPlot::cmplx_to_colour(pixels + at_pos_index(row + start_row, j), expr.evaluate({{'z', {x, y}}}));
+            }
+
+            if(stats) t2 = Clock::now();
+
+            for(int k = 0; k < n; k++)
+            {
+                unsigned char* pix = row_pix + k * bytes_per_pixel;
+                if(!on_grid[k])
+                {
+                    if(auto_exposure)
+                        ComplexPlot::cmplx_to_colour(pix, row_values[k], tone_map);
+                    else
+                        ComplexPlot::cmplx_to_colour(pix, row_values[k]);
+                }
+
+                if(bytes_per_pixel == 4)
+                    pix[3] = 255;
+            }
+
+            if(field_out)
+                for(int k = 0; k < n; k++)
+                    field_out[(std::size_t)row * width + start_col + k] = on_grid[k] ? unsampled : std::complex<double>(row_values[k]);
+
+            if(cached)
+                samples_reused += cached;
+
+            if(stats)
+            {
+                Clock::time_point t3 = Clock::now();
+                stats->grid_ms += ms_between(t0, t1);
+                stats->evaluate_ms += ms_between(t1, t2);
+                stats->colour_ms += ms_between(t2, t3);
             }
         }
+
+        if(stats) stats->evaluations += evaluations;
     }
 
 
-    int at_pos_index(int row, int column)
+    std::size_t at_pos_index(int row, int column)
     {
         assert(row < height && column < width);
-        return 3 * (row * width + column);
+        if(tiled)
+        {
+            std::size_t tile = (row / tile_size) * ((width + tile_size - 1) / tile_size) + column / tile_size;
+            return pixels.tile_offset[tile] + (row % tile_size) * pixels.stride + bytes_per_pixel * (column % tile_size);
+        }
+        return row * pixels.stride + bytes_per_pixel * column;
     }
 
-    template<typename T>
-    void plot_complex
-    (Parsing::Expression<std::complex<T>>& expr, int maxval, bool grid, unsigned int nthreads)
+    //one worker's share of the frame, a contiguous run of the tile sequence
+    struct alignas(64) TileRun
     {
-        nthreads = (int)std::min(nthreads, std::thread::hardware_concurrency()); //no more threads than available processors
-        int rows_per_thread = height / nthreads; //size of each horizontal slice
+        std::atomic<int> next{0};
+        int end = 0;
+    };
 
-        std::cout << "Using " << nthreads << " threads...\n";
-        std::vector<std::thread> threads;
-        threads.reserve(nthreads + 1); 
+    static void pin_to_cpu(std::thread& t, unsigned cpu);
 
-        
-        
-        for(int row = 0; row < height - height % rows_per_thread; row += rows_per_thread)
+    //the tiles of a focused render in the order they are taken
+    struct TileSchedule
+    {
+        std::vector<int> order;
+        std::vector<int> focus;  //the tiles of the focus region
+        Clock::time_point since; //when this focus was asked for, or the render began
+        std::atomic<bool> reported{false};
+    };
+
+    std::mutex focus_mutex;
+    bool focused = false;
+    ComplexPlot::Focus focus;
+    std::shared_ptr<TileSchedule> schedule; //of the render in progress, null between renders
+    std::atomic<unsigned> schedule_generation{0};
+    std::function<void()> focus_callback;
+    std::atomic<double> focus_ms{0};
+
+    std::shared_ptr<TileSchedule> make_schedule(Clock::time_point since) const; //for focus at the current size, call with focus_mutex held
+
+    void focus_complete(const TileSchedule& done); //records the time and shows the region in the front buffer or the preview
+
+    //renders every tile on nthreads workers. tile_func(start_row, start_col, stats) renders one tile,
+    //stats is the worker's own counters when instrumentation is on, otherwise nullptr.
+    //each worker owns a contiguous run of tiles (Morton order when tiled, else row-major) and steals
+    //from the other runs once its own is done, so expensive regions don't hold up the frame while
+    //frame after frame the same worker writes, and first touches, the same memory.
+    //with a focus set, every worker instead takes the next unclaimed tile of the shared schedule, and a new focus
+    //replaces the schedule mid-render: workers finish the tile in hand, then continue in the new order
+    template<typename F>
+    void render_tiles(unsigned int nthreads, F tile_func)
+    {
+        nthreads = std::max(1u, std::min(nthreads, std::thread::hardware_concurrency())); //no more threads than available processors
+
+        int tiles_x = (width + tile_size - 1) / tile_size, tiles_y = (height + tile_size - 1) / tile_size;
+        tiles_total = tiles_x * tiles_y;
+        tiles_culled = 0;
+
+        std::vector<TileRun> runs(nthreads);
+        for(unsigned int i = 0; i < nthreads; i++)
         {
-            threads.push_back(
-                std::thread(
-                    [=, this](){this->plot_complex_sector(expr, row, rows_per_thread, maxval, grid);}
-                )
-            );
+            runs[i].next = (int)((long)tiles_total * i / nthreads);
+            runs[i].end = (int)((long)tiles_total * (i + 1) / nthreads);
         }
+        const int* sequence = tiled ? pixels.tile_sequence.data() : nullptr;
+
+        //one per worker and cache line aligned, so counting needs no atomics and no line is shared
+        struct alignas(64) WorkerLog
+        {
+            ComplexPlot::ThreadStats stats;
+            std::vector<ComplexPlot::TileTiming> tiles;
+        };
+        std::vector<WorkerLog> logs(instrument ? nthreads : 0);
+        Clock::time_point origin = render_origin, tiles_start = Clock::now();
 
-        if(height % nthreads)
+        auto run = [&](unsigned int i, int tile)
+        {
+            WorkerLog* log = logs.empty() ? nullptr : &logs[i];
+            int row = (tile / tiles_x) * tile_size, col = (tile % tiles_x) * tile_size;
+            if(!log)
+            {
+                tile_func(row, col, nullptr);
+                return;
+            }
+
+            Clock::time_point start = Clock::now();
+            unsigned long culled = log->stats.tiles_culled;
+            tile_func(row, col, &log->stats);
+            Clock::time_point end = Clock::now();
+
+            log->stats.tiles++;
+            log->stats.busy_ms += ms_between(start, end);
+            log->tiles.push_back({row, col, i, ms_between(origin, start), ms_between(origin, end), log->stats.tiles_culled != culled});
+        };
+
+        bool prioritise;
+        {
+            std::lock_guard<std::mutex> lock(focus_mutex);
+            prioritise = focused;
+            if(focused)
+            {
+                schedule = make_schedule(Clock::now());
+                schedule_generation++;
+            }
+        }
+        std::vector<std::atomic<unsigned char>> claimed(prioritise ? tiles_total.load() : 0), done(claimed.size());
+
+        std::vector<std::thread> threads;
+        threads.reserve(nthreads);
+
+        for(unsigned int i = 0; i < nthreads; i++)
         {
             threads.push_back(
                 std::thread(
-                    [=, this](){this->plot_complex_sector(expr, height - height % nthreads, height % nthreads, maxval, grid);}
+                    [=, &run, &runs, &claimed, &done]()
+                    {
+                        if(!prioritise)
+                        {
+                            for(unsigned int victim = 0; victim < nthreads; victim++)
+                            for(int slot; (slot = runs[(i + victim) % nthreads].next++) < runs[(i + victim) % nthreads].end;)
+                                run(i, sequence ? sequence[slot] : slot);
+                            return;
+                        }
+
+                        std::shared_ptr<TileSchedule> mine;
+                        unsigned int seen = 0;
+                        std::size_t cursor = 0;
+                        for(;;)
+                        {
+                            if(!mine || schedule_generation != seen)
+                            {
+                                std::lock_guard<std::mutex> lock(focus_mutex);
+                                mine = schedule;
+                                seen = schedule_generation;
+                                cursor = 0;
+                            }
+                            while(cursor < mine->order.size() && claimed[mine->order[cursor]].exchange(1))
+                                cursor++;
+                            if(cursor == mine->order.size())
+                                break;
+
+                            int tile = mine->order[cursor++];
+                            run(i, tile);
+                            done[tile] = 1;
+
+                            if(!mine->reported && seen == schedule_generation
+                               && std::all_of(mine->focus.begin(), mine->focus.end(), [&](int t){ return done[t] != 0; })
+                               && !mine->reported.exchange(true))
+                                focus_complete(*mine);
+                        }
+                    }
                 )
             );
+            if(tiled && nthreads > 1 && !prioritise)
+                pin_to_cpu(threads.back(), i);
         }
         
         for(auto& t : threads)
             t.join();
+
+        if(prioritise)
+        {
+            std::shared_ptr<TileSchedule> last;
+            {
+                std::lock_guard<std::mutex> lock(focus_mutex);
+                last = std::move(schedule);
+            }
+            if(!last->reported) //the focus moved onto tiles already done, or after the last was taken
+                focus_complete(*last);
+        }
+
+        if(instrument)
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            stats.setup_ms = ms_between(origin, tiles_start);
+            double tiles_ms = ms_between(tiles_start, Clock::now());
+            for(auto& log : logs)
+            {
+                log.stats.idle_ms = tiles_ms - log.stats.busy_ms; //waiting to start, and for the last tiles of other threads
+                stats.threads.push_back(log.stats);
+                stats.tiles.insert(stats.tiles.end(), log.tiles.begin(), log.tiles.end());
+            }
+        }
+    }
+
+    template<typename T, typename E>
+    void plot_complex(const E& expr, const ComplexPlot::JitKernel* jit, double maxval, bool grid, unsigned int nthreads)
+    {
+        //the native kernel has its own optimiser, hoisting is for the interpreter
+        std::unique_ptr<StagedFrame<T>> staged;
+        hoisting = {};
+        if constexpr(std::is_same<E, Parsing::Expression<std::complex<T>>>::value)
+            if(!jit && hoist)
+                staged = stage_frame(expr, maxval);
+
+        if(auto_exposure)
+            expose<T>(expr, jit, maxval, nthreads);
+
+        const StagedFrame<T>* frame = staged.get();
+        render_tiles(nthreads, [=, &expr, this](int row, int col, ComplexPlot::ThreadStats* stats)
+        {
+            this->plot_complex_tile(expr, jit, frame, row, col, maxval, grid, stats);
+        });
+    }
+
+    //split expr by how often each part changes over the frame and evaluate everything that isn't per pixel.
+    //nullptr when nothing can be hoisted
+    template<typename T>
+    std::unique_ptr<StagedFrame<T>> stage_frame(const Parsing::Expression<std::complex<T>>& expr, double maxval)
+    {
+        using Parsing::Stage;
+        auto frame = std::make_unique<StagedFrame<T>>(StagedFrame<T>{Parsing::StagedExpression<std::complex<T>>(expr), variable_table<T>(), {}, {}, {}, {}});
+        const auto& staged = frame->staged;
+
+        std::size_t before = staged.ops_in_stage(Stage::Constant) + staged.ops_in_stage(Stage::Frame) + staged.ops_in_stage(Stage::Row)
+                           + staged.ops_in_stage(Stage::Column) + staged.ops_in_stage(Stage::Pixel);
+        hoisting = {before, before};
+        if(staged.hoisted.empty())
+            return nullptr;
+
+        double pixel_per_int = pixel_scale(maxval);
+        for(const auto& h : staged.hoisted)
+        {
+            if(h.stage == Stage::Row) frame->row_slots.push_back(h.slot);
+            else if(h.stage == Stage::Column) frame->column_slots.push_back(h.slot);
+            else frame->frame_vars[h.slot] = h.expr.evaluate_table(frame->frame_vars);
+        }
+
+        //imag(z) and real(z) only ever see their own half of z
+        auto vars = frame->frame_vars;
+        std::size_t nr = frame->row_slots.size(), nc = frame->column_slots.size();
+        frame->row_values.resize(nr * height);
+        frame->column_values.resize(nc * width);
+        for(const auto& h : staged.hoisted)
+        {
+            if(h.stage == Stage::Row)
+            {
+                std::size_t s = std::find(frame->row_slots.begin(), frame->row_slots.end(), h.slot) - frame->row_slots.begin();
+                for(int row = 0; row < height; row++)
+                {
+                    vars['z'] = {0, plane_y(row, pixel_per_int)};
+                    frame->row_values[row * nr + s] = h.expr.evaluate_table(vars);
+                }
+            }
+            else if(h.stage == Stage::Column)
+            {
+                std::size_t s = std::find(frame->column_slots.begin(), frame->column_slots.end(), h.slot) - frame->column_slots.begin();
+                for(int col = 0; col < width; col++)
+                {
+                    vars['z'] = {plane_x(col, pixel_per_int), 0};
+                    frame->column_values[col * nc + s] = h.expr.evaluate_table(vars);
+                }
+            }
+        }
+
+        double pixels = double(width) * height;
+        hoisting.ops_per_pixel_after = staged.ops_per_pixel();
+        hoisting.constant_ops = staged.ops_in_stage(Stage::Constant);
+        hoisting.frame_ops = staged.ops_in_stage(Stage::Frame);
+        hoisting.row_ops = staged.ops_in_stage(Stage::Row);
+        hoisting.column_ops = staged.ops_in_stage(Stage::Column);
+        hoisting.ops_eliminated = (before - hoisting.ops_per_pixel_after) * pixels
+                                - (hoisting.constant_ops + hoisting.frame_ops + hoisting.row_ops * height + hoisting.column_ops * width);
+        return frame;
     }
 
+    //recolour a newton render by which distinct root each pixel reached, so roots on one ray from 0 differ too
+    void colour_newton_basins(const std::vector<std::pair<std::complex<double>, int>>& reached, int max_iterations);
+
+    //newton's method from every pixel. the root reached and the iterations taken go to reached (row-major, NaN where
+    //it doesn't converge within max_iterations) for colour_newton_basins; until then the pixel is coloured by the
+    //root's phase, so a focus preview shows something close. pixels that don't converge are black
+    template<typename T>
+    void plot_newton_tile(const Parsing::Expression<std::complex<T>>& expr, int start_row, int start_col, double maxval, int max_iterations,
+                          std::pair<std::complex<double>, int>* reached, ComplexPlot::ThreadStats* stats)
+    {
+        auto vars = variable_table<T>();
+        double pixel_per_int = pixel_scale(maxval);
+        int end_row = std::min(start_row + tile_size, height), end_col = std::min(start_col + tile_size, width);
+        unsigned long evaluations = 0;
+
+        for(int row = start_row; row < end_row; row++)
+        {
+            for(int j = start_col; j < end_col; j++)
+            {
+                std::complex<T> z = {plane_x(j, pixel_per_int), plane_y(row, pixel_per_int)};
+                int iteration = 0;
+                bool converged = false;
+
+                for(; iteration < max_iterations && !converged; iteration++)
+                {
+                    vars['z'] = z;
+                    auto [f, df] = expr.evaluate_with_derivative(vars);
+                    std::complex<T> step = f / df;
+                    if(!std::isfinite(step.real()) || !std::isfinite(step.imag()))
+                        break;
+                    z -= step;
+                    converged = std::abs(step) < 1e-9;
+                }
+                evaluations += iteration;
+                reached[(std::size_t)row * width + j] = {converged ? std::complex<double>(z) : std::complex<double>(NAN, NAN), iteration};
+
+                unsigned char* pix = pixels.data + at_pos_index(row, j);
+                for(int i = 0; i < 3; ++i)
+                    pix[i] = 0;
+                if(converged)
+                {
+                    ComplexPlot::cmplx_to_colour(pix, std::polar<T>(20, std::arg(z))); //bright, hue from the root's phase
+                    double shade = 1 - 0.8 * iteration / max_iterations;
+                    for(int i = 0; i < 3; ++i)
+                        pix[i] = (unsigned char)(pix[i] * shade);
+                }
+
+                if(bytes_per_pixel == 4)
+                    pix[3] = 255;
+            }
+        }
+
+        if(stats) stats->evaluations += evaluations;
+    }
+
+    //deep zoom: every pixel is an offset from the viewport centre, which only the perturbation holds exactly
+    void plot_deep_tile(const ComplexPlot::Perturbation& f, int start_row, int start_col, double pixel_per_int, ComplexPlot::ThreadStats* stats)
+    {
+        int end_row = std::min(start_row + tile_size, height), end_col = std::min(start_col + tile_size, width);
+
+        for(int row = start_row; row < end_row; row++)
+        {
+            double dy = (-row + origin_row) / pixel_per_int;
+            for(int j = start_col; j < end_col; j++)
+            {
+                unsigned char* pix = pixels.data + at_pos_index(row, j);
+                ComplexPlot::cmplx_to_colour(pix, f.evaluate({(j - origin_col) / pixel_per_int, dy}));
+                if(bytes_per_pixel == 4)
+                    pix[3] = 255;
+            }
+        }
+
+        if(stats) stats->evaluations += (unsigned long)(end_row - start_row) * (end_col - start_col);
+    }
+
+    //one evaluation of the fused program per pixel, coloured into every output. this bitmap supplies the geometry
+    void plot_fused_tile(const Parsing::FusedExpression<std::complex<double>>& fused, const std::vector<BitMap*>& outputs,
+                         int start_row, int start_col, double maxval, bool grid, ComplexPlot::ThreadStats* stats)
+    {
+        auto vars = variable_table<double>();
+        std::vector<std::complex<double>> regs(fused.registers()), values(fused.size());
+        fused.bind(vars, regs.data());
+
+        double pixel_per_int = pixel_scale(maxval);
+        int end_row = std::min(start_row + tile_size, height), end_col = std::min(start_col + tile_size, width);
+
+        for(int row = start_row; row < end_row; row++)
+        {
+            double y = plane_y(row, pixel_per_int);
+            bool grid_row = std::abs(y - std::floor(y)) < 0.002;
+
+            for(int j = start_col; j < end_col; j++)
+            {
+                double x = plane_x(j, pixel_per_int);
+                bool on_grid = grid && maxval <= 50 && (grid_row || std::abs(x - std::floor(x)) < 0.002);
+                if(!on_grid)
+                {
+                    vars['z'] = {x, y};
+                    fused.evaluate(vars, regs.data(), values.data());
+                }
+
+                for(std::size_t k = 0; k < outputs.size(); k++)
+                {
+                    BitMap& out = *outputs[k];
+                    unsigned char* pix = out.pixels.data + out.at_pos_index(row, j);
+                    if(on_grid)
+                        draw_grid_pixel(pix);
+                    else
+                        ComplexPlot::cmplx_to_colour(pix, values[k]);
+                    if(out.bytes_per_pixel == 4)
+                        pix[3] = 255;
+                }
+            }
+        }
+
+        if(stats) stats->evaluations += (unsigned long)(end_row - start_row) * (end_col - start_col);
+    }
+
+    //time a render into the back buffer and publish it
+    void render_frame(const std::function<void()>& render);
+
+    void plot_viewport(const std::string& expr, const ComplexPlot::Viewport& view, bool grid, unsigned int nthreads);
+
     public:
 
-        BitMap(int width, int height);
+        //locked view of the front buffer, packed RGB rows, owned by the BitMap.
+        //suitable for wxImage(width, height, data, true) without copying (RGB row-major
+        //layout without row padding; other layouts are packed into scratch first).
+        //the renderer will not publish over it while this is held
+        struct FrontBuffer
+        {
+            std::unique_lock<std::mutex> lock;
+            unsigned char* data;
+            int width, height;
+        };
+
+        //tiled order keeps each 32x32 render tile in its own contiguous block (a page for RGBX) and pins the
+        //render threads, so on NUMA machines each tile's memory stays local to the thread that renders it.
+        //it costs a conversion on output, so wxImage and the savers no longer see the buffer directly
+        BitMap(int width, int height, ComplexPlot::PixelLayout layout = ComplexPlot::PixelLayout::RGB, bool pad_rows = false,
+               ComplexPlot::PixelOrder order = ComplexPlot::PixelOrder::RowMajor);
 
         ~BitMap();
 
-        void plot_complex_func(std::string expr, int maxval, bool grid, unsigned int nthreads);
+        //change the size of the next render, the front buffer keeps showing the previous frame
+        void resize(int width, int height);
+
+        int get_width() const { return width; }
+
+        int get_height() const { return height; }
+
+        std::size_t allocation_count() const { return allocations; } //pixel buffer allocations so far
+
+        //build expressions into native code for long batch renders, falls back to the interpreter
+        //when no compiler is available. the first render of each expression pays for compilation
+        void set_jit(bool enabled) { use_jit = enabled; }
+
+        bool jit_active() const { return jit_kernel != nullptr && use_jit; }
+
+        //skip evaluating tiles that interval bounds prove vary by at most tolerance colour levels,
+        //filling them from their corners instead. 0 (the default) evaluates every pixel
+        void set_tile_culling(double tolerance) { cull_tolerance = tolerance; }
+
+        //evaluate parts of the expression that don't change across the frame, a row or a column only
+        //once per frame, row or column instead of per pixel. on by default, results are identical
+        void set_hoisting(bool enabled) { hoist = enabled; }
+
+        ComplexPlot::HoistingStats hoisting_stats() const { return hoisting; }
+
+        //find the zeros and poles of f on every plot_complex_func and plot_complex_region, from the samples the render
+        //evaluates anyway, and mark them on the frame: rings on zeros, crosses on poles, larger for higher orders
+        void set_root_finding(bool enabled, bool markers = true) { find_roots = enabled; mark_roots = markers; }
+
+        std::vector<ComplexPlot::Root> roots(); //found in the front buffer's frame, empty unless root finding is on
+
+        double last_roots_ms() const { return roots_ms; } //part of last_frame_ms
+
+        //trace level curves of |f| and arg f through the samples of every plot_complex_func and plot_complex_region,
+        //drawn antialiased over the frame when options.overlay is set. pixels the render skipped are evaluated first
+        void set_contours(bool enabled, const ComplexPlot::ContourOptions& options = {}) { trace_contours = enabled; contour_options = options; }
+
+        ComplexPlot::ContourSet contours(); //traced in the front buffer's frame, with their timings
+
+        //the front frame's contours as SVG paths, over the frame itself as an embedded PNG when with_image is set.
+        //returns the number of bytes written
+        std::size_t save_svg(std::string filename, bool with_image = true);
+
+        //brightness from the frame's own spread of |f| instead of a fixed curve, so functions that are large or small
+        //everywhere don't render almost all bright or all dark. a histogram of a subsampled grid is taken before each
+        //render and equalised into the tone map the colouring looks up. applies to plot_complex_func, plot_complex_region,
+        //plot_static and plot_complex_derivative; regions sample the whole image, so they match when stitched
+        void set_auto_exposure(bool enabled, const ComplexPlot::ExposureOptions& options = {});
+
+        double exposure_midpoint() const { return auto_exposure ? tone_map.midpoint() : 5; } //|f| shown at half brightness
+
+        double last_exposure_ms() const { return exposure_ms; } //part of last_frame_ms
+
+        //keep every plot_complex_func and plot_complex_region's samples, and have the next render take them over instead
+        //of evaluating f again wherever a pixel falls on exactly the same point of the plane: after a resize that keeps
+        //the scale, a pan by whole pixels, or a zoom by a power of two. the frame is the same as a fresh render
+        void set_sample_reuse(bool enabled);
+
+        double reused_fraction() const { return width && height ? double(samples_reused) / ((double)width * height) : 0; } //of the last render's pixels
+
+        //the front frame as plot_complex_func would place it at another size: same centre and extent, so scaled by the
+        //change in the smaller side and cropped or padded with black. packed RGB rows, for showing straight away while
+        //the frame renders at the new size. once that render's focus region is done, it is drawn in as well
+        std::vector<unsigned char> resampled_front(int width, int height);
+
+        //interactive renders: take tiles nearest the focus first instead of in memory order. may be called while a
+        //render is in progress, whose remaining tiles then follow the new focus
+        void set_focus(const ComplexPlot::Focus& focus);
+
+        void clear_focus(); //back to memory order from the next render
+
+        //called on a render thread once the focus region of a render in progress is complete, after its pixels have
+        //been copied into the front buffer over the previous frame, or when the size changed, into what
+        //resampled_front returns at the new size. set between renders
+        void set_focus_callback(std::function<void()> callback) { focus_callback = std::move(callback); }
+
+        double last_focus_ms() const { return focus_ms; } //from the render starting, or the focus changing, until the focus region was done
+
+        //collect per-thread phase timers, per-tile timings and evaluation counts on every render.
+        //off by default, the uninstrumented path only checks a null pointer per row
+        void set_instrumentation(bool enabled) { instrument = enabled; }
+
+        ComplexPlot::RenderStats render_stats();
+
+        //share of the last render's tiles that were interpolated rather than evaluated
+        double culled_fraction() const { return tiles_total ? double(tiles_culled) / tiles_total : 0; }
+
+        FrontBuffer acquire_front();
+
+        double last_frame_ms() const { return last_render_ms; } //render time of the most recently published frame
+
+        unsigned long frame_count() const { return frames; }
+
+        void plot_complex_func(std::string expr, int maxval, bool grid, unsigned int nthreads); //centred on 0, maxval to the nearest edge
+
+        void plot_complex_func(std::string expr, const ComplexPlot::Viewport& view, bool grid, unsigned int nthreads);
+
+        //for extents below about 1e-12 * |centre|, where plot_complex_func runs out of precision. no grid lines,
+        //tile culling, hoisting or JIT; about 0.7 to 2 times the time of a plain render, see the bench's deep-slowdown
+        void plot_complex_deep(std::string expr, const ComplexPlot::DeepViewport& view, unsigned int nthreads);
+
+        //render with a kernel compiled from a string literal, e.g. plot_static<Parsing::StaticExpression<Rational>>(view, true, 4).
+        //no parsing or interpretation at run time; tile culling, hoisting and the JIT don't apply
+        template<typename Kernel>
+        void plot_static(const ComplexPlot::Viewport& view, bool grid, unsigned int nthreads)
+        {
+            if(!(view.extent > 0)) throw std::invalid_argument("Viewport extent must be positive");
+
+            render_frame([&]()
+            {
+                check_variables(Kernel::variable_names());
+                centre = view.centre;
+                BitMap::plot_complex<double>(Kernel(), nullptr, view.extent, grid, nthreads);
+            });
+        }
+
+        //render exprs[k] into *outputs[k], all over the same view, in one pass that computes every subexpression they
+        //share once per pixel. the outputs must be the same size; variables come from outputs[0]
+        static ComplexPlot::FusionStats plot_complex_funcs(const std::vector<std::string>& exprs, const std::vector<BitMap*>& outputs,
+                                                           const ComplexPlot::Viewport& view, bool grid, unsigned int nthreads);
+
+        //render this bitmap as the part of a full_width x full_height image of view whose top left pixel is (col, row),
+        //pixel for pixel what the full render puts there. keep col and row multiples of 32 when tile culling is on
+        void plot_complex_region(std::string expr, const ComplexPlot::Viewport& view, int full_width, int full_height,
+                                 int col, int row, bool grid, unsigned int nthreads);
+
+        //value used for a variable other than z in every following render, e.g. c in z^2+c
+        void set_variable(char name, std::complex<double> value);
+
+        void clear_variables();
+
+        //render frames with t swept over the options' range, writing each as a JPEG. frame n is encoded
+        //on its own thread while frame n+1 renders, so throughput is set by the slower of the two. t is bound only
+        //while this runs, any earlier value of t is back when it returns or throws
+        ComplexPlot::AnimationStats animate(std::string expr, const std::string& output, const ComplexPlot::AnimationOptions& options = {});
+
+        //plot f'(z), derived symbolically from expr. throws std::invalid_argument if f is not holomorphic
+        void plot_complex_derivative(std::string expr, int maxval, bool grid, unsigned int nthreads);
+
+        //basins of attraction of newton's method for f(z) = 0, f' from the fused value + derivative evaluator.
+        //each distinct root found in the frame gets its own hue, shaded by the iterations taken to reach it
+        void plot_newton_fractal(std::string expr, int maxval, unsigned int nthreads, int max_iterations = 50);
+
+        void save_jpeg(std::string filename, const ComplexPlot::JpegOptions& options = {});
+
+        //lossless writers, each returns the number of bytes written
+        std::size_t save_ppm(std::string filename);
+
+        std::size_t save_raw(std::string filename);
+
+        std::size_t save_png(std::string filename, bool fast = true); //fast: Sub filter + Z_BEST_SPEED, otherwise per-row adaptive filter
+
+        std::size_t save(std::string filename, ComplexPlot::ImageFormat format);
 
-        void save_jpeg(std::string filename);
+        //the front buffer encoded in memory, as the matching save function would write it
+        std::vector<unsigned char> encode(ComplexPlot::ImageFormat format, const ComplexPlot::JpegOptions& options = {});
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,112 @@
+#ifndef RENDER_SERVER_HPP
+#define RENDER_SERVER_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "libcplot.hpp"
+
+namespace ComplexPlot
+{
+    struct ServerOptions
+    {
+        std::string unix_path;  //listen on this Unix domain socket when set,
+        int port = 0;           //otherwise on 127.0.0.1:port, 0 picks a free one
+        unsigned int workers = std::max(1u, std::thread::hardware_concurrency());
+        unsigned int render_threads = 1;       //per request, requests already render in parallel
+        std::size_t queue_limit = 64;          //connections waiting for a worker before new ones get 503
+        std::size_t cache_bytes = 256u << 20;  //encoded images kept for repeated requests
+    };
+
+    struct ServerStats
+    {
+        unsigned long requests = 0, rejected = 0, errors = 0, cache_hits = 0;
+        std::size_t queued = 0, cached_bytes = 0;
+        double p50_ms = 0, p99_ms = 0; //accept to last byte sent, over the most recent requests
+    };
+
+    //a warm renderer shared by local tools. speaks HTTP/1.0 on a Unix socket or localhost TCP:
+    //  GET /render?expr=z%5E2%2Bc&re=0&im=0&extent=2&w=256&h=256&format=png&grid=1&var_c=0.3,0.5
+    //  GET /stats
+    //query values are percent-decoded, a literal + stays a plus so expressions can be sent as typed.
+    //parsed expressions are shared through expression_cache(), encoded images through an LRU cache
+    class RenderServer
+    {
+    public:
+        explicit RenderServer(ServerOptions options); //binds and listens, throws std::runtime_error
+
+        ~RenderServer();
+
+        RenderServer(const RenderServer&) = delete;
+        RenderServer& operator=(const RenderServer&) = delete;
+
+        int port() const { return bound_port; }
+
+        void run(); //serves until stop()
+
+        void stop(); //only writes to a pipe, so safe from a signal handler
+
+        ServerStats stats();
+
+    private:
+        struct Connection
+        {
+            int fd;
+            std::chrono::steady_clock::time_point accepted;
+        };
+
+        struct Response
+        {
+            int status;
+            std::string content_type;
+            std::shared_ptr<const std::vector<unsigned char>> body;
+            std::string extra_headers;
+            bool cached = false;
+        };
+
+        ServerOptions options;
+        int listen_fd = -1, bound_port = 0;
+        int wake_pipe[2] = {-1, -1};
+        std::atomic<bool> stopping{false};
+
+        std::mutex queue_mutex;
+        std::condition_variable queue_ready;
+        std::deque<Connection> queue;
+        std::vector<std::thread> workers;
+
+        //encoded images by canonical request, least recently used at the back
+        std::mutex cache_mutex;
+        std::list<std::pair<std::string, std::shared_ptr<const std::vector<unsigned char>>>> lru;
+        std::unordered_map<std::string, decltype(lru)::iterator> cache;
+        std::size_t cached_bytes = 0;
+
+        std::mutex stats_mutex;
+        ServerStats counters;
+        std::vector<double> latencies; //ring buffer
+        std::size_t next_latency = 0;
+
+        void worker_loop();
+
+        void serve(Connection connection, BitMap& bitmap);
+
+        Response handle(const std::string& target, BitMap& bitmap);
+
+        Response render(const std::unordered_map<std::string, std::string>& query, BitMap& bitmap);
+
+        std::shared_ptr<const std::vector<unsigned char>> cache_find(const std::string& key);
+
+        void cache_insert(const std::string& key, std::shared_ptr<const std::vector<unsigned char>> body);
+
+        void record(double latency_ms, bool error, bool hit);
+    };
+};
+
+#endif
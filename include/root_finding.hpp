@@ -0,0 +1,29 @@
+#ifndef ROOT_FINDING_HPP
+#define ROOT_FINDING_HPP
+
+#include <complex>
+#include <vector>
+
+#include "expr_parsing_cpp/parsing.hpp"
+#include "sampled_field.hpp"
+
+namespace ComplexPlot
+{
+    //a zero (order > 0) or pole (order < 0) of f, |order| is its multiplicity
+    struct Root
+    {
+        std::complex<double> z;
+        int order;
+        bool refined; //newton converged; otherwise z is the centre of the smallest cell that still winds
+    };
+
+    //zeros and poles inside the frame by the argument principle. the winding number of f around every cell x cell
+    //block of pixels comes from the stored samples, blocks that wind are subdivided down to a quarter pixel and
+    //the result polished with newton's method. blocks are shared out over nthreads. a zero and a pole inside the
+    //same block cancel and may be missed; roots are sorted by real then imaginary part
+    std::vector<Root> locate_roots(const Parsing::Expression<std::complex<double>>& f,
+                                   const Parsing::Expression<std::complex<double>>::VarTable& vars,
+                                   const SampledField& field, int cell, unsigned int nthreads);
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef SAMPLED_FIELD_HPP
+#define SAMPLED_FIELD_HPP
+
+#include <complex>
+
+namespace ComplexPlot
+{
+    //f at every pixel of a rendered frame, row-major, NaN where the render skipped the pixel (grid lines,
+    //interpolated tiles). pixel (row, col) lies at centre + ((col - origin_col), (origin_row - row)) / pixel_per_int
+    struct SampledField
+    {
+        const std::complex<double>* values;
+        int width, height;
+        std::complex<double> centre;
+        int origin_col, origin_row;
+        double pixel_per_int;
+
+        std::complex<double> position(double row, double col) const
+        {
+            return {(col - origin_col) / pixel_per_int + centre.real(), (origin_row - row) / pixel_per_int + centre.imag()};
+        }
+    };
+}
+
+#endif
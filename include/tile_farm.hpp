@@ -0,0 +1,97 @@
+#ifndef TILE_FARM_HPP
+#define TILE_FARM_HPP
+
+#include <chrono>
+#include <complex>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "libcplot.hpp"
+
+namespace ComplexPlot
+{
+    //one image to be rendered across worker processes
+    struct FarmJob
+    {
+        std::string expr;
+        Viewport view;
+        int width = 1024, height = 1024;
+        bool grid = true;
+        std::vector<std::pair<char, std::complex<double>>> variables; //as set_variable
+        int tile = 256; //edge of the square tiles handed out, a multiple of 32
+    };
+
+    struct FarmStats
+    {
+        unsigned long tiles = 0;
+        unsigned long retried = 0;      //tiles handed out again after their worker died or stalled
+        unsigned int workers_used = 0;  //workers that returned at least one tile
+        unsigned int workers_lost = 0;
+        double wall_ms = 0;
+        std::vector<unsigned long> tiles_per_worker; //in order of connection
+    };
+
+    //called as each tile arrives, with the tile's packed RGB rows. tiles arrive in no particular order
+    using TileSink = std::function<void(int col, int row, int width, int height, const unsigned char* rgb)>;
+
+    //hands tiles of a render to workers connected over TCP. each worker holds a couple of tiles at a time, so
+    //faster workers simply come back for more. a worker that disconnects or sits on a tile for longer than
+    //tile_timeout_ms is dropped and its tiles go back to the front of the queue. workers may join at any time
+    class TileCoordinator
+    {
+    public:
+        //listens on bind_address:port, port 0 picks a free one. throws std::runtime_error
+        explicit TileCoordinator(int port = 0, const std::string& bind_address = "127.0.0.1");
+
+        ~TileCoordinator();
+
+        TileCoordinator(const TileCoordinator&) = delete;
+        TileCoordinator& operator=(const TileCoordinator&) = delete;
+
+        int port() const { return bound_port; }
+
+        std::size_t connected_workers() const { return peers.size(); }
+
+        //block until at least n workers are connected, false on timeout
+        bool wait_for_workers(std::size_t n, int timeout_ms);
+
+        //render the job, every tile goes to sink exactly once. throws std::invalid_argument when workers
+        //reject the job, std::runtime_error when no worker is left for no_worker_timeout_ms
+        FarmStats render(const FarmJob& job, const TileSink& sink);
+
+        int tile_timeout_ms = 60000;
+        int no_worker_timeout_ms = 10000;
+        int tiles_in_flight = 2; //per worker, hides the round trip between tiles
+
+    private:
+        struct Tile
+        {
+            int col, row, width, height;
+            std::chrono::steady_clock::time_point sent;
+        };
+
+        struct Peer
+        {
+            int fd;
+            unsigned long job = 0; //the job this worker was last told about
+            std::vector<Tile> in_flight{};
+            int slot = -1; //its entry in tiles_per_worker for that job
+        };
+
+        int listen_fd = -1, bound_port = 0;
+        unsigned long job_id = 0;
+        std::vector<Peer> peers;
+
+        void accept_workers();
+
+        void drop(std::size_t index, std::vector<Tile>& pending, FarmStats& stats);
+    };
+
+    //connect to a coordinator (retrying for up to connect_timeout_ms while it starts) and render
+    //tiles for it until it disconnects. returns the number of tiles rendered
+    unsigned long run_tile_worker(const std::string& host, int port, unsigned int threads, int connect_timeout_ms = 10000);
+};
+
+#endif
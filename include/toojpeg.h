@@ -34,6 +34,14 @@ namespace TooJpeg
   // comment      - optional JPEG comment (0/NULL if no comment), must not contain ASCII code 0xFF
   bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels, unsigned short width, unsigned short height,
                  bool isRGB = true, unsigned char quality = 90, bool downsample = false, const char* comment = nullptr);
+
+  // same as above, plus
+  // optimizeHuffman - if true then Huffman tables are derived from the image's own symbol statistics (two passes, smaller file)
+  // progressive     - if true then a progressive JPEG is written: DC of all channels first, then low and high AC bands per channel
+  // note: both options keep all quantized coefficients in memory (2 bytes per coefficient, allocated with new[])
+  bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels, unsigned short width, unsigned short height,
+                 bool isRGB, unsigned char quality, bool downsample, const char* comment,
+                 bool optimizeHuffman, bool progressive);
 } // namespace TooJpeg
 
 // My main inspiration was Jon Olick's Minimalistic JPEG writer
@@ -0,0 +1,423 @@
+#include "contours.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+    using ComplexPlot::ContourPoint;
+
+    double ms_since(Clock::time_point start) { return std::chrono::duration<double, std::milli>(Clock::now() - start).count(); }
+
+    //body(i) for i in 0..n, handed out one at a time over nthreads
+    template<typename F>
+    void parallel_for(int n, unsigned int nthreads, F body)
+    {
+        nthreads = std::max(1u, std::min({nthreads, std::thread::hardware_concurrency(), (unsigned)std::max(n, 1)}));
+        std::atomic<int> next{0};
+        std::vector<std::thread> threads;
+        for(unsigned int t = 0; t < nthreads; t++)
+            threads.emplace_back([&, t]()
+            {
+                for(int i; (i = next++) < n;)
+                    body(i, t);
+            });
+        for(auto& t : threads)
+            t.join();
+    }
+
+    //part of one level curve. its ends are the pixel edges it crosses, as keys unique to the level, so pieces
+    //traced in different blocks join wherever they cross the same edge
+    struct Piece
+    {
+        std::vector<ContourPoint> points;
+        std::uint64_t head, tail;
+        int level;
+        bool closed;
+    };
+
+    //join pieces that share an end into maximal polylines
+    std::vector<Piece> link(std::vector<Piece>& pieces)
+    {
+        std::unordered_map<std::uint64_t, std::array<int, 2>> ends;
+        ends.reserve(2 * pieces.size());
+        for(int i = 0; i < (int)pieces.size(); i++)
+        {
+            if(pieces[i].closed) continue;
+            for(std::uint64_t key : {pieces[i].head, pieces[i].tail})
+            {
+                auto found = ends.emplace(key, std::array<int, 2>{-1, -1}).first;
+                found->second[found->second[0] < 0 ? 0 : 1] = i;
+            }
+        }
+
+        std::vector<Piece> joined;
+        std::vector<bool> used(pieces.size());
+        for(int i = 0; i < (int)pieces.size(); i++)
+        {
+            if(used[i]) continue;
+            used[i] = true;
+            Piece line = std::move(pieces[i]);
+            if(line.closed)
+            {
+                joined.push_back(std::move(line));
+                continue;
+            }
+
+            //forwards from the tail, then backwards from the head
+            std::vector<ContourPoint> before;
+            for(int direction = 0; direction < 2 && !line.closed; direction++)
+            {
+                int last = i;
+                while(true)
+                {
+                    std::uint64_t key = direction == 0 ? line.tail : line.head;
+                    const auto& at = ends[key];
+                    int j = at[0] == last ? at[1] : at[0];
+                    if(j < 0 || used[j]) break;
+                    used[j] = true;
+                    last = j;
+
+                    Piece& next = pieces[j];
+                    bool forwards = next.head == key;
+                    std::uint64_t far = forwards ? next.tail : next.head;
+                    if(!forwards) std::reverse(next.points.begin(), next.points.end());
+                    if(direction == 0)
+                    {
+                        line.points.insert(line.points.end(), next.points.begin() + 1, next.points.end());
+                        line.tail = far;
+                    }
+                    else
+                    {
+                        before.insert(before.end(), next.points.rbegin() + 1, next.points.rend());
+                        line.head = far;
+                    }
+                    if(line.head == line.tail)
+                    {
+                        line.closed = true;
+                        break;
+                    }
+                }
+            }
+            if(!before.empty())
+            {
+                std::reverse(before.begin(), before.end());
+                before.insert(before.end(), line.points.begin(), line.points.end());
+                line.points = std::move(before);
+            }
+            joined.push_back(std::move(line));
+        }
+        return joined;
+    }
+
+    //marching squares over the cells of one block, each a square of four neighbouring pixel centres. a level of
+    //|f| is traced through g = log |f| - log level, a phase theta through g = sin(arg f - theta), which is also 0
+    //on the opposite ray, so crossings there are marked invalid by h = cos(arg f - theta) <= 0
+    void trace_block(const ComplexPlot::SampledField& field, const ComplexPlot::ContourOptions& options, int r0, int r1, int c0, int c1,
+                     std::vector<Piece>& out)
+    {
+        int rows = r1 - r0 + 1, cols = c1 - c0 + 1;
+        int magnitudes = (int)options.magnitudes.size(), phases = options.phases;
+        std::size_t stride = (std::size_t)field.width * field.height * 2; //edge keys per level
+
+        std::vector<double> log_level(magnitudes), cos_t(phases), sin_t(phases);
+        for(int l = 0; l < magnitudes; l++)
+            log_level[l] = std::log(options.magnitudes[l]);
+        for(int k = 0; k < phases; k++)
+        {
+            cos_t[k] = std::cos(2 * M_PI * k / phases);
+            sin_t[k] = std::sin(2 * M_PI * k / phases);
+        }
+
+        std::vector<std::complex<double>> value(rows * cols);
+        std::vector<double> norm(rows * cols);
+        for(int r = 0; r < rows; r++)
+            for(int c = 0; c < cols; c++)
+            {
+                value[r * cols + c] = field.values[(std::size_t)(r0 + r) * field.width + c0 + c];
+                norm[r * cols + c] = std::norm(value[r * cols + c]);
+            }
+
+        //which side of every level each pixel is on, a bit per level. a level crosses a cell only where its bit differs
+        //between corners, which for most cells is no level at all. the sides need no log or square root
+        std::vector<std::uint64_t> magnitude_side(rows * cols), phase_side(rows * cols);
+        for(int i = 0; i < rows * cols; i++)
+        {
+            for(int l = 0; l < magnitudes; l++)
+                magnitude_side[i] |= std::uint64_t(norm[i] > options.magnitudes[l] * options.magnitudes[l]) << l;
+            for(int k = 0; k < phases; k++)
+                phase_side[i] |= std::uint64_t(value[i].imag() * cos_t[k] - value[i].real() * sin_t[k] > 0) << k;
+        }
+
+        //where a level crosses an edge is interpolated from these, only needed at the crossings
+        auto g = [&](int level, int i)
+        {
+            if(level < magnitudes) return 0.5 * std::log(norm[i]) - log_level[level];
+            int k = level - magnitudes;
+            return (value[i].imag() * cos_t[k] - value[i].real() * sin_t[k]) / std::sqrt(norm[i]);
+        };
+        auto h = [&](int level, int i)
+        {
+            int k = level - magnitudes;
+            return (value[i].real() * cos_t[k] + value[i].imag() * sin_t[k]) / std::sqrt(norm[i]);
+        };
+        auto side = [&](int level, int i)
+        {
+            return level < magnitudes ? magnitude_side[i] >> level & 1 : phase_side[i] >> (level - magnitudes) & 1;
+        };
+
+        std::vector<Piece> pieces;
+        for(int r = 0; r + 1 < rows; r++)
+            for(int c = 0; c + 1 < cols; c++)
+            {
+                int a = r * cols + c;
+                const int corners[4] = {a, a + 1, a + cols + 1, a + cols}; //clockwise from top left
+                bool defined = true;
+                for(int i : corners)
+                    defined &= norm[i] > 0 && norm[i] < std::numeric_limits<double>::infinity();
+                if(!defined)
+                    continue; //a zero or pole sits on a corner, or f is undefined
+
+                std::uint64_t magnitude_cross = 0, phase_cross = 0;
+                for(int i : corners)
+                {
+                    magnitude_cross |= magnitude_side[i] ^ magnitude_side[a];
+                    phase_cross |= phase_side[i] ^ phase_side[a];
+                }
+
+                for(int level = 0; level < magnitudes + phases; level++)
+                {
+                    if(!(level < magnitudes ? magnitude_cross >> level & 1 : phase_cross >> (level - magnitudes) & 1))
+                        continue;
+                    bool phase = level >= magnitudes;
+
+                    //the crossing on the edge from pixel p to its right or lower neighbour q, interpolated the same way
+                    //from whichever cell it is reached
+                    ContourPoint at[4];
+                    std::uint64_t key[4];
+                    bool crossed[4], valid[4];
+                    const int edges[4][2] = {{0, 1}, {1, 2}, {3, 2}, {0, 3}}; //top, right, bottom, left as corner pairs p, q
+                    for(int e = 0; e < 4; e++)
+                    {
+                        int p = corners[edges[e][0]], q = corners[edges[e][1]];
+                        crossed[e] = side(level, p) != side(level, q);
+                        if(!crossed[e]) continue;
+
+                        double gp = g(level, p), gq = g(level, q);
+                        double t = std::clamp(gp / (gp - gq), 0.0, 1.0); //g and the sides can disagree by a rounding
+                        valid[e] = !phase || h(level, p) + t * (h(level, q) - h(level, p)) > 0;
+                        bool vertical = q - p == cols;
+                        int row = r0 + p / cols, col = c0 + p % cols;
+                        at[e] = {col + (vertical ? 0 : t), row + (vertical ? t : 0)};
+                        key[e] = level * stride + ((std::size_t)row * field.width + col) * 2 + vertical;
+                    }
+
+                    //a phase curve ends at the zero or pole where it meets the opposite ray, it stops a cell short
+                    auto segment = [&](int e, int f)
+                    {
+                        if(valid[e] && valid[f])
+                            pieces.push_back({{at[e], at[f]}, key[e], key[f], level, false});
+                    };
+                    if(crossed[0] && crossed[1] && crossed[2] && crossed[3])
+                    {
+                        //saddle: the centre decides whether the top left corner's side joins the bottom right one
+                        double centre = 0.25 * (g(level, corners[0]) + g(level, corners[1]) + g(level, corners[2]) + g(level, corners[3]));
+                        if((centre > 0) == (bool)side(level, corners[0]))
+                        {
+                            segment(0, 1);
+                            segment(2, 3);
+                        }
+                        else
+                        {
+                            segment(3, 0);
+                            segment(1, 2);
+                        }
+                    }
+                    else if(crossed[0] + crossed[1] + crossed[2] + crossed[3] == 2)
+                    {
+                        int e = 0;
+                        while(!crossed[e]) e++;
+                        int f = e + 1;
+                        while(!crossed[f]) f++;
+                        segment(e, f);
+                    }
+                }
+            }
+
+        for(auto& p : link(pieces))
+            out.push_back(std::move(p));
+    }
+
+    void cover(float* coverage, int r0, int c0, int cell, int width, int height, double half_width, ContourPoint a, ContourPoint b)
+    {
+        int rmin = std::max({r0, (int)std::floor(std::min(a.y, b.y) - half_width - 1), 0});
+        int rmax = std::min({r0 + cell - 1, (int)std::ceil(std::max(a.y, b.y) + half_width + 1), height - 1});
+        int cmin = std::max({c0, (int)std::floor(std::min(a.x, b.x) - half_width - 1), 0});
+        int cmax = std::min({c0 + cell - 1, (int)std::ceil(std::max(a.x, b.x) + half_width + 1), width - 1});
+
+        double dx = b.x - a.x, dy = b.y - a.y, length2 = dx * dx + dy * dy;
+        for(int r = rmin; r <= rmax; r++)
+            for(int c = cmin; c <= cmax; c++)
+            {
+                double t = length2 > 0 ? std::clamp(((c - a.x) * dx + (r - a.y) * dy) / length2, 0.0, 1.0) : 0;
+                double distance = std::hypot(c - a.x - t * dx, r - a.y - t * dy);
+                float value = (float)std::clamp(half_width + 0.5 - distance, 0.0, 1.0);
+                float& slot = coverage[(r - r0) * cell + c - c0];
+                slot = std::max(slot, value); //where segments of a line meet, the pixel is covered once
+            }
+    }
+
+    const char base64_digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string base64(const std::vector<unsigned char>& data)
+    {
+        std::string out;
+        out.reserve((data.size() + 2) / 3 * 4);
+        for(std::size_t i = 0; i < data.size(); i += 3)
+        {
+            std::uint32_t n = data[i] << 16;
+            if(i + 1 < data.size()) n |= data[i + 1] << 8;
+            if(i + 2 < data.size()) n |= data[i + 2];
+            out += base64_digits[(n >> 18) & 63];
+            out += base64_digits[(n >> 12) & 63];
+            out += i + 1 < data.size() ? base64_digits[(n >> 6) & 63] : '=';
+            out += i + 2 < data.size() ? base64_digits[n & 63] : '=';
+        }
+        return out;
+    }
+
+    std::string hex_colour(const std::array<unsigned char, 3>& c)
+    {
+        char buf[8];
+        std::snprintf(buf, sizeof buf, "#%02x%02x%02x", c[0], c[1], c[2]);
+        return buf;
+    }
+}
+
+std::vector<ComplexPlot::Contour> ComplexPlot::extract_contours(const SampledField& field, const ContourOptions& options, int cell,
+                                                                unsigned int nthreads, ContourStats& stats)
+{
+    std::vector<Contour> contours;
+    if(field.width < 2 || field.height < 2 || cell < 1) return contours;
+    for(double m : options.magnitudes)
+        if(!(m > 0)) throw std::invalid_argument("Contour magnitudes must be positive");
+    if(options.magnitudes.size() > 64 || options.phases < 0 || options.phases > 64)
+        throw std::invalid_argument("At most 64 contour levels each of magnitude and phase");
+
+    auto start = Clock::now();
+
+    //blocks of cells share their border pixels, the keys of the edges along them match up
+    int blocks_x = (field.width - 2) / cell + 1, blocks_y = (field.height - 2) / cell + 1;
+    std::vector<std::vector<Piece>> traced(blocks_x * blocks_y);
+    parallel_for(blocks_x * blocks_y, nthreads, [&](int b, unsigned int)
+    {
+        int r0 = (b / blocks_x) * cell, c0 = (b % blocks_x) * cell;
+        trace_block(field, options, r0, std::min(r0 + cell, field.height - 1), c0, std::min(c0 + cell, field.width - 1), traced[b]);
+    });
+    stats.extract_ms = ms_since(start);
+
+    start = Clock::now();
+    std::vector<Piece> pieces;
+    for(auto& block : traced)
+        for(auto& p : block)
+        {
+            stats.segments += p.points.size() - 1;
+            pieces.push_back(std::move(p));
+        }
+
+    for(auto& line : link(pieces))
+    {
+        bool phase = line.level >= (int)options.magnitudes.size();
+        double level = phase ? 2 * M_PI * (line.level - (int)options.magnitudes.size()) / options.phases : options.magnitudes[line.level];
+        if(phase && level > M_PI) level -= 2 * M_PI;
+        contours.push_back({phase, level, line.closed, std::move(line.points)});
+    }
+    stats.stitch_ms = ms_since(start);
+    return contours;
+}
+
+void ComplexPlot::rasterize_contours(const std::vector<Contour>& contours, int width, int height, double line_width, int cell,
+                                     unsigned int nthreads, const ContourBlend& blend)
+{
+    if(width < 1 || height < 1) return;
+
+    //every segment goes to each block its line reaches, so blocks can be drawn in parallel without sharing pixels
+    double half_width = 0.5 * line_width;
+    int blocks_x = (width + cell - 1) / cell, blocks_y = (height + cell - 1) / cell;
+    std::vector<std::vector<std::pair<int, int>>> segments(blocks_x * blocks_y); //contour, first point
+    for(int k = 0; k < (int)contours.size(); k++)
+    {
+        const auto& points = contours[k].points;
+        for(int i = 0; i + 1 < (int)points.size(); i++)
+        {
+            double reach = half_width + 1;
+            int bx0 = std::max(0, (int)std::floor((std::min(points[i].x, points[i + 1].x) - reach) / cell));
+            int bx1 = std::min(blocks_x - 1, (int)std::floor((std::max(points[i].x, points[i + 1].x) + reach) / cell));
+            int by0 = std::max(0, (int)std::floor((std::min(points[i].y, points[i + 1].y) - reach) / cell));
+            int by1 = std::min(blocks_y - 1, (int)std::floor((std::max(points[i].y, points[i + 1].y) + reach) / cell));
+            for(int by = by0; by <= by1; by++)
+                for(int bx = bx0; bx <= bx1; bx++)
+                    segments[by * blocks_x + bx].push_back({k, i});
+        }
+    }
+
+    parallel_for(blocks_x * blocks_y, nthreads, [&](int b, unsigned int)
+    {
+        if(segments[b].empty()) return;
+        int r0 = (b / blocks_x) * cell, c0 = (b % blocks_x) * cell;
+        std::vector<float> magnitude(cell * cell), phase(cell * cell);
+        for(auto [k, i] : segments[b])
+            cover(contours[k].phase ? phase.data() : magnitude.data(), r0, c0, cell, width, height, half_width,
+                  contours[k].points[i], contours[k].points[i + 1]);
+
+        for(int r = 0; r < cell; r++)
+            for(int c = 0; c < cell; c++)
+                if(magnitude[r * cell + c] > 0 || phase[r * cell + c] > 0)
+                    blend(r0 + r, c0 + c, magnitude[r * cell + c], phase[r * cell + c]);
+    });
+}
+
+std::string ComplexPlot::contours_svg(const ContourSet& set, const ContourOptions& options, const std::vector<unsigned char>& png)
+{
+    std::string svg = "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"" + std::to_string(set.width) + "\" height=\""
+                    + std::to_string(set.height) + "\" viewBox=\"0 0 " + std::to_string(set.width) + " " + std::to_string(set.height) + "\">\n";
+    if(!png.empty())
+        svg += "<image width=\"" + std::to_string(set.width) + "\" height=\"" + std::to_string(set.height)
+             + "\" href=\"data:image/png;base64," + base64(png) + "\"/>\n";
+
+    //points are pixel centres, the image puts pixel (0, 0) over the square from 0 to 1
+    char buf[64];
+    std::snprintf(buf, sizeof buf, "%g", options.line_width);
+    std::string width = buf;
+    std::snprintf(buf, sizeof buf, "%g", options.opacity);
+    std::string opacity = buf;
+
+    for(bool phase : {false, true})
+    {
+        svg += "<g transform=\"translate(0.5 0.5)\" fill=\"none\" stroke=\"" + hex_colour(phase ? options.phase_colour : options.magnitude_colour)
+             + "\" stroke-width=\"" + width + "\" stroke-opacity=\"" + opacity + "\" stroke-linejoin=\"round\">\n";
+        for(const auto& contour : set.contours)
+        {
+            if(contour.phase != phase || contour.points.size() < 2) continue;
+            std::snprintf(buf, sizeof buf, "<path data-level=\"%.6g\" d=\"", contour.level);
+            svg += buf;
+            for(std::size_t i = 0; i < contour.points.size(); i++)
+            {
+                std::snprintf(buf, sizeof buf, "%s%.2f %.2f", i == 0 ? "M" : " L", contour.points[i].x, contour.points[i].y);
+                svg += buf;
+            }
+            svg += contour.closed ? "Z\"/>\n" : "\"/>\n";
+        }
+        svg += "</g>\n";
+    }
+    return svg + "</svg>\n";
+}
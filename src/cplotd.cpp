@@ -0,0 +1,228 @@
+#include <algorithm>
+#include <chrono>
+#include <cctype>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "render_server.hpp"
+
+//cplotd [--unix path | --port n] [--workers n] [--render-threads n] [--queue n] [--cache-mb n]
+//cplotd client [--unix path | --port n] [--requests n] [--concurrency n] [--expr e] [--size n]
+//the first form serves renders until SIGINT/SIGTERM, the second is a load generator that reports latency percentiles
+
+namespace
+{
+    struct Options
+    {
+        bool client = false;
+        ComplexPlot::ServerOptions server;
+        int requests = 200, concurrency = 8, size = 256;
+        std::string expr = "(z^3-1)/(z^2+i)";
+    };
+
+    ComplexPlot::RenderServer* running = nullptr;
+
+    void on_signal(int)
+    {
+        if(running) running->stop();
+    }
+
+    int connect_to(const Options& opt)
+    {
+        int fd;
+        if(!opt.server.unix_path.empty())
+        {
+            sockaddr_un addr{};
+            addr.sun_family = AF_UNIX;
+            std::strncpy(addr.sun_path, opt.server.unix_path.c_str(), sizeof(addr.sun_path) - 1);
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if(fd >= 0 && connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) return fd;
+        }
+        else
+        {
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            addr.sin_port = htons(opt.server.port);
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            if(fd >= 0 && connect(fd, (sockaddr*)&addr, sizeof(addr)) == 0) return fd;
+        }
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+
+    //returns the status code, -1 when the connection failed
+    int fetch(const Options& opt, const std::string& target, std::string* body = nullptr)
+    {
+        int fd = connect_to(opt);
+        if(fd < 0) return -1;
+
+        std::string request = "GET " + target + " HTTP/1.0\r\n\r\n";
+        if(send(fd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size())
+        {
+            close(fd);
+            return -1;
+        }
+
+        std::string response;
+        char buffer[65536];
+        ssize_t n;
+        while((n = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+            response.append(buffer, n);
+        close(fd);
+
+        int status = -1;
+        if(std::sscanf(response.c_str(), "HTTP/1.%*d %d", &status) != 1) return -1;
+        if(body)
+        {
+            auto split = response.find("\r\n\r\n");
+            *body = split == std::string::npos ? "" : response.substr(split + 4);
+        }
+        return status;
+    }
+
+    std::string url_encode(const std::string& s)
+    {
+        std::string out;
+        for(unsigned char c : s)
+        {
+            if(std::isalnum(c) || c == '.' || c == '-' || c == '_')
+                out.push_back(c);
+            else
+            {
+                char hex[4];
+                std::snprintf(hex, sizeof(hex), "%%%02X", c);
+                out += hex;
+            }
+        }
+        return out;
+    }
+
+    int run_client(const Options& opt)
+    {
+        std::vector<double> latencies(opt.requests);
+        std::vector<int> statuses(opt.requests);
+        std::atomic<int> next{0};
+
+        auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for(int t = 0; t < opt.concurrency; t++)
+        {
+            threads.emplace_back([&]()
+            {
+                for(int i; (i = next++) < opt.requests;)
+                {
+                    //a panning viewer: every request a new viewport, a few of them repeated to exercise the cache
+                    int frame = i % std::max(1, opt.requests * 3 / 4);
+                    char target[512];
+                    std::snprintf(target, sizeof(target), "/render?expr=%s&re=%.3f&im=%.3f&extent=%.3f&size=%d&format=png",
+                                  url_encode(opt.expr).c_str(), 0.01 * frame, -0.005 * frame, 2.0 + 0.01 * (frame % 50), opt.size);
+
+                    auto sent = std::chrono::steady_clock::now();
+                    statuses[i] = fetch(opt, target);
+                    latencies[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sent).count();
+                }
+            });
+        }
+        for(auto& t : threads)
+            t.join();
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        int ok = std::count(statuses.begin(), statuses.end(), 200);
+        int busy = std::count(statuses.begin(), statuses.end(), 503);
+        int failed = opt.requests - ok - busy;
+
+        std::vector<double> served;
+        for(int i = 0; i < opt.requests; i++)
+            if(statuses[i] == 200) served.push_back(latencies[i]);
+        std::sort(served.begin(), served.end());
+        auto percentile = [&](int p) { return served.empty() ? 0.0 : served[std::min(served.size() - 1, served.size() * p / 100)]; };
+
+        std::printf("%d requests, concurrency %d: %d ok, %d rejected (503), %d failed\n", opt.requests, opt.concurrency, ok, busy, failed);
+        std::printf("  %.1f requests/s, p50 %.2f ms, p99 %.2f ms\n", opt.requests / elapsed, percentile(50), percentile(99));
+
+        std::string stats;
+        if(fetch(opt, "/stats", &stats) == 200)
+            std::printf("  server: %s", stats.c_str());
+        return failed ? 1 : 0;
+    }
+
+    Options parse_args(int argc, char** argv)
+    {
+        Options opt;
+        int i = 1;
+        if(argc > 1 && std::string(argv[1]) == "client")
+        {
+            opt.client = true;
+            i++;
+        }
+
+        for(; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string
+            {
+                if(i + 1 >= argc)
+                    throw std::invalid_argument(arg + " needs a value");
+                return argv[++i];
+            };
+
+            if(arg == "--unix") opt.server.unix_path = value();
+            else if(arg == "--port") opt.server.port = std::stoi(value());
+            else if(arg == "--workers") opt.server.workers = std::max(1, std::stoi(value()));
+            else if(arg == "--render-threads") opt.server.render_threads = std::max(1, std::stoi(value()));
+            else if(arg == "--queue") opt.server.queue_limit = std::max(1, std::stoi(value()));
+            else if(arg == "--cache-mb") opt.server.cache_bytes = (std::size_t)std::max(0, std::stoi(value())) << 20;
+            else if(opt.client && arg == "--requests") opt.requests = std::max(1, std::stoi(value()));
+            else if(opt.client && arg == "--concurrency") opt.concurrency = std::max(1, std::stoi(value()));
+            else if(opt.client && arg == "--expr") opt.expr = value();
+            else if(opt.client && arg == "--size") opt.size = std::max(1, std::stoi(value()));
+            else throw std::invalid_argument("Unknown option " + arg);
+        }
+
+        if(opt.client && opt.server.unix_path.empty() && opt.server.port == 0)
+            throw std::invalid_argument("client needs --unix or --port");
+        return opt;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        Options opt = parse_args(argc, argv);
+        if(opt.client)
+            return run_client(opt);
+
+        ComplexPlot::RenderServer server(opt.server);
+        if(opt.server.unix_path.empty())
+            std::printf("cplotd: listening on 127.0.0.1:%d\n", server.port());
+        else
+            std::printf("cplotd: listening on %s\n", opt.server.unix_path.c_str());
+        std::fflush(stdout);
+
+        running = &server;
+        std::signal(SIGINT, on_signal);
+        std::signal(SIGTERM, on_signal);
+        server.run();
+        running = nullptr;
+
+        ComplexPlot::ServerStats s = server.stats();
+        std::printf("cplotd: served %lu requests (%lu cached, %lu errors, %lu rejected), p50 %.2f ms, p99 %.2f ms\n",
+                    s.requests, s.cache_hits, s.errors, s.rejected, s.p50_ms, s.p99_ms);
+    }
+    catch(std::exception& e)
+    {
+        std::fprintf(stderr, "cplotd: %s\n"
+                             "usage: cplotd [--unix path | --port n] [--workers n] [--render-threads n] [--queue n] [--cache-mb n]\n"
+                             "       cplotd client [--unix path | --port n] [--requests n] [--concurrency n] [--expr e] [--size n]\n", e.what());
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "tile_farm.hpp"
+
+//cplot-farm render [--port n] [--bind addr] [--spawn n] [--workers n] [--threads n] [--expr e] [--size WxH]
+//                  [--re x] [--im y] [--extent e] [--tile n] [--var c=re,im] [--no-grid] [--out file.ppm] [--kill-one]
+//cplot-farm scaling [--spawn n] ...  renders the same job with 1, 2, 4 .. n local workers and reports the speedup
+//cplot-farm worker --connect host:port [--threads n]
+//tiles are written into the output file as they arrive, so a print size image never has to fit in memory
+
+namespace
+{
+    struct Options
+    {
+        std::string mode;
+        ComplexPlot::FarmJob job;
+        int port = 0;
+        std::string bind = "127.0.0.1", host = "127.0.0.1", out;
+        int spawn = 0, workers = 0;
+        unsigned int threads = 1;
+        bool kill_one = false;
+    };
+
+    //PPM or raw RGB, filled in place one tile row at a time
+    class StreamedImage
+    {
+    public:
+        StreamedImage(const std::string& filename, int width, int height) : width(width)
+        {
+            fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if(fd < 0) throw std::runtime_error("Could not open " + filename);
+
+            if(ComplexPlot::format_from_extension(filename) == ComplexPlot::ImageFormat::PPM)
+            {
+                std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+                header_size = header.size();
+                if(write(fd, header.data(), header.size()) != (ssize_t)header.size())
+                    throw std::runtime_error("Could not write " + filename);
+            }
+            else if(ComplexPlot::format_from_extension(filename) != ComplexPlot::ImageFormat::RAW)
+                throw std::invalid_argument("Tiles stream into .ppm or .raw files only");
+
+            if(ftruncate(fd, header_size + 3 * (off_t)width * height) != 0)
+                throw std::runtime_error("Could not size " + filename);
+        }
+
+        ~StreamedImage() { close(fd); }
+
+        void put(int col, int row, int w, int h, const unsigned char* rgb)
+        {
+            for(int r = 0; r < h; ++r)
+            {
+                off_t at = header_size + 3 * ((off_t)(row + r) * width + col);
+                if(pwrite(fd, rgb + 3 * (std::size_t)r * w, 3 * (std::size_t)w, at) != 3 * (ssize_t)w)
+                    throw std::runtime_error("Short write to output image");
+            }
+        }
+
+    private:
+        int fd, width;
+        off_t header_size = 0;
+    };
+
+    std::vector<pid_t> spawn_workers(int n, int port, unsigned int threads)
+    {
+        std::vector<pid_t> pids;
+        for(int i = 0; i < n; i++)
+        {
+            pid_t pid = fork();
+            if(pid < 0) throw std::runtime_error("fork failed");
+            if(pid == 0)
+            {
+                try
+                {
+                    ComplexPlot::run_tile_worker("127.0.0.1", port, threads);
+                }
+                catch(std::exception& e)
+                {
+                    std::fprintf(stderr, "cplot-farm worker: %s\n", e.what());
+                    _exit(1);
+                }
+                _exit(0);
+            }
+            pids.push_back(pid);
+        }
+        return pids;
+    }
+
+    void reap(std::vector<pid_t>& pids)
+    {
+        for(pid_t pid : pids)
+        {
+            kill(pid, SIGTERM);
+            waitpid(pid, nullptr, 0);
+        }
+        pids.clear();
+    }
+
+    void print_stats(const ComplexPlot::FarmStats& s)
+    {
+        std::printf("  %lu tiles in %.1f ms, %u workers used, %u lost, %lu tiles retried\n", s.tiles, s.wall_ms, s.workers_used,
+                    s.workers_lost, s.retried);
+        std::printf("  tiles per worker:");
+        for(auto n : s.tiles_per_worker)
+            std::printf(" %lu", n);
+        std::printf("\n");
+    }
+
+    int render(const Options& opt)
+    {
+        ComplexPlot::TileCoordinator coordinator(opt.port, opt.bind);
+        std::printf("cplot-farm: coordinator on %s:%d\n", opt.bind.c_str(), coordinator.port());
+        std::fflush(stdout);
+
+        std::vector<pid_t> children = spawn_workers(opt.spawn, coordinator.port(), opt.threads);
+        std::size_t wanted = std::max(1, std::max(opt.spawn, opt.workers));
+        if(!coordinator.wait_for_workers(wanted, 30000))
+            std::printf("cplot-farm: only %zu of %zu workers connected, starting anyway\n", coordinator.connected_workers(), wanted);
+
+        std::unique_ptr<StreamedImage> image;
+        if(!opt.out.empty())
+            image = std::make_unique<StreamedImage>(opt.out, opt.job.width, opt.job.height);
+
+        bool killed = false;
+        ComplexPlot::FarmStats stats = coordinator.render(opt.job, [&](int col, int row, int w, int h, const unsigned char* rgb)
+        {
+            if(image) image->put(col, row, w, h, rgb);
+            if(opt.kill_one && !killed && !children.empty())
+            {
+                //simulate a crashed node to exercise the retry path
+                kill(children.front(), SIGKILL);
+                killed = true;
+            }
+        });
+
+        print_stats(stats);
+        reap(children);
+        return 0;
+    }
+
+    int scaling(const Options& opt)
+    {
+        int most = std::max(1, opt.spawn);
+        double base = 0;
+        for(int n = 1; n <= most; n = n * 2 > most && n < most ? most : n * 2)
+        {
+            ComplexPlot::TileCoordinator coordinator(0, "127.0.0.1");
+            std::vector<pid_t> children = spawn_workers(n, coordinator.port(), opt.threads);
+            coordinator.wait_for_workers(n, 30000);
+
+            //the first render warms the workers' expression caches, time the second
+            auto sink = [](int, int, int, int, const unsigned char*) {};
+            coordinator.render(opt.job, sink);
+            ComplexPlot::FarmStats stats = coordinator.render(opt.job, sink);
+            reap(children);
+
+            if(n == 1) base = stats.wall_ms;
+            std::printf("%2d workers: %8.1f ms  speedup %.2f  efficiency %.0f%%\n", n, stats.wall_ms, base / stats.wall_ms,
+                        100 * base / stats.wall_ms / n);
+        }
+        return 0;
+    }
+
+    std::pair<std::string, int> host_port(const std::string& s)
+    {
+        auto colon = s.rfind(':');
+        if(colon == std::string::npos) throw std::invalid_argument("Expected host:port, got " + s);
+        return {s.substr(0, colon), std::stoi(s.substr(colon + 1))};
+    }
+
+    Options parse_args(int argc, char** argv)
+    {
+        Options opt;
+        if(argc < 2) throw std::invalid_argument("Missing mode");
+        opt.mode = argv[1];
+        opt.job.expr = "(z^3-1)/(z^2+i)";
+        opt.job.view.extent = 3;
+
+        for(int i = 2; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            auto value = [&]() -> std::string
+            {
+                if(i + 1 >= argc)
+                    throw std::invalid_argument(arg + " needs a value");
+                return argv[++i];
+            };
+
+            if(arg == "--port") opt.port = std::stoi(value());
+            else if(arg == "--bind") opt.bind = value();
+            else if(arg == "--connect") std::tie(opt.host, opt.port) = host_port(value());
+            else if(arg == "--spawn") opt.spawn = std::max(0, std::stoi(value()));
+            else if(arg == "--workers") opt.workers = std::max(0, std::stoi(value()));
+            else if(arg == "--threads") opt.threads = std::max(1, std::stoi(value()));
+            else if(arg == "--expr") opt.job.expr = value();
+            else if(arg == "--re") opt.job.view.centre.real(std::stod(value()));
+            else if(arg == "--im") opt.job.view.centre.imag(std::stod(value()));
+            else if(arg == "--extent") opt.job.view.extent = std::stod(value());
+            else if(arg == "--tile") opt.job.tile = std::stoi(value());
+            else if(arg == "--no-grid") opt.job.grid = false;
+            else if(arg == "--out") opt.out = value();
+            else if(arg == "--kill-one") opt.kill_one = true;
+            else if(arg == "--size")
+            {
+                std::string size = value();
+                if(std::sscanf(size.c_str(), "%dx%d", &opt.job.width, &opt.job.height) != 2)
+                    throw std::invalid_argument("Expected WxH, got " + size);
+            }
+            else if(arg == "--var")
+            {
+                std::string v = value();
+                double re = 0, im = 0;
+                if(v.size() < 3 || v[1] != '=' || std::sscanf(v.c_str() + 2, "%lf,%lf", &re, &im) < 1)
+                    throw std::invalid_argument("Expected --var c=re,im, got " + v);
+                opt.job.variables.push_back({v[0], {re, im}});
+            }
+            else throw std::invalid_argument("Unknown option " + arg);
+        }
+
+        if(opt.mode != "render" && opt.mode != "scaling" && opt.mode != "worker")
+            throw std::invalid_argument("Unknown mode " + opt.mode);
+        if(opt.mode == "worker" && opt.port == 0)
+            throw std::invalid_argument("worker needs --connect host:port");
+        return opt;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    try
+    {
+        Options opt = parse_args(argc, argv);
+        if(opt.mode == "render") return render(opt);
+        if(opt.mode == "scaling") return scaling(opt);
+
+        unsigned long tiles = ComplexPlot::run_tile_worker(opt.host, opt.port, opt.threads);
+        std::printf("cplot-farm worker: rendered %lu tiles\n", tiles);
+    }
+    catch(std::exception& e)
+    {
+        std::fprintf(stderr, "cplot-farm: %s\n"
+                             "usage: cplot-farm render [--port n] [--bind addr] [--spawn n] [--workers n] [--threads n] [--expr e] [--size WxH]\n"
+                             "                         [--re x] [--im y] [--extent e] [--tile n] [--var c=re,im] [--no-grid] [--out file.ppm] [--kill-one]\n"
+                             "       cplot-farm scaling [--spawn n] [--threads n] [job options as for render]\n"
+                             "       cplot-farm worker --connect host:port [--threads n]\n", e.what());
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,84 @@
+#include "exposure.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+    //|f|^2 at the lower edge of bin k, the mantissa rises linearly across the octave
+    double edge_norm(int k)
+    {
+        using ComplexPlot::ToneMap;
+        return std::ldexp(1 + double(k % ToneMap::steps) / ToneMap::steps, k / ToneMap::steps - ToneMap::octaves);
+    }
+}
+
+ComplexPlot::ToneMap::ToneMap()
+{
+    for(int k = 0; k < bins; k++)
+        levels[k] = (float)(1 - 5 / (std::sqrt(edge_norm(k)) + 5));
+    levels[bins] = 1;
+}
+
+ComplexPlot::ToneMap::ToneMap(const MagnitudeHistogram& histogram, const ExposureOptions& options) : ToneMap()
+{
+    if(histogram.total == 0) return;
+
+    int first = 0, last = bins - 1;
+    while(!histogram.counts[first]) first++;
+    while(!histogram.counts[last]) last--;
+
+    //a frame of nearly one magnitude still spans an octave of |f|, rather than the whole range in one bin
+    int widen = std::max(0, 2 * steps - (last - first + 1));
+    first = std::max(0, first - widen / 2);
+    last = std::min(bins - 1, last + (widen + 1) / 2);
+
+    //contrast limited equalisation: what a bin holds above the limit is shared out over the span, so large flat
+    //areas don't take most of the brightness range
+    double n = (double)histogram.total, limit = options.clip * n / (last - first + 1), excess = 0;
+    std::array<double, bins> share{};
+    for(int k = first; k <= last; k++)
+    {
+        share[k] = std::min((double)histogram.counts[k], limit);
+        excess += histogram.counts[k] - share[k];
+    }
+    double base = options.floor * n / (1 - options.floor) / bins;
+    for(int k = 0; k < bins; k++)
+        share[k] += base + (k >= first && k <= last ? excess / (last - first + 1) : 0);
+
+    double sum = 0;
+    for(double s : share)
+        sum += s;
+    double level = 0;
+    for(int k = 0; k < bins; k++)
+    {
+        levels[k] = (float)level;
+        level += share[k] / sum;
+    }
+    levels[bins] = 1;
+}
+
+void ComplexPlot::ToneMap::blend(const ToneMap& previous, double weight)
+{
+    for(int k = 0; k <= bins; k++)
+        levels[k] = (float)((1 - weight) * levels[k] + weight * previous.levels[k]);
+}
+
+double ComplexPlot::ToneMap::midpoint() const
+{
+    int k = int(std::upper_bound(levels.begin(), levels.end(), 0.5f) - levels.begin()) - 1;
+    if(k < 0) return 0;
+    if(k >= bins) return INFINITY;
+
+    double t = (0.5 - levels[k]) / (levels[k + 1] - levels[k]);
+    double low = edge_norm(k), high = edge_norm(k + 1);
+    return std::sqrt(low + t * (high - low));
+}
+
+ComplexPlot::MagnitudeHistogram& ComplexPlot::MagnitudeHistogram::operator+=(const MagnitudeHistogram& other)
+{
+    for(int k = 0; k < ToneMap::bins; k++)
+        counts[k] += other.counts[k];
+    total += other.total;
+    return *this;
+}
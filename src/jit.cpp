@@ -0,0 +1,159 @@
+#include "jit.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <vector>
+#include <dlfcn.h>
+#include <unistd.h>
+
+using ComplexPlot::JitKernel;
+
+static std::string complex_literal(std::complex<double> value)
+{
+    char buf[96];
+    snprintf(buf, sizeof(buf), "C(%a, %a)", value.real(), value.imag()); //hex floats round-trip exactly
+    return buf;
+}
+
+//small integer exponents become multiplications, everything else keeps std::pow like the interpreter
+static bool small_integer(std::complex<double> value, int& n)
+{
+    if(value.imag() != 0 || value.real() != std::floor(value.real()) || std::abs(value.real()) > 8 || value.real() == 0)
+        return false;
+    n = (int)value.real();
+    return true;
+}
+
+std::string JitKernel::generate_source(const Parsing::Expression<std::complex<double>>& expr)
+{
+    //indexed by op - Op::Sqrt, same order as Parsing::unary_funcs
+    static const std::array<std::string, Parsing::num_unary_funcs> unary = {
+        "std::sqrt(%)", "std::exp(%)", "std::sin(%)", "std::cos(%)", "std::tan(%)", "std::asin(%)", "std::acos(%)",
+        "std::atan(%)", "std::log(%)", "std::log10(%)", "C(std::abs(%), 0)", "C(std::real(%), 0)", "C(std::imag(%), 0)",
+        "C(std::arg(%), 0)"
+    };
+
+    std::ostringstream body;
+    std::vector<std::string> stack; //names of the locals holding each stack slot
+    std::vector<const Parsing::Instruction<std::complex<double>>*> source; //instruction that produced each slot
+    int temps = 0;
+
+    auto push = [&](const std::string& code, const Parsing::Instruction<std::complex<double>>* ins)
+    {
+        std::string name = "t" + std::to_string(temps++);
+        body << "        const C " << name << " = " << code << ";\n";
+        stack.push_back(name);
+        source.push_back(ins);
+    };
+    auto pop = [&]()
+    {
+        std::string name = stack.back();
+        stack.pop_back();
+        source.pop_back();
+        return name;
+    };
+
+    //the expression already validated its stack usage when it was compiled
+    for(const auto& ins : expr.instructions())
+    {
+        if(ins.op == Parsing::Op::Number)
+            push(complex_literal(ins.value), &ins);
+        else if(ins.op == Parsing::Op::Variable)
+        {
+            if(ins.var == 'z') push("C(z[2 * k], z[2 * k + 1])", &ins);
+            else push("C(vars[2 * " + std::to_string((int)ins.var) + "], vars[2 * " + std::to_string((int)ins.var) + " + 1])", &ins);
+        }
+        else if(Parsing::is_unary(ins.op))
+        {
+            std::string code = unary[(std::size_t)ins.op - Parsing::num_binary_ops];
+            code.replace(code.find('%'), 1, pop());
+            push(code, &ins);
+        }
+        else
+        {
+            auto right_source = source.back();
+            std::string right = pop();
+            std::string left = pop();
+
+            int n;
+            if(ins.op == Parsing::Op::Pow && right_source->op == Parsing::Op::Number && small_integer(right_source->value, n))
+            {
+                std::string code = left;
+                for(int i = 1; i < std::abs(n); ++i) code += " * " + left;
+                push(n > 0 ? code : "C(1, 0) / (" + code + ")", &ins);
+            }
+            else if(ins.op == Parsing::Op::Pow) push("std::pow(" + left + ", " + right + ")", &ins);
+            else push(left + " " + std::string(Parsing::op_names[(std::size_t)ins.op]) + " " + right, &ins);
+        }
+    }
+    if(stack.size() != 1) throw std::invalid_argument("Extra operator, malformed expression");
+
+    std::ostringstream src;
+    src << "#include <complex>\n"
+        << "typedef std::complex<double> C;\n"
+        << "extern \"C\" void cplot_kernel(const double* z, double* out, int n, const double* vars)\n"
+        << "{\n"
+        << "    (void)vars;\n"
+        << "    for(int k = 0; k < n; ++k)\n"
+        << "    {\n"
+        << body.str()
+        << "        out[2 * k] = " << stack.back() << ".real();\n"
+        << "        out[2 * k + 1] = " << stack.back() << ".imag();\n"
+        << "    }\n"
+        << "}\n";
+    return src.str();
+}
+
+std::unique_ptr<JitKernel> JitKernel::compile(const Parsing::Expression<std::complex<double>>& expr)
+{
+    std::string source;
+    try
+    {
+        source = generate_source(expr);
+    }
+    catch(const std::exception&)
+    {
+        return nullptr;
+    }
+
+    char dir[] = "/tmp/cplot-jit-XXXXXX";
+    if(!mkdtemp(dir)) return nullptr;
+
+    std::string src_path = std::string(dir) + "/kernel.cpp", lib_path = std::string(dir) + "/kernel.so";
+
+    FILE* f = fopen(src_path.c_str(), "w");
+    if(!f)
+    {
+        rmdir(dir);
+        return nullptr;
+    }
+    fputs(source.c_str(), f);
+    fclose(f);
+
+    const char* cxx = getenv("CPLOT_JIT_CXX");
+    std::string command = std::string(cxx ? cxx : "c++") + " -std=c++17 -O2 -fno-math-errno -shared -fPIC -o '" + lib_path + "' '" + src_path + "' 2>/dev/null";
+    int status = std::system(command.c_str());
+
+    void* handle = status == 0 ? dlopen(lib_path.c_str(), RTLD_NOW | RTLD_LOCAL) : nullptr;
+
+    //the mapping stays valid after the files are gone
+    unlink(src_path.c_str());
+    unlink(lib_path.c_str());
+    rmdir(dir);
+
+    if(!handle) return nullptr;
+
+    auto fn = (KernelFn)dlsym(handle, "cplot_kernel");
+    if(!fn)
+    {
+        dlclose(handle);
+        return nullptr;
+    }
+    return std::unique_ptr<JitKernel>(new JitKernel(handle, fn));
+}
+
+JitKernel::~JitKernel()
+{
+    dlclose(handle);
+}
@@ -1,33 +1,1208 @@
 #include "libcplot.hpp"
 #include "toojpeg.h"
 
-BitMap::BitMap(int width, int height) : width(width), height(height)
+#include <cstring>
+#include <future>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <zlib.h>
+
+static std::string with_extension(std::string filename, const std::string& ext)
 {
-    pixels = new unsigned char[3 * width * height];
+    return filename + (filename.length() > ext.length() && filename.substr(filename.length() - ext.length()) == ext ? "" : ext);
+}
+
+BitMap::BitMap(int width, int height, ComplexPlot::PixelLayout layout, bool pad_rows, ComplexPlot::PixelOrder order)
+    : width(width), height(height), layout(layout),
+      bytes_per_pixel(layout == ComplexPlot::PixelLayout::RGBX ? 4 : 3), pad_rows(pad_rows),
+      tiled(order == ComplexPlot::PixelOrder::Tiled)
+{
+    fit_to_size(pixels);
+    fit_to_size(front);
+    if(!tiled)
+    {
+        std::memset(front.data, 0, front.size);
+        return;
+    }
+
+    //the front becomes the back after the first frame, so it is cleared the way renders write it, each tile by its worker
+    std::swap(pixels, front);
+    std::size_t tile_bytes = (std::size_t)tile_size * tile_size * bytes_per_pixel;
+    render_tiles(std::thread::hardware_concurrency(), [this, tile_bytes](int row, int col, ComplexPlot::ThreadStats*)
+    {
+        std::memset(pixels.data + at_pos_index(row, col), 0, tile_bytes);
+    });
+    std::swap(pixels, front);
 }
 
 BitMap::~BitMap()
 {
-    delete[] pixels;
+    std::free(pixels.data);
+    std::free(front.data);
+    std::free(packed.data);
+}
+
+void BitMap::reserve(PixelBuffer& buf, std::size_t bytes)
+{
+    if(bytes <= buf.capacity) return;
+
+    //grow with headroom so a window being dragged larger settles quickly
+    std::size_t capacity = std::max(bytes, buf.capacity + buf.capacity / 2);
+    capacity = (capacity + 63) / 64 * 64; //aligned_alloc needs a multiple of the alignment
+
+    unsigned char* data = (unsigned char*)std::aligned_alloc(64, capacity);
+    if(!data) throw std::bad_alloc();
+
+    std::free(buf.data);
+    buf.data = data;
+    buf.capacity = capacity;
+    ++allocations;
+}
+
+//interleave the bits of x and y
+static std::uint32_t morton(std::uint32_t x, std::uint32_t y)
+{
+    std::uint32_t code = 0;
+    for(int bit = 0; bit < 16; ++bit)
+        code |= ((x >> bit) & 1) << (2 * bit) | ((y >> bit) & 1) << (2 * bit + 1);
+    return code;
+}
+
+void BitMap::fit_to_size(PixelBuffer& buf)
+{
+    if(tiled)
+    {
+        if(buf.width == width && buf.height == height && buf.data) return;
+
+        //every tile gets a whole slot, edge tiles leave the rest of theirs unused
+        int tiles_x = (width + tile_size - 1) / tile_size, tiles_y = (height + tile_size - 1) / tile_size;
+        std::size_t tile_bytes = (std::size_t)tile_size * tile_size * bytes_per_pixel;
+
+        buf.tile_sequence.resize(tiles_x * tiles_y);
+        for(int i = 0; i < tiles_x * tiles_y; ++i)
+            buf.tile_sequence[i] = i;
+        std::sort(buf.tile_sequence.begin(), buf.tile_sequence.end(), [tiles_x](int a, int b)
+        {
+            return morton(a % tiles_x, a / tiles_x) < morton(b % tiles_x, b / tiles_x);
+        });
+
+        buf.tile_offset.resize(tiles_x * tiles_y);
+        for(int slot = 0; slot < tiles_x * tiles_y; ++slot)
+            buf.tile_offset[buf.tile_sequence[slot]] = slot * tile_bytes;
+
+        //no clearing: the first write to each page is from the render thread that owns it
+        reserve(buf, tile_bytes * tiles_x * tiles_y);
+        buf.width = width;
+        buf.height = height;
+        buf.stride = (std::size_t)tile_size * bytes_per_pixel;
+        buf.size = tile_bytes * tiles_x * tiles_y;
+        return;
+    }
+
+    std::size_t stride = (std::size_t)bytes_per_pixel * width;
+    if(pad_rows) stride = (stride + 63) / 64 * 64;
+
+    reserve(buf, stride * height);
+    buf.width = width;
+    buf.height = height;
+    buf.stride = stride;
+    buf.size = stride * height;
+}
+
+void BitMap::resize(int width, int height)
+{
+    assert(width > 0 && height > 0);
+    this->width = width;
+    this->height = height;
+    fit_to_size(pixels);
+}
+
+const unsigned char* BitMap::packed_front()
+{
+    if(!tiled && bytes_per_pixel == 3 && front.stride == 3 * (std::size_t)front.width)
+        return front.data;
+
+    reserve(packed, 3 * (std::size_t)front.width * front.height);
+    int tiles_x = (front.width + tile_size - 1) / tile_size;
+
+    for(int row = 0; row < front.height; ++row)
+    {
+        unsigned char* dst = packed.data + 3 * (std::size_t)row * front.width;
+        if(tiled)
+        {
+            //one tile row at a time, each a contiguous run of at most tile_size pixels
+            for(int tx = 0; tx < tiles_x; ++tx)
+            {
+                const unsigned char* src = front.data + front.tile_offset[(row / tile_size) * tiles_x + tx] + (row % tile_size) * front.stride;
+                int n = std::min(tile_size, front.width - tx * tile_size);
+                if(bytes_per_pixel == 3)
+                    std::memcpy(dst + 3 * tx * tile_size, src, 3 * n);
+                else
+                    for(int col = 0; col < n; ++col)
+                        std::memcpy(dst + 3 * (tx * tile_size + col), src + 4 * col, 3);
+            }
+            continue;
+        }
+
+        const unsigned char* src = front.data + row * front.stride;
+        for(int col = 0; col < front.width; ++col)
+            std::memcpy(dst + 3 * col, src + bytes_per_pixel * col, 3);
+    }
+    return packed.data;
+}
+
+void BitMap::pin_to_cpu(std::thread& t, unsigned cpu)
+{
+    //the cpu-th of the CPUs this process may run on, which taskset or a cgroup can make fewer or not the first ones
+    cpu_set_t allowed;
+    if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return;
+    int count = CPU_COUNT(&allowed);
+    if(count == 0) return;
+
+    int skip = cpu % count, chosen = 0;
+    for(; chosen < CPU_SETSIZE; chosen++)
+        if(CPU_ISSET(chosen, &allowed) && skip-- == 0)
+            break;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(chosen, &set);
+    pthread_setaffinity_np(t.native_handle(), sizeof(set), &set); //best effort, placement is only a hint
+}
+
+void BitMap::publish_frame()
+{
+    std::lock_guard<std::mutex> lock(front_mutex);
+    std::swap(pixels, front);
+    std::swap(back_roots, front_roots);
+    std::swap(back_contours, front_contours);
+    preview.clear();
+    preview_width = preview_height = 0;
+    ++frames;
+}
+
+BitMap::FrontBuffer BitMap::acquire_front()
+{
+    std::unique_lock<std::mutex> lock(front_mutex);
+    unsigned char* data = (unsigned char*)packed_front();
+    return {std::move(lock), data, front.width, front.height};
+}
+
+void BitMap::begin_frame()
+{
+    fit_to_size(pixels); //the back buffer may still have the geometry of an older frame
+    origin_col = width / 2;
+    origin_row = height / 2;
+    scale_pixels = std::min(width, height);
+    image_width = width;
+    image_height = height;
+    back_roots.clear();
+    roots_ms = 0;
+    exposure_ms = 0;
+    samples_reused = 0;
+    back_contours = {};
+
+    std::lock_guard<std::mutex> lock(front_mutex);
+    preview.clear();
+    preview_width = preview_height = 0;
+}
+
+void BitMap::render_frame(const std::function<void()>& render)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    if(instrument)
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stats = {};
+        render_origin = start;
+    }
+
+    begin_frame();
+    render();
+
+    last_render_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    if(instrument)
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        stats.wall_ms = last_render_ms;
+    }
+    publish_frame();
+}
+
+std::shared_ptr<BitMap::TileSchedule> BitMap::make_schedule(Clock::time_point since) const
+{
+    int tiles_x = (width + tile_size - 1) / tile_size, tiles_y = (height + tile_size - 1) / tile_size;
+    double col = focus.col < 0 ? width / 2.0 : focus.col, row = focus.row < 0 ? height / 2.0 : focus.row;
+
+    //exposed tiles sort below every distance, nearest the point first among either kind
+    std::vector<std::pair<double, int>> keyed;
+    auto result = std::make_shared<TileSchedule>();
+    result->since = since;
+    for(int tile = 0; tile < tiles_x * tiles_y; tile++)
+    {
+        int c0 = (tile % tiles_x) * tile_size, r0 = (tile / tiles_x) * tile_size;
+        int c1 = std::min(c0 + tile_size, width), r1 = std::min(r0 + tile_size, height);
+        double distance = std::hypot(std::max({c0 - col, col - c1, 0.0}), std::max({r0 - row, row - r1, 0.0}));
+
+        bool exposed = std::any_of(focus.exposed.begin(), focus.exposed.end(), [&](const ComplexPlot::PixelRect& r)
+        {
+            return r.col < c1 && c0 < r.col + r.width && r.row < r1 && r0 < r.row + r.height;
+        });
+        keyed.push_back({exposed ? distance - 1e9 : distance, tile});
+        if(exposed || distance <= focus.radius)
+            result->focus.push_back(tile);
+    }
+
+    std::sort(keyed.begin(), keyed.end());
+    for(const auto& k : keyed)
+        result->order.push_back(k.second);
+    return result;
+}
+
+void BitMap::focus_complete(const TileSchedule& done)
+{
+    focus_ms = ms_between(done.since, Clock::now());
+    if(!focus_callback) return;
+
+    int tiles_x = (width + tile_size - 1) / tile_size;
+    bool same_size;
+    {
+        std::lock_guard<std::mutex> lock(front_mutex);
+        same_size = front.width == pixels.width && front.height == pixels.height && front.stride == pixels.stride;
+        if(same_size)
+        {
+            for(int tile : done.focus)
+            {
+                int c0 = (tile % tiles_x) * tile_size, r0 = (tile / tiles_x) * tile_size;
+                int n = std::min(c0 + tile_size, width) - c0;
+                for(int row = r0; row < std::min(r0 + tile_size, height); row++)
+                {
+                    std::size_t at = at_pos_index(row, c0);
+                    std::memcpy(front.data + at, pixels.data + at, (std::size_t)n * bytes_per_pixel);
+                }
+            }
+        }
+    }
+
+    if(!same_size)
+    {
+        //the old frame scaled to the new size, or the preview of an earlier focus of this render, with the region drawn in
+        std::vector<unsigned char> drawn = resampled_front(width, height);
+        for(int tile : done.focus)
+        {
+            int c0 = (tile % tiles_x) * tile_size, r0 = (tile / tiles_x) * tile_size;
+            for(int row = r0; row < std::min(r0 + tile_size, height); row++)
+                for(int col = c0; col < std::min(c0 + tile_size, width); col++)
+                    std::memcpy(drawn.data() + 3 * ((std::size_t)row * width + col), pixels.data + at_pos_index(row, col), 3);
+        }
+
+        std::lock_guard<std::mutex> lock(front_mutex);
+        preview = std::move(drawn);
+        preview_width = width;
+        preview_height = height;
+    }
+    focus_callback();
+}
+
+void BitMap::set_focus(const ComplexPlot::Focus& focus)
+{
+    std::lock_guard<std::mutex> lock(focus_mutex);
+    this->focus = focus;
+    focused = true;
+    if(schedule)
+    {
+        schedule = make_schedule(Clock::now());
+        schedule_generation++;
+    }
+}
+
+void BitMap::clear_focus()
+{
+    std::lock_guard<std::mutex> lock(focus_mutex);
+    focused = false;
+}
+
+void BitMap::record_encode(const char* format, Clock::time_point start)
+{
+    if(!instrument) return;
+
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    stats.encodes.push_back({format, ms_between(render_origin, start), ms_between(render_origin, Clock::now())});
+}
+
+ComplexPlot::RenderStats BitMap::render_stats()
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    return stats;
+}
+
+ComplexPlot::ThreadStats& ComplexPlot::ThreadStats::operator+=(const ThreadStats& other)
+{
+    evaluate_ms += other.evaluate_ms;
+    colour_ms += other.colour_ms;
+    grid_ms += other.grid_ms;
+    busy_ms += other.busy_ms;
+    idle_ms += other.idle_ms;
+    evaluations += other.evaluations;
+    interval_evaluations += other.interval_evaluations;
+    tiles += other.tiles;
+    tiles_culled += other.tiles_culled;
+    return *this;
+}
+
+ComplexPlot::ThreadStats ComplexPlot::RenderStats::total() const
+{
+    ThreadStats sum;
+    for(auto& t : threads)
+        sum += t;
+    return sum;
+}
+
+double ComplexPlot::RenderStats::encode_ms() const
+{
+    double sum = 0;
+    for(auto& e : encodes)
+        sum += e.end_ms - e.start_ms;
+    return sum;
+}
+
+void ComplexPlot::RenderStats::write_trace(const std::string& filename) const
+{
+    FILE* f = fopen(filename.c_str(), "w");
+    if(!f) throw std::runtime_error("Could not open " + filename);
+
+    //timestamps are microseconds, render threads are tids 1.., encodes run on the caller as tid 0
+    fprintf(f, "{\"traceEvents\": [\n");
+    fprintf(f, "  {\"name\": \"render\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0, \"ts\": 0, \"dur\": %.3f}", 1000 * wall_ms);
+    fprintf(f, ",\n  {\"name\": \"setup\", \"cat\": \"setup\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0, \"ts\": 0, \"dur\": %.3f}", 1000 * setup_ms);
+
+    for(auto& t : tiles)
+        fprintf(f, ",\n  {\"name\": \"tile %d,%d\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                t.row, t.col, t.culled ? "culled" : "evaluated", t.thread + 1, 1000 * t.start_ms, 1000 * (t.end_ms - t.start_ms));
+
+    for(auto& e : encodes)
+        fprintf(f, ",\n  {\"name\": \"encode %s\", \"cat\": \"encode\", \"ph\": \"X\", \"pid\": 1, \"tid\": 0, \"ts\": %.3f, \"dur\": %.3f}",
+                e.format.c_str(), 1000 * e.start_ms, 1000 * (e.end_ms - e.start_ms));
+
+    //phase totals per thread as metadata on the thread name
+    for(std::size_t i = 0; i < threads.size(); i++)
+    {
+        const ThreadStats& t = threads[i];
+        fprintf(f, ",\n  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %zu, \"args\": {\"name\": "
+                   "\"worker %zu: eval %.2f ms, colour %.2f ms, grid %.2f ms, idle %.2f ms, %lu evaluations\"}}",
+                i + 1, i, t.evaluate_ms, t.colour_ms, t.grid_ms, t.idle_ms, t.evaluations);
+    }
+    fprintf(f, "\n]}\n");
+
+    bool failed = ferror(f);
+    fclose(f);
+    if(failed) throw std::runtime_error("Write failed for " + filename);
 }
 
 void BitMap::plot_complex_func(std::string expr, int maxval, bool grid, unsigned int nthreads)
 {
-    Parsing::Expression<std::complex<double>> func(expr);
-    BitMap::plot_complex<double>(func, maxval, grid, nthreads);
+    plot_complex_func(expr, ComplexPlot::Viewport{{0, 0}, (double)maxval}, grid, nthreads);
+}
+
+void BitMap::plot_viewport(const std::string& expr, const ComplexPlot::Viewport& view, bool grid, unsigned int nthreads)
+{
+    auto func = ComplexPlot::expression_cache().get(expr);
+    check_variables(func->variable_names()); //surface missing variables here rather than inside a worker thread
+
+    std::string key = Parsing::ExpressionCache<std::complex<double>>::normalize(expr);
+    if(use_jit && key != jit_expr)
+    {
+        jit_kernel = ComplexPlot::JitKernel::compile(*func);
+        jit_expr = key;
+    }
+
+    centre = view.centre;
+    if(find_roots || trace_contours || reuse_samples)
+    {
+        field.resize((std::size_t)width * height);
+        field_out = field.data();
+    }
+    if(reuse_samples)
+        map_cached_samples(key, view.extent);
+    BitMap::plot_complex<double>(*func, use_jit ? jit_kernel.get() : nullptr, view.extent, grid, nthreads);
+    field_out = nullptr;
+    reuse_rows.clear();
+    reuse_cols.clear();
+    if(reuse_samples)
+        cache_samples(key, view.extent);
+
+    if(trace_contours)
+        contour_frame(*func, view.extent, nthreads);
+    if(find_roots)
+        locate_frame_roots(*func, view.extent, nthreads);
+}
+
+void BitMap::map_cached_samples(const std::string& expr, double maxval)
+{
+    const SampleCache& c = sample_cache;
+    if(c.values.empty() || c.expr != expr || c.bindings != bindings || c.jit != (use_jit && jit_kernel))
+        return;
+
+    //compared as the doubles the render computes, so a reused sample is the one a fresh evaluation would give
+    double pixel_per_int = pixel_scale(maxval);
+    reuse_rows.assign(height, -1);
+    reuse_cols.assign(width, -1);
+    for(int row = 0; row < height; row++)
+    {
+        double y = plane_y(row, pixel_per_int);
+        double at = std::round(c.origin_row - (y - c.centre.imag()) * c.pixel_per_int);
+        if(at >= 0 && at < c.height && (-(int)at + c.origin_row) / c.pixel_per_int + c.centre.imag() == y)
+            reuse_rows[row] = (int)at;
+    }
+    for(int col = 0; col < width; col++)
+    {
+        double x = plane_x(col, pixel_per_int);
+        double at = std::round((x - c.centre.real()) * c.pixel_per_int + c.origin_col);
+        if(at >= 0 && at < c.width && ((int)at - c.origin_col) / c.pixel_per_int + c.centre.real() == x)
+            reuse_cols[col] = (int)at;
+    }
+}
+
+void BitMap::cache_samples(const std::string& expr, double maxval)
+{
+    //roots and contours still need the field, otherwise it can be handed over
+    if(find_roots || trace_contours)
+        sample_cache.values = field;
+    else
+        std::swap(sample_cache.values, field);
+
+    sample_cache.width = width;
+    sample_cache.height = height;
+    sample_cache.origin_col = origin_col;
+    sample_cache.origin_row = origin_row;
+    sample_cache.centre = centre;
+    sample_cache.pixel_per_int = pixel_scale(maxval);
+    sample_cache.expr = expr;
+    sample_cache.bindings = bindings;
+    sample_cache.jit = use_jit && jit_kernel;
+}
+
+void BitMap::set_sample_reuse(bool enabled)
+{
+    reuse_samples = enabled;
+    if(!enabled)
+        sample_cache = {};
+}
+
+std::vector<unsigned char> BitMap::resampled_front(int new_width, int new_height)
+{
+    if(new_width <= 0 || new_height <= 0) throw std::invalid_argument("Size must be positive");
+
+    std::lock_guard<std::mutex> lock(front_mutex);
+    if(new_width == preview_width && new_height == preview_height)
+        return preview;
+
+    const unsigned char* src = packed_front();
+    int old_width = front.width, old_height = front.height;
+    double ratio = double(std::min(old_width, old_height)) / std::min(new_width, new_height); //old pixels per new
+
+    //nearest old pixel to where each new row and column lands, or -1 outside the old frame
+    std::vector<int> cols(new_width), rows(new_height);
+    for(int col = 0; col < new_width; col++)
+    {
+        long at = std::lround(old_width / 2 + (col - new_width / 2) * ratio);
+        cols[col] = at >= 0 && at < old_width ? (int)at : -1;
+    }
+    for(int row = 0; row < new_height; row++)
+    {
+        long at = std::lround(old_height / 2 + (row - new_height / 2) * ratio);
+        rows[row] = at >= 0 && at < old_height ? (int)at : -1;
+    }
+
+    std::vector<unsigned char> out((std::size_t)new_width * new_height * 3, 0);
+    for(int row = 0; row < new_height; row++)
+    {
+        if(rows[row] < 0) continue;
+        const unsigned char* line = src + (std::size_t)rows[row] * old_width * 3;
+        unsigned char* pix = out.data() + (std::size_t)row * new_width * 3;
+        for(int col = 0; col < new_width; col++, pix += 3)
+            if(cols[col] >= 0)
+                std::memcpy(pix, line + cols[col] * 3, 3);
+    }
+    return out;
+}
+
+void BitMap::fill_field(const Parsing::Expression<std::complex<double>>& f, double maxval, unsigned int nthreads)
+{
+    nthreads = std::max(1u, std::min(nthreads, std::thread::hardware_concurrency()));
+    double pixel_per_int = pixel_scale(maxval);
+    std::vector<std::thread> threads;
+    for(unsigned int i = 0; i < nthreads; i++)
+        threads.emplace_back([&, i]()
+        {
+            auto vars = variable_table<double>();
+            for(int row = i; row < height; row += nthreads)
+                for(int col = 0; col < width; col++)
+                {
+                    std::complex<double>& v = field[(std::size_t)row * width + col];
+                    if(!std::isnan(v.real())) continue;
+                    vars['z'] = {plane_x(col, pixel_per_int), plane_y(row, pixel_per_int)};
+                    v = f.evaluate_table(vars);
+                }
+        });
+    for(auto& t : threads)
+        t.join();
+}
+
+void BitMap::contour_frame(const Parsing::Expression<std::complex<double>>& f, double maxval, unsigned int nthreads)
+{
+    auto start = Clock::now();
+    fill_field(f, maxval, nthreads);
+    back_contours.stats.fill_ms = ms_between(start, Clock::now());
+
+    double pixel_per_int = pixel_scale(maxval);
+    ComplexPlot::SampledField sampled{field.data(), width, height, centre, origin_col, origin_row, pixel_per_int};
+    back_contours.contours = ComplexPlot::extract_contours(sampled, contour_options, tile_size, nthreads, back_contours.stats);
+    back_contours.width = width;
+    back_contours.height = height;
+    if(!contour_options.overlay)
+        return;
+
+    start = Clock::now();
+    const ComplexPlot::ContourOptions& o = contour_options;
+    ComplexPlot::rasterize_contours(back_contours.contours, width, height, o.line_width, tile_size, nthreads,
+                                    [&](int row, int col, float magnitude, float phase)
+    {
+        unsigned char* pix = pixels.data + at_pos_index(row, col);
+        for(int i = 0; i < 3; ++i)
+        {
+            double v = pix[i];
+            v += (o.magnitude_colour[i] - v) * o.opacity * magnitude;
+            v += (o.phase_colour[i] - v) * o.opacity * phase;
+            pix[i] = (unsigned char)(v + 0.5);
+        }
+    });
+    back_contours.stats.draw_ms = ms_between(start, Clock::now());
+}
+
+void BitMap::set_auto_exposure(bool enabled, const ComplexPlot::ExposureOptions& options)
+{
+    if(options.subsample < 1) throw std::invalid_argument("Exposure subsample must be at least 1");
+    if(!(options.clip >= 1)) throw std::invalid_argument("Exposure clip must be at least 1");
+    if(!(options.floor >= 0 && options.floor < 1)) throw std::invalid_argument("Exposure floor must be in [0, 1)");
+    if(!(options.smoothing >= 0 && options.smoothing < 1)) throw std::invalid_argument("Exposure smoothing must be in [0, 1)");
+
+    //don't blend the next frame with a map built under other options
+    const ComplexPlot::ExposureOptions& o = exposure_options;
+    if(enabled != auto_exposure || options.subsample != o.subsample || options.clip != o.clip || options.floor != o.floor)
+        tone_map_fresh = false;
+    auto_exposure = enabled;
+    exposure_options = options;
+}
+
+ComplexPlot::ContourSet BitMap::contours()
+{
+    std::lock_guard<std::mutex> lock(front_mutex);
+    return front_contours;
+}
+
+void BitMap::locate_frame_roots(const Parsing::Expression<std::complex<double>>& f, double maxval, unsigned int nthreads)
+{
+    auto start = Clock::now();
+    double pixel_per_int = pixel_scale(maxval);
+    ComplexPlot::SampledField sampled{field.data(), width, height, centre, origin_col, origin_row, pixel_per_int};
+
+    back_roots = ComplexPlot::locate_roots(f, variable_table<double>(), sampled, tile_size, nthreads);
+    if(mark_roots)
+        for(const auto& root : back_roots)
+            draw_root_marker(root, pixel_per_int);
+    roots_ms = ms_between(start, Clock::now());
+}
+
+void BitMap::draw_root_marker(const ComplexPlot::Root& root, double pixel_per_int)
+{
+    //zeros colour black and poles white, so the markers are the opposite
+    double col = (root.z.real() - centre.real()) * pixel_per_int + origin_col;
+    double row = origin_row - (root.z.imag() - centre.imag()) * pixel_per_int;
+    int radius = 3 + 2 * std::min(std::abs(root.order), 4);
+    unsigned char shade = root.order > 0 ? 255 : 0;
+
+    for(int r = std::max(0, (int)std::floor(row) - radius - 1); r <= std::min(height - 1, (int)std::ceil(row) + radius + 1); r++)
+        for(int c = std::max(0, (int)std::floor(col) - radius - 1); c <= std::min(width - 1, (int)std::ceil(col) + radius + 1); c++)
+        {
+            double dx = std::abs(c - col), dy = std::abs(r - row);
+            bool on = root.order > 0 ? std::abs(std::hypot(dx, dy) - radius) < 0.75
+                                     : std::max(dx, dy) <= radius && std::abs(dx - dy) < 0.75;
+            if(!on) continue;
+
+            unsigned char* pix = pixels.data + at_pos_index(r, c);
+            for(int i = 0; i < 3; ++i)
+                pix[i] = shade;
+        }
+}
+
+std::vector<ComplexPlot::Root> BitMap::roots()
+{
+    std::lock_guard<std::mutex> lock(front_mutex);
+    return front_roots;
+}
+
+void BitMap::plot_complex_func(std::string expr, const ComplexPlot::Viewport& view, bool grid, unsigned int nthreads)
+{
+    if(!(view.extent > 0)) throw std::invalid_argument("Viewport extent must be positive");
+
+    render_frame([&]()
+    {
+        plot_viewport(expr, view, grid, nthreads);
+    });
+}
+
+void BitMap::plot_complex_region(std::string expr, const ComplexPlot::Viewport& view, int full_width, int full_height,
+                                 int col, int row, bool grid, unsigned int nthreads)
+{
+    if(!(view.extent > 0)) throw std::invalid_argument("Viewport extent must be positive");
+    if(col < 0 || row < 0 || col + width > full_width || row + height > full_height)
+        throw std::invalid_argument("Region lies outside the full image");
+
+    render_frame([&]()
+    {
+        origin_col = full_width / 2 - col;
+        origin_row = full_height / 2 - row;
+        scale_pixels = std::min(full_width, full_height);
+        image_width = full_width;
+        image_height = full_height;
+        plot_viewport(expr, view, grid, nthreads);
+    });
+}
+
+void BitMap::plot_complex_deep(std::string expr, const ComplexPlot::DeepViewport& view, unsigned int nthreads)
+{
+    if(!(view.extent > 0)) throw std::invalid_argument("Viewport extent must be positive");
+
+    render_frame([&]()
+    {
+        auto func = ComplexPlot::expression_cache().get(expr);
+        check_variables(func->variable_names());
+        centre = view.centre.rounded();
+
+        ComplexPlot::Perturbation f(*func, view.centre, variable_table<double>());
+        double pixel_per_int = pixel_scale(view.extent);
+        render_tiles(nthreads, [&f, pixel_per_int, this](int row, int col, ComplexPlot::ThreadStats* stats)
+        {
+            this->plot_deep_tile(f, row, col, pixel_per_int, stats);
+        });
+    });
+}
+
+ComplexPlot::FusionStats BitMap::plot_complex_funcs(const std::vector<std::string>& exprs, const std::vector<BitMap*>& outputs,
+                                                    const ComplexPlot::Viewport& view, bool grid, unsigned int nthreads)
+{
+    if(exprs.empty() || exprs.size() != outputs.size()) throw std::invalid_argument("Need one output bitmap per expression");
+    if(!(view.extent > 0)) throw std::invalid_argument("Viewport extent must be positive");
+
+    BitMap& first = *outputs[0];
+    for(BitMap* out : outputs)
+        if(out->width != first.width || out->height != first.height)
+            throw std::invalid_argument("Fused outputs must all be the same size");
+
+    std::vector<std::shared_ptr<const Parsing::Expression<std::complex<double>>>> funcs;
+    std::vector<const Parsing::Expression<std::complex<double>>*> programs;
+    for(const auto& expr : exprs)
+    {
+        funcs.push_back(ComplexPlot::expression_cache().get(expr));
+        first.check_variables(funcs.back()->variable_names());
+        programs.push_back(funcs.back().get());
+    }
+
+    Parsing::FusedExpression<std::complex<double>> fused(programs);
+    ComplexPlot::FusionStats result{exprs.size(), fused.ops_unshared(), fused.ops()};
+
+    for(BitMap* out : outputs)
+    {
+        out->begin_frame();
+        out->centre = view.centre;
+    }
+
+    first.render_frame([&]()
+    {
+        first.render_tiles(nthreads, [&](int row, int col, ComplexPlot::ThreadStats* stats)
+        {
+            first.plot_fused_tile(fused, outputs, row, col, view.extent, grid, stats);
+        });
+    });
+
+    for(std::size_t k = 1; k < outputs.size(); k++)
+    {
+        outputs[k]->last_render_ms = first.last_render_ms.load();
+        outputs[k]->publish_frame();
+    }
+    return result;
+}
+
+void BitMap::plot_complex_derivative(std::string expr, int maxval, bool grid, unsigned int nthreads)
+{
+    render_frame([&]()
+    {
+        auto derivative = ComplexPlot::expression_cache().get(expr)->derivative('z');
+        check_variables(derivative.variable_names());
+        centre = {0, 0};
+
+        BitMap::plot_complex<double>(derivative, nullptr, maxval, grid, nthreads);
+    });
+}
+
+void BitMap::plot_newton_fractal(std::string expr, int maxval, unsigned int nthreads, int max_iterations)
+{
+    render_frame([&]()
+    {
+        auto func = ComplexPlot::expression_cache().get(expr);
+        check_variables(func->variable_names());
+        func->check_differentiable('z'); //throws here for functions newton's method can't use
+        centre = {0, 0};
+
+        const Parsing::Expression<std::complex<double>>& f = *func;
+        std::vector<std::pair<std::complex<double>, int>> reached((std::size_t)width * height);
+        render_tiles(nthreads, [=, &f, &reached, this](int row, int col, ComplexPlot::ThreadStats* stats)
+        {
+            this->plot_newton_tile(f, row, col, maxval, max_iterations, reached.data(), stats);
+        });
+        colour_newton_basins(reached, max_iterations);
+    });
+}
+
+void BitMap::colour_newton_basins(const std::vector<std::pair<std::complex<double>, int>>& reached, int max_iterations)
+{
+    //the distinct roots in the frame. newton's method stops within 1e-9 of a simple root, slower and further off
+    //near a multiple one, so anything this close is taken to be the same root
+    auto same = [](std::complex<double> a, std::complex<double> b) { return std::abs(a - b) < 1e-6 * std::max(1.0, std::abs(b)); };
+    std::vector<std::complex<double>> roots;
+    for(const auto& [z, iterations] : reached)
+        if(!std::isnan(z.real()) && std::none_of(roots.begin(), roots.end(), [&](std::complex<double> r) { return same(z, r); }))
+            roots.push_back(z);
+
+    //hues evenly spaced around the wheel, in order of phase then modulus so they don't depend on which pixel came first
+    std::sort(roots.begin(), roots.end(), [](std::complex<double> a, std::complex<double> b)
+    {
+        return std::arg(a) != std::arg(b) ? std::arg(a) < std::arg(b) : std::abs(a) < std::abs(b);
+    });
+
+    for(int row = 0; row < height; row++)
+        for(int col = 0; col < width; col++)
+        {
+            const auto& [z, iterations] = reached[(std::size_t)row * width + col];
+            if(std::isnan(z.real())) continue; //already black
+
+            std::size_t k = std::find_if(roots.begin(), roots.end(), [&](std::complex<double> r) { return same(z, r); }) - roots.begin();
+            unsigned char* pix = pixels.data + at_pos_index(row, col);
+            ComplexPlot::cmplx_to_colour(pix, std::polar(20.0, 2 * M_PI * k / roots.size()));
+            double shade = 1 - 0.8 * iterations / max_iterations;
+            for(int i = 0; i < 3; ++i)
+                pix[i] = (unsigned char)(pix[i] * shade);
+        }
+}
+
+void BitMap::write_jpeg(FILE* out, const ComplexPlot::JpegOptions& options)
+{
+    jpeg_out = out;
+    const unsigned char* temp_pix = packed_front();
+
+    TooJpeg::writeJpeg([](unsigned char byte){fputc(byte, jpeg_out);}, temp_pix, front.width, front.height, true,
+                       std::clamp(options.quality, 1, 100), options.downsample, NULL, options.optimize_huffman, options.progressive);
+}
+
+void BitMap::save_jpeg(std::string filename, const ComplexPlot::JpegOptions& options)//Does what it says. .jpg extension not necessary
+{
+    auto start = Clock::now();
+    filename = with_extension(filename, ".jpg");
+
+    FILE* out = fopen(filename.c_str(), "wb");
+    if(!out) throw std::runtime_error("Could not open " + filename);
+
+    std::lock_guard<std::mutex> lock(front_mutex);
+    write_jpeg(out, options);
+
+    fclose(out);
+    record_encode("jpeg", start);
 }
 
-void BitMap::save_jpeg(std::string filename)//Does what it says. .jpg extension not necessary
+void BitMap::set_variable(char name, std::complex<double> value)
 {
-    filename += (filename.length() > 4 && filename.substr(filename.length() - 4, 4) == ".jpg" ? "" : ".jpg");
+    if(name == 'z' || name == 'i' || (unsigned char)name >= bindings.size())
+        throw std::invalid_argument(std::string("Cannot bind variable ") + name);
+
+    bindings[(unsigned char)name] = value;
+    if(bound_names.find(name) == std::string::npos)
+        bound_names.push_back(name);
+}
+
+void BitMap::clear_variables()
+{
+    bindings.fill({0, 0});
+    bound_names.clear();
+}
+
+void BitMap::check_variables(const std::string& names) const
+{
+    for(char v : names)
+        if(v != 'z' && bound_names.find(v) == std::string::npos)
+            throw std::invalid_argument(std::string("No value for variable ") + v);
+}
+
+ComplexPlot::AnimationStats BitMap::animate(std::string expr, const std::string& output, const ComplexPlot::AnimationOptions& options)
+{
+    if(options.frames < 1) throw std::invalid_argument("Animation needs at least one frame");
+
+    std::string base = output;
+    if(ComplexPlot::format_from_extension(base) == ComplexPlot::ImageFormat::JPEG && base.rfind('.') != std::string::npos && base.rfind('.') > base.rfind('/') + 1)
+        base = base.substr(0, base.rfind('.')); //output may name the first frame or the stream
 
-    jpeg_out = fopen(filename.c_str(), "wb");
+    FILE* stream = nullptr;
+    if(options.mjpeg)
+    {
+        stream = fopen((base + ".mjpeg").c_str(), "wb");
+        if(!stream) throw std::runtime_error("Could not open " + base + ".mjpeg");
+    }
 
-    //temporary due to issues with _RGBpix obj and jpeg storage
-    unsigned char* temp_pix = pixels;
+    //t is only bound for the frames, whatever the caller had goes back afterwards
+    std::complex<double> saved_t = bindings['t'];
+    std::string saved_names = bound_names;
+    auto restore_t = [&]()
+    {
+        bindings['t'] = saved_t;
+        bound_names = saved_names;
+    };
 
-    TooJpeg::writeJpeg([](unsigned char byte){fputc(byte, jpeg_out);},temp_pix, width, height, true, 100, false, NULL);
+    ComplexPlot::AnimationStats result;
+    std::atomic<double> encode_ms{0};
+    std::exception_ptr encode_error;
+    std::thread encoder;
+    auto start = Clock::now();
 
-    fclose(jpeg_out);
-    
-}
\ No newline at end of file
+    auto finish_encode = [&]()
+    {
+        if(encoder.joinable()) encoder.join();
+        if(encode_error) std::rethrow_exception(encode_error);
+    };
+
+    try
+    {
+        for(int frame = 0; frame < options.frames; frame++)
+        {
+            double t = options.frames == 1 ? options.t_start
+                                           : options.t_start + (options.t_end - options.t_start) * frame / (options.frames - 1);
+            set_variable('t', t);
+
+            //publishing waits for the encoder to let go of the previous frame
+            plot_complex_func(expr, options.maxval, options.grid, options.nthreads);
+            result.render_ms += last_render_ms;
+            finish_encode();
+
+            //hand the frame to an encoder thread, and only render the next one once it holds the front buffer
+            std::promise<void> locked;
+            std::future<void> holding = locked.get_future();
+            encoder = std::thread([&, frame, locked = std::move(locked)]() mutable
+            {
+                std::unique_lock<std::mutex> lock(front_mutex);
+                locked.set_value();
+                try
+                {
+                    auto encode_start = Clock::now();
+                    if(stream)
+                        write_jpeg(stream, options.jpeg);
+                    else
+                    {
+                        char suffix[16];
+                        std::snprintf(suffix, sizeof(suffix), "_%04d.jpg", frame);
+                        FILE* out = fopen((base + suffix).c_str(), "wb");
+                        if(!out) throw std::runtime_error("Could not open " + base + suffix);
+                        write_jpeg(out, options.jpeg);
+                        fclose(out);
+                    }
+                    encode_ms = encode_ms + ms_between(encode_start, Clock::now());
+                }
+                catch(...)
+                {
+                    encode_error = std::current_exception();
+                }
+            });
+            holding.wait();
+        }
+        finish_encode();
+    }
+    catch(...)
+    {
+        if(encoder.joinable()) encoder.join();
+        if(stream) fclose(stream);
+        restore_t();
+        throw;
+    }
+
+    if(stream) fclose(stream);
+    restore_t();
+
+    result.frames = options.frames;
+    result.wall_ms = ms_between(start, Clock::now());
+    result.encode_ms = encode_ms;
+    result.fps = 1000 * result.frames / result.wall_ms;
+    return result;
+}
+
+Parsing::ExpressionCache<std::complex<double>>& ComplexPlot::expression_cache()
+{
+    static Parsing::ExpressionCache<std::complex<double>> cache(128);
+    return cache;
+}
+
+ComplexPlot::ImageFormat ComplexPlot::format_from_extension(const std::string& filename)
+{
+    auto dot = filename.rfind('.');
+    std::string ext = dot == std::string::npos ? "" : filename.substr(dot);
+
+    if(ext == ".ppm") return ImageFormat::PPM;
+    if(ext == ".png") return ImageFormat::PNG;
+    if(ext == ".rgb" || ext == ".raw") return ImageFormat::RAW;
+    return ImageFormat::JPEG;
+}
+
+std::size_t BitMap::save_ppm(std::string filename)
+{
+    auto start = Clock::now();
+    filename = with_extension(filename, ".ppm");
+
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) throw std::runtime_error("Could not open " + filename);
+
+    std::lock_guard<std::mutex> lock(front_mutex);
+
+    std::string header = "P6\n" + std::to_string(front.width) + " " + std::to_string(front.height) + "\n255\n";
+    std::size_t data_size = 3 * (std::size_t)front.width * front.height;
+
+    //header and pixels go out in a single syscall, no intermediate copy
+    iovec parts[2] = {{(void*)header.data(), header.size()}, {(void*)packed_front(), data_size}};
+    std::size_t total = header.size() + data_size, written = 0;
+
+    while(written < total)
+    {
+        ssize_t n = writev(fd, parts, 2);
+        if(n <= 0)
+        {
+            close(fd);
+            throw std::runtime_error("Write failed for " + filename);
+        }
+        written += n;
+
+        //partial write, skip over what already went out
+        for(auto& part : parts)
+        {
+            std::size_t step = std::min((std::size_t)n, part.iov_len);
+            part.iov_base = (char*)part.iov_base + step;
+            part.iov_len -= step;
+            n -= step;
+        }
+    }
+
+    close(fd);
+    record_encode("ppm", start);
+    return total;
+}
+
+std::size_t BitMap::save_raw(std::string filename)
+{
+    auto start = Clock::now();
+    if(ComplexPlot::format_from_extension(filename) != ComplexPlot::ImageFormat::RAW)
+        filename += ".rgb";
+
+    int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) throw std::runtime_error("Could not open " + filename);
+
+    std::lock_guard<std::mutex> lock(front_mutex);
+    std::size_t data_size = 3 * (std::size_t)front.width * front.height;
+
+    if(ftruncate(fd, data_size) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("Could not size " + filename);
+    }
+
+    void* map = mmap(nullptr, data_size, PROT_WRITE, MAP_SHARED, fd, 0);
+    if(map == MAP_FAILED)
+    {
+        close(fd);
+        throw std::runtime_error("Could not map " + filename);
+    }
+
+    std::memcpy(map, packed_front(), data_size);
+
+    munmap(map, data_size);
+    close(fd);
+    record_encode("raw", start);
+    return data_size;
+}
+
+static void png_chunk(std::vector<unsigned char>& out, const char* type, const unsigned char* data, std::size_t len)
+{
+    auto put32 = [&out](uint32_t v){for(int s = 24; s >= 0; s -= 8) out.push_back((v >> s) & 0xFF);};
+
+    put32(len);
+    std::size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data, data + len);
+    put32(crc32(0, out.data() + start, len + 4)); //crc covers type and data
+}
+
+std::vector<unsigned char> BitMap::png_bytes(bool fast)
+{
+    std::unique_lock<std::mutex> lock(front_mutex);
+
+    const int width = front.width, height = front.height;
+    const std::size_t stride = 3 * (std::size_t)width;
+    const unsigned char* src = packed_front();
+
+    //one filter byte in front of every row
+    std::vector<unsigned char> filtered((stride + 1) * height);
+    std::vector<unsigned char> candidate(stride);
+
+    for(int row = 0; row < height; ++row)
+    {
+        const unsigned char* cur = src + row * stride;
+        const unsigned char* prev = row ? cur - stride : nullptr;
+        unsigned char* dst = filtered.data() + row * (stride + 1);
+
+        //Sub is cheap and suits smooth domain colouring, adaptive mode also tries Up and Paeth
+        int best_filter = 1;
+        for(std::size_t i = 0; i < stride; ++i)
+            dst[i + 1] = cur[i] - (i >= 3 ? cur[i - 3] : 0);
+
+        if(!fast)
+        {
+            auto cost = [stride](const unsigned char* p){long c = 0; for(std::size_t i = 0; i < stride; ++i) c += std::abs((signed char)p[i]); return c;};
+            long best_cost = cost(dst + 1);
+
+            for(int filter = 2; filter <= 4; filter += 2) //2 = Up, 4 = Paeth
+            {
+                for(std::size_t i = 0; i < stride; ++i)
+                {
+                    int a = i >= 3 ? cur[i - 3] : 0, b = prev ? prev[i] : 0, c = (prev && i >= 3) ? prev[i - 3] : 0;
+                    int pred = b;
+                    if(filter == 4)
+                    {
+                        int p = a + b - c, pa = std::abs(p - a), pb = std::abs(p - b), pc = std::abs(p - c);
+                        pred = (pa <= pb && pa <= pc) ? a : (pb <= pc ? b : c);
+                    }
+                    candidate[i] = cur[i] - pred;
+                }
+                long c = cost(candidate.data());
+                if(c < best_cost)
+                {
+                    best_cost = c;
+                    best_filter = filter;
+                    std::copy(candidate.begin(), candidate.end(), dst + 1);
+                }
+            }
+        }
+        dst[0] = best_filter;
+    }
+    lock.unlock();
+
+    uLongf compressed_size = compressBound(filtered.size());
+    std::vector<unsigned char> compressed(compressed_size);
+    if(compress2(compressed.data(), &compressed_size, filtered.data(), filtered.size(), fast ? Z_BEST_SPEED : Z_DEFAULT_COMPRESSION) != Z_OK)
+        throw std::runtime_error("PNG compression failed");
+
+    unsigned char ihdr[13] = {
+        (unsigned char)(width >> 24), (unsigned char)(width >> 16), (unsigned char)(width >> 8), (unsigned char)width,
+        (unsigned char)(height >> 24), (unsigned char)(height >> 16), (unsigned char)(height >> 8), (unsigned char)height,
+        8, 2, 0, 0, 0 //8 bit depth, truecolour, deflate, adaptive filtering, no interlace
+    };
+
+    std::vector<unsigned char> out = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    out.reserve(compressed_size + 64);
+    png_chunk(out, "IHDR", ihdr, sizeof(ihdr));
+    png_chunk(out, "IDAT", compressed.data(), compressed_size);
+    png_chunk(out, "IEND", nullptr, 0);
+    return out;
+}
+
+std::size_t BitMap::save_png(std::string filename, bool fast)
+{
+    auto start = Clock::now();
+    filename = with_extension(filename, ".png");
+    std::vector<unsigned char> out = png_bytes(fast);
+
+    FILE* f = fopen(filename.c_str(), "wb");
+    if(!f) throw std::runtime_error("Could not open " + filename);
+    std::size_t written = fwrite(out.data(), 1, out.size(), f);
+    fclose(f);
+
+    if(written != out.size()) throw std::runtime_error("Write failed for " + filename);
+    record_encode("png", start);
+    return written;
+}
+
+std::size_t BitMap::save_svg(std::string filename, bool with_image)
+{
+    auto start = Clock::now();
+    filename = with_extension(filename, ".svg");
+    std::string svg = ComplexPlot::contours_svg(contours(), contour_options, with_image ? png_bytes(true) : std::vector<unsigned char>());
+
+    FILE* f = fopen(filename.c_str(), "wb");
+    if(!f) throw std::runtime_error("Could not open " + filename);
+    std::size_t written = fwrite(svg.data(), 1, svg.size(), f);
+    fclose(f);
+
+    if(written != svg.size()) throw std::runtime_error("Write failed for " + filename);
+    record_encode("svg", start);
+    return written;
+}
+
+std::size_t BitMap::save(std::string filename, ComplexPlot::ImageFormat format)
+{
+    switch(format)
+    {
+        case ComplexPlot::ImageFormat::PPM:
+            return save_ppm(filename);
+        case ComplexPlot::ImageFormat::PNG:
+            return save_png(filename);
+        case ComplexPlot::ImageFormat::RAW:
+            return save_raw(filename);
+        default:
+        {
+            save_jpeg(filename);
+            struct stat info;
+            return stat(with_extension(filename, ".jpg").c_str(), &info) == 0 ? info.st_size : 0;
+        }
+    }
+}
+
+std::vector<unsigned char> BitMap::encode(ComplexPlot::ImageFormat format, const ComplexPlot::JpegOptions& options)
+{
+    if(format == ComplexPlot::ImageFormat::PNG)
+        return png_bytes(true);
+
+    std::lock_guard<std::mutex> lock(front_mutex);
+    std::vector<unsigned char> out;
+
+    if(format == ComplexPlot::ImageFormat::JPEG)
+    {
+        char* buffer = nullptr;
+        std::size_t size = 0;
+        FILE* stream = open_memstream(&buffer, &size);
+        if(!stream) throw std::runtime_error("Could not open memory stream");
+        write_jpeg(stream, options);
+        fclose(stream);
+        out.assign(buffer, buffer + size);
+        std::free(buffer);
+        return out;
+    }
+
+    if(format == ComplexPlot::ImageFormat::PPM)
+    {
+        std::string header = "P6\n" + std::to_string(front.width) + " " + std::to_string(front.height) + "\n255\n";
+        out.assign(header.begin(), header.end());
+    }
+    const unsigned char* data = packed_front();
+    out.insert(out.end(), data, data + 3 * (std::size_t)front.width * front.height);
+    return out;
+}
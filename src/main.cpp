@@ -1,5 +1,8 @@
 #include <wx/wx.h>
 
+#include <thread>
+#include <chrono>
+
 #include "libcplot.hpp"
 
 class CPlotWindow : public wxFrame {
@@ -15,6 +18,10 @@ public:
         fileMenu->Append(wxID_SAVEAS, "&Save as...\tAlt-Shift-S", "Save and name the current image");
         menuBar->Append(fileMenu, "&File");
 
+		viewMenu = new wxMenu;
+		viewMenu->AppendCheckItem(ID_AUTO_EXPOSURE, "Auto &exposure\tAlt-E", "Scale brightness to the magnitudes in view");
+        menuBar->Append(viewMenu, "&View");
+
 		helpMenu = new wxMenu;
 		helpMenu->Append(wxID_ABOUT, "&About\tAlt-A", "Show about dialog");
         menuBar->Append(helpMenu, "&Help");
@@ -42,30 +49,200 @@ public:
 
         panel->SetSizer(mainSizer); // Assign the sizer to the panel
 
+        CreateStatusBar();
+
+        src_bitmap = new BitMap(400, 400);
+        src_bitmap->set_tile_culling(3); // interpolated tiles stay within 3 colour levels of the exact render
+        src_bitmap->set_root_finding(true); // mark zeros and poles on every frame
+        src_bitmap->set_focus({}); // centre of the window first
+        src_bitmap->set_sample_reuse(true); // after a resize that keeps the scale, only the uncovered strips are evaluated
+        src_bitmap->set_focus_callback([this]() { CallAfter([this]() { if(rendering) ShowFront(); }); });
+
         // Bind an event handler to handle frame resizing
         Bind(wxEVT_SIZE, &CPlotWindow::OnResize, this);
+        resize_timer.SetOwner(this);
+        Bind(wxEVT_TIMER, &CPlotWindow::OnResizeSettled, this, resize_timer.GetId());
+        textBox->Bind(wxEVT_TEXT, &CPlotWindow::OnTextChange, this);
+        Bind(wxEVT_MENU, &CPlotWindow::OnAutoExposure, this, ID_AUTO_EXPOSURE);
+        staticBitmap->Bind(wxEVT_MOTION, &CPlotWindow::OnMouseMove, this);
+        staticBitmap->Bind(wxEVT_LEAVE_WINDOW, &CPlotWindow::OnMouseLeave, this);
+    }
+
+    ~CPlotWindow() {
+        if(render_thread.joinable())
+            render_thread.join();
+        delete src_bitmap;
     }
 
 private:
 
+    enum { ID_AUTO_EXPOSURE = wxID_HIGHEST + 1 };
+
 	wxMenuBar* menuBar;
 	wxMenu* fileMenu;
+	wxMenu* viewMenu;
 	wxMenu* helpMenu;
     wxStaticBitmap* staticBitmap;
     wxTextCtrl* textBox;
     wxBoxSizer* mainSizer;
     BitMap* src_bitmap;
-    
+
+    // renders run off the GUI thread into the back buffer while the front buffer stays on screen
+    std::thread render_thread;
+    bool rendering = false; // only touched on the GUI thread
+    bool pending = false;
+    std::string pending_expr;
+    bool exposure = false;
+    wxTimer resize_timer;
+    wxPoint mouse = wxDefaultPosition; // over the bitmap, otherwise (-1, -1)
+    wxSize rendered_size;              // of the last render started
+    std::string rendered_expr;
 
     void OnResize(wxSizeEvent& event) {
         // Adjust the width of the text box to match the frame's width while keeping its height fixed
         wxSize size = GetClientSize();
         textBox->SetSize(size.GetWidth(), 100); // 100 is the fixed height of the text box
         event.Skip(); // Allow default handling of the resize event
+
+        // once the sizer has laid out the bitmap, show the last frame resampled to its new size straight away.
+        // dragging sends a burst of these, the render at the final size waits until they pause
+        CallAfter([this]() {
+            if(src_bitmap->frame_count() > 0)
+                ShowFront();
+        });
+        resize_timer.StartOnce(150);
+    }
+
+    void OnResizeSettled(wxTimerEvent&) {
+        if(pending_expr.empty())
+            return;
+        pending = true;
+        if(!rendering)
+            StartRender();
+    }
+
+    void OnTextChange(wxCommandEvent& event) {
+        pending_expr = textBox->GetValue().ToStdString();
+        pending = true;
+        if(!rendering)
+            StartRender();
+    }
+
+    void OnAutoExposure(wxCommandEvent& event) {
+        exposure = event.IsChecked();
+        if(pending_expr.empty())
+            return;
+        pending = true;
+        if(!rendering)
+            StartRender();
+    }
+
+    // tiles under the mouse render first, also for a render already under way
+    void OnMouseMove(wxMouseEvent& event) {
+        mouse = event.GetPosition();
+        src_bitmap->set_focus({(double)mouse.x, (double)mouse.y});
+        event.Skip();
     }
 
-    void OnTextChange(){
+    void OnMouseLeave(wxMouseEvent& event) {
+        mouse = wxDefaultPosition;
+        src_bitmap->set_focus({});
+        event.Skip();
+    }
+
+    // after a resize that keeps the scale, the old frame stays centred and only the strips around it are new
+    std::vector<ComplexPlot::PixelRect> ExposedBy(wxSize from, wxSize to) {
+        std::vector<ComplexPlot::PixelRect> exposed;
+        if(std::min(from.x, from.y) != std::min(to.x, to.y))
+            return exposed;
+        int left = to.x / 2 - from.x / 2, top = to.y / 2 - from.y / 2;
+        if(left > 0)
+            exposed.push_back({0, 0, left, to.y});
+        if(to.x - left - from.x > 0)
+            exposed.push_back({left + from.x, 0, to.x - left - from.x, to.y});
+        if(top > 0)
+            exposed.push_back({0, 0, to.x, top});
+        if(to.y - top - from.y > 0)
+            exposed.push_back({0, top + from.y, to.x, to.y - top - from.y});
+        return exposed;
+    }
+
+    void StartRender() {
+        if(render_thread.joinable())
+            render_thread.join();
+
+        rendering = true;
+        pending = false;
+
+        // safe while no render is running, the back buffer reuses its capacity
+        wxSize size = staticBitmap->GetSize();
+        if(size.GetWidth() > 0 && size.GetHeight() > 0)
+            src_bitmap->resize(size.GetWidth(), size.GetHeight());
+
+        ComplexPlot::Focus focus{(double)mouse.x, (double)mouse.y};
+        if(pending_expr == rendered_expr && size != rendered_size)
+            focus.exposed = ExposedBy(rendered_size, size);
+        src_bitmap->set_focus(focus);
+        rendered_size = size;
+        rendered_expr = pending_expr;
+
+        // steadied over frames, so brightness doesn't jump while typing
+        ComplexPlot::ExposureOptions options;
+        options.smoothing = 0.5;
+        src_bitmap->set_auto_exposure(exposure, options);
+
+        render_thread = std::thread([this, expr = pending_expr]() {
+            bool ok = true;
+            try {
+                src_bitmap->plot_complex_func(expr, 10, true, std::thread::hardware_concurrency());
+            }
+            catch(const std::exception&) {
+                ok = false; // incomplete expression while the user is still typing
+            }
+            CallAfter([this, ok]() { OnRenderDone(ok); });
+        });
+    }
+
+    void OnRenderDone(bool ok) {
+        rendering = false;
+        if(ok)
+            ShowFrame();
+        if(pending)
+            StartRender(); // a newer expression arrived while rendering
+    }
+
+    void ShowFront() {
+        wxSize size = staticBitmap->GetSize();
+        {
+            // wrap the front buffer without copying, it stays locked until wxBitmap has been built
+            BitMap::FrontBuffer front = src_bitmap->acquire_front();
+            if(size == wxSize(front.width, front.height) || size.GetWidth() <= 0 || size.GetHeight() <= 0) {
+                wxImage image(front.width, front.height, front.data, true);
+                staticBitmap->SetBitmap(wxBitmap(image));
+                return;
+            }
+        }
+
+        // resized since the frame was rendered, show it scaled to the new size until that has rendered,
+        // with the new render's focus region once that is done
+        std::vector<unsigned char> resampled = src_bitmap->resampled_front(size.GetWidth(), size.GetHeight());
+        wxImage image(size.GetWidth(), size.GetHeight(), resampled.data(), true);
+        staticBitmap->SetBitmap(wxBitmap(image));
+    }
+
+    void ShowFrame() {
+        auto start = std::chrono::steady_clock::now();
+        ShowFront();
+        double display_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        int zeros = 0, poles = 0;
+        for(const auto& root : src_bitmap->roots())
+            (root.order > 0 ? zeros : poles) += std::abs(root.order);
 
+        SetStatusText(wxString::Format("frame %lu: render %.1f ms (focus %.1f ms, %.0f%% samples reused, %.0f%% tiles interpolated, %d zeros and %d poles in %.1f ms), display %.1f ms, parse cache hits %.0f%%",
+                                       src_bitmap->frame_count(), src_bitmap->last_frame_ms(), src_bitmap->last_focus_ms(), 100 * src_bitmap->reused_fraction(), 100 * src_bitmap->culled_fraction(),
+                                       zeros, poles, src_bitmap->last_roots_ms(), display_ms,
+                                       100 * ComplexPlot::expression_cache().stats().hit_rate()));
     }
 };
 
@@ -0,0 +1,453 @@
+#include "render_server.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static constexpr std::size_t max_request_bytes = 8192;
+static constexpr std::size_t latency_window = 4096;
+static constexpr int max_dimension = 4096;
+
+static const char* status_text(int status)
+{
+    switch(status)
+    {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 503: return "Service Unavailable";
+        default: return "Internal Server Error";
+    }
+}
+
+static std::string percent_decode(const std::string& s)
+{
+    std::string out;
+    for(std::size_t i = 0; i < s.size(); ++i)
+    {
+        if(s[i] == '%' && i + 2 < s.size() && std::isxdigit((unsigned char)s[i + 1]) && std::isxdigit((unsigned char)s[i + 2]))
+        {
+            out.push_back((char)std::stoi(s.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        }
+        else
+            out.push_back(s[i]);
+    }
+    return out;
+}
+
+static std::unordered_map<std::string, std::string> parse_query(const std::string& query)
+{
+    std::unordered_map<std::string, std::string> params;
+    std::size_t pos = 0;
+    while(pos <= query.size())
+    {
+        std::size_t end = std::min(query.find('&', pos), query.size());
+        std::string pair = query.substr(pos, end - pos);
+        std::size_t eq = pair.find('=');
+        if(!pair.empty())
+            params[percent_decode(pair.substr(0, eq))] = eq == std::string::npos ? "" : percent_decode(pair.substr(eq + 1));
+        pos = end + 1;
+    }
+    return params;
+}
+
+static double number_param(const std::unordered_map<std::string, std::string>& query, const std::string& name, double fallback)
+{
+    auto it = query.find(name);
+    if(it == query.end()) return fallback;
+
+    char* end;
+    double v = std::strtod(it->second.c_str(), &end);
+    if(end == it->second.c_str() || *end || !std::isfinite(v))
+        throw std::invalid_argument("Bad value for " + name);
+    return v;
+}
+
+static bool send_all(int fd, const void* data, std::size_t size)
+{
+    const char* p = (const char*)data;
+    while(size)
+    {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static void send_response(int fd, int status, const std::string& content_type, const std::vector<unsigned char>& body, const std::string& extra_headers)
+{
+    std::string head = "HTTP/1.0 " + std::to_string(status) + " " + status_text(status) + "\r\n"
+                       "Content-Type: " + content_type + "\r\n"
+                       "Content-Length: " + std::to_string(body.size()) + "\r\n" + extra_headers +
+                       "Connection: close\r\n\r\n";
+    if(send_all(fd, head.data(), head.size()))
+        send_all(fd, body.data(), body.size());
+}
+
+static std::shared_ptr<const std::vector<unsigned char>> text_body(const std::string& text)
+{
+    return std::make_shared<const std::vector<unsigned char>>(text.begin(), text.end());
+}
+
+ComplexPlot::RenderServer::RenderServer(ServerOptions options) : options(std::move(options))
+{
+    if(this->options.workers == 0) this->options.workers = 1;
+    latencies.reserve(latency_window);
+
+    if(!this->options.unix_path.empty())
+    {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if(this->options.unix_path.size() >= sizeof(addr.sun_path))
+            throw std::runtime_error("Socket path too long: " + this->options.unix_path);
+        std::strcpy(addr.sun_path, this->options.unix_path.c_str());
+
+        //a socket left by an earlier run refuses connections and can go, one still answering belongs to a live daemon
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(probe >= 0)
+        {
+            bool live = connect(probe, (sockaddr*)&addr, sizeof(addr)) == 0;
+            bool stale = !live && errno == ECONNREFUSED;
+            close(probe);
+            if(live)
+                throw std::runtime_error("Another server is listening on " + this->options.unix_path);
+            if(stale)
+                unlink(addr.sun_path);
+        }
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            if(listen_fd >= 0) close(listen_fd);
+            throw std::runtime_error("Could not bind " + this->options.unix_path);
+        }
+    }
+    else
+    {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK); //local tools only
+        addr.sin_port = htons(this->options.port);
+
+        listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int yes = 1;
+        if(listen_fd >= 0)
+            setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if(listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0)
+        {
+            if(listen_fd >= 0) close(listen_fd);
+            throw std::runtime_error("Could not bind 127.0.0.1:" + std::to_string(this->options.port));
+        }
+
+        socklen_t len = sizeof(addr);
+        getsockname(listen_fd, (sockaddr*)&addr, &len);
+        bound_port = ntohs(addr.sin_port);
+    }
+
+    if(listen(listen_fd, 128) != 0 || pipe2(wake_pipe, O_CLOEXEC) != 0)
+    {
+        close(listen_fd);
+        throw std::runtime_error("Could not listen");
+    }
+}
+
+ComplexPlot::RenderServer::~RenderServer()
+{
+    stop();
+    for(auto& t : workers)
+        if(t.joinable()) t.join();
+
+    close(listen_fd);
+    close(wake_pipe[0]);
+    close(wake_pipe[1]);
+    if(!options.unix_path.empty())
+        unlink(options.unix_path.c_str());
+}
+
+void ComplexPlot::RenderServer::stop()
+{
+    stopping = true;
+    char byte = 0;
+    ssize_t ignored = write(wake_pipe[1], &byte, 1);
+    (void)ignored;
+}
+
+void ComplexPlot::RenderServer::run()
+{
+    for(unsigned int i = 0; i < options.workers; ++i)
+        workers.emplace_back([this](){ worker_loop(); });
+
+    pollfd fds[2] = {{listen_fd, POLLIN, 0}, {wake_pipe[0], POLLIN, 0}};
+    while(!stopping)
+    {
+        if(poll(fds, 2, -1) < 0)
+        {
+            if(errno == EINTR) continue;
+            break;
+        }
+        if(fds[1].revents) break;
+        if(!(fds[0].revents & POLLIN)) continue;
+
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if(fd < 0) continue;
+        auto accepted = std::chrono::steady_clock::now();
+
+        timeval timeout = {5, 0}; //a stalled client must not hold a worker
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        if(queue.size() >= options.queue_limit)
+        {
+            //backpressure: refuse straight away rather than let latency grow without bound
+            lock.unlock();
+            send_response(fd, 503, "text/plain", *text_body("render queue full\n"), "Retry-After: 1\r\n");
+            close(fd);
+            std::lock_guard<std::mutex> stats_lock(stats_mutex);
+            counters.rejected++;
+            continue;
+        }
+        queue.push_back({fd, accepted});
+        lock.unlock();
+        queue_ready.notify_one();
+    }
+
+    stopping = true;
+    queue_ready.notify_all();
+    for(auto& t : workers)
+        t.join();
+    workers.clear();
+
+    //refuse whatever was still waiting
+    for(auto& c : queue)
+        close(c.fd);
+    queue.clear();
+}
+
+void ComplexPlot::RenderServer::worker_loop()
+{
+    BitMap bitmap(256, 256); //reused across requests, so steady state rendering allocates nothing
+
+    while(true)
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        queue_ready.wait(lock, [this](){ return stopping || !queue.empty(); });
+        if(stopping) return;
+
+        Connection connection = queue.front();
+        queue.pop_front();
+        lock.unlock();
+
+        serve(connection, bitmap);
+    }
+}
+
+void ComplexPlot::RenderServer::serve(Connection connection, BitMap& bitmap)
+{
+    std::string request;
+    char buffer[1024];
+    while(request.find("\r\n\r\n") == std::string::npos && request.size() < max_request_bytes)
+    {
+        ssize_t n = recv(connection.fd, buffer, sizeof(buffer), 0);
+        if(n <= 0) break;
+        request.append(buffer, n);
+    }
+
+    Response response;
+    std::size_t line_end = request.find("\r\n");
+    std::string line = request.substr(0, line_end);
+    std::size_t sp1 = line.find(' '), sp2 = line.rfind(' ');
+
+    if(line_end == std::string::npos || sp1 == std::string::npos || sp1 == sp2 || line.compare(0, sp1, "GET") != 0)
+        response = {400, "text/plain", text_body("expected GET <path> HTTP/1.x\n"), ""};
+    else
+    {
+        try
+        {
+            response = handle(line.substr(sp1 + 1, sp2 - sp1 - 1), bitmap);
+        }
+        catch(std::invalid_argument& e)
+        {
+            response = {400, "text/plain", text_body(std::string(e.what()) + "\n"), ""};
+        }
+        catch(std::exception& e)
+        {
+            response = {500, "text/plain", text_body(std::string(e.what()) + "\n"), ""};
+        }
+    }
+
+    send_response(connection.fd, response.status, response.content_type, *response.body, response.extra_headers);
+    close(connection.fd);
+
+    record(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - connection.accepted).count(),
+           response.status != 200, response.cached);
+}
+
+ComplexPlot::RenderServer::Response ComplexPlot::RenderServer::handle(const std::string& target, BitMap& bitmap)
+{
+    std::size_t q = target.find('?');
+    std::string path = target.substr(0, q);
+    auto query = parse_query(q == std::string::npos ? "" : target.substr(q + 1));
+
+    if(path == "/render")
+        return render(query, bitmap);
+
+    if(path == "/stats")
+    {
+        ServerStats s = stats();
+        char json[512];
+        std::snprintf(json, sizeof(json),
+                      "{\"requests\": %lu, \"rejected\": %lu, \"errors\": %lu, \"cache_hits\": %lu, \"queued\": %zu, "
+                      "\"cached_bytes\": %zu, \"p50_ms\": %.3f, \"p99_ms\": %.3f}\n",
+                      s.requests, s.rejected, s.errors, s.cache_hits, s.queued, s.cached_bytes, s.p50_ms, s.p99_ms);
+        return {200, "application/json", text_body(json), ""};
+    }
+
+    return {404, "text/plain", text_body("unknown path " + path + ", try /render or /stats\n"), ""};
+}
+
+ComplexPlot::RenderServer::Response ComplexPlot::RenderServer::render(const std::unordered_map<std::string, std::string>& query, BitMap& bitmap)
+{
+    auto expr_it = query.find("expr");
+    if(expr_it == query.end() || expr_it->second.empty())
+        throw std::invalid_argument("Missing expr");
+
+    double size = number_param(query, "size", 256);
+    double width = number_param(query, "w", size), height = number_param(query, "h", size);
+    if(!(width >= 1 && height >= 1 && width < max_dimension + 1 && height < max_dimension + 1)) //before converting, out of range is undefined
+        throw std::invalid_argument("Image size must be 1 to " + std::to_string(max_dimension));
+    int w = (int)width, h = (int)height;
+
+    Viewport view{{number_param(query, "re", 0), number_param(query, "im", 0)}, number_param(query, "extent", 10)};
+    bool grid = number_param(query, "grid", 1) != 0;
+
+    auto format_it = query.find("format");
+    std::string format_name = format_it == query.end() ? "png" : format_it->second;
+    ImageFormat format = format_from_extension("." + format_name);
+    if(format == ImageFormat::JPEG && format_name != "jpeg" && format_name != "jpg")
+        throw std::invalid_argument("Unknown format " + format_name);
+
+    JpegOptions jpeg;
+    jpeg.quality = (int)std::clamp(number_param(query, "quality", 90), 1.0, 100.0); //the range the encoder clamps to anyway
+
+    //canonical key: normalized expression, then every parameter that affects the bytes
+    std::string key = Parsing::ExpressionCache<std::complex<double>>::normalize(expr_it->second);
+    char params[256];
+    std::snprintf(params, sizeof(params), "|%a|%a|%a|%d|%d|%d|%s|%d", view.centre.real(), view.centre.imag(), view.extent, w, h, grid,
+                  format_name.c_str(), jpeg.quality);
+    key += params;
+
+    bitmap.clear_variables();
+    std::vector<std::pair<std::string, std::string>> vars(query.begin(), query.end());
+    std::sort(vars.begin(), vars.end()); //so the key doesn't depend on parameter order
+    for(auto& [name, value] : vars)
+    {
+        if(name.size() != 5 || name.compare(0, 4, "var_") != 0) continue;
+
+        double re = 0, im = 0;
+        if(std::sscanf(value.c_str(), "%lf,%lf", &re, &im) < 1)
+            throw std::invalid_argument("Bad value for " + name);
+        bitmap.set_variable(name[4], {re, im});
+        key += "|" + name + "=" + value;
+    }
+
+    const char* content_type = format == ImageFormat::JPEG ? "image/jpeg" : format == ImageFormat::PNG ? "image/png"
+                             : format == ImageFormat::PPM ? "image/x-portable-pixmap" : "application/octet-stream";
+    std::string size_header = "X-Image-Size: " + std::to_string(w) + "x" + std::to_string(h) + "\r\n";
+
+    if(auto hit = cache_find(key))
+        return {200, content_type, hit, size_header + "X-Cache: hit\r\n", true};
+
+    bitmap.resize(w, h);
+    bitmap.plot_complex_func(expr_it->second, view, grid, options.render_threads);
+    auto body = std::make_shared<const std::vector<unsigned char>>(bitmap.encode(format, jpeg));
+    cache_insert(key, body);
+
+    char timing[64];
+    std::snprintf(timing, sizeof(timing), "X-Render-Ms: %.3f\r\n", bitmap.last_frame_ms());
+    return {200, content_type, body, size_header + "X-Cache: miss\r\n" + timing, false};
+}
+
+std::shared_ptr<const std::vector<unsigned char>> ComplexPlot::RenderServer::cache_find(const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    auto it = cache.find(key);
+    if(it == cache.end()) return nullptr;
+
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->second;
+}
+
+void ComplexPlot::RenderServer::cache_insert(const std::string& key, std::shared_ptr<const std::vector<unsigned char>> body)
+{
+    if(body->size() > options.cache_bytes) return;
+
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    if(cache.count(key)) return; //another worker rendered the same request meanwhile
+
+    lru.emplace_front(key, body);
+    cache[key] = lru.begin();
+    cached_bytes += body->size();
+
+    while(cached_bytes > options.cache_bytes)
+    {
+        cached_bytes -= lru.back().second->size();
+        cache.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+void ComplexPlot::RenderServer::record(double latency_ms, bool error, bool hit)
+{
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    counters.requests++;
+    counters.errors += error;
+    counters.cache_hits += hit;
+
+    if(latencies.size() < latency_window)
+        latencies.push_back(latency_ms);
+    else
+        latencies[next_latency] = latency_ms;
+    next_latency = (next_latency + 1) % latency_window;
+}
+
+ComplexPlot::ServerStats ComplexPlot::RenderServer::stats()
+{
+    ServerStats s;
+    std::vector<double> sorted;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        s = counters;
+        sorted = latencies;
+    }
+    {
+        std::lock_guard<std::mutex> lock(queue_mutex);
+        s.queued = queue.size();
+    }
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex);
+        s.cached_bytes = cached_bytes;
+    }
+
+    if(!sorted.empty())
+    {
+        std::sort(sorted.begin(), sorted.end());
+        s.p50_ms = sorted[sorted.size() / 2];
+        s.p99_ms = sorted[std::min(sorted.size() - 1, sorted.size() * 99 / 100)];
+    }
+    return s;
+}
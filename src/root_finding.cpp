@@ -0,0 +1,242 @@
+#include "root_finding.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+namespace
+{
+    using Complex = std::complex<double>;
+    using Expr = Parsing::Expression<Complex>;
+
+    constexpr double max_turn = 1.0;   //radians arg f may turn between neighbouring samples before the step is split
+    constexpr int max_splits = 10;
+    constexpr int edge_samples = 4;    //per side of a cell below block size, the rate test adds more where needed
+    constexpr int max_depth = 12;      //a 32 pixel block reaches a quarter pixel in 7
+    constexpr int newton_iterations = 50;
+
+    bool usable(Complex v) { return std::isfinite(v.real()) && std::isfinite(v.imag()) && v != Complex(0); }
+
+    //a point of a contour, rate is |f'/f| where the derivative is known: how fast arg f turns per plane unit
+    struct Sample
+    {
+        Complex z, f;
+        double rate;
+    };
+
+    //the work for one thread, with its own variable table
+    class Locator
+    {
+    public:
+        Locator(const Expr& f, const Expr::VarTable& vars, const ComplexPlot::SampledField& field)
+            : f(f), vars(vars), field(field), pixel(1 / field.pixel_per_int) {}
+
+        //roots inside the block of pixels between rows r0..r1 and columns c0..c1, edges included
+        void block(int r0, int r1, int c0, int c1, std::vector<ComplexPlot::Root>& out)
+        {
+            //counterclockwise in the plane, rows grow downwards
+            contour.clear();
+            for(int c = c0; c < c1; c++) contour.push_back(sample(r1, c));
+            for(int r = r1; r > r0; r--) contour.push_back(sample(r, c1));
+            for(int c = c1; c > c0; c--) contour.push_back(sample(r0, c));
+            for(int r = r0; r < r1; r++) contour.push_back(sample(r, c0));
+
+            //the stored samples have no f', estimate how fast f turns from the relative change to either neighbour.
+            //a multiple root just off the contour shows up as a dip or spike in |f| over three samples
+            std::size_t n = contour.size();
+            for(std::size_t i = 0; i < n; i++)
+            {
+                Sample& s = contour[i];
+                const Sample& before = contour[(i + n - 1) % n];
+                const Sample& after = contour[(i + 1) % n];
+                s.rate = std::max(std::abs(s.f - before.f) / std::abs(s.z - before.z), std::abs(after.f - s.f) / std::abs(after.z - s.z)) / std::abs(s.f);
+            }
+
+            double sum = 0;
+            for(std::size_t i = 0; i < n; i++)
+                sum += turn(contour[i], contour[(i + 1) % n], 0);
+
+            int w = winding(sum);
+            if(w != 0)
+            {
+                Complex low = field.position(r1, c0), high = field.position(r0, c1);
+                subdivide(low.real(), high.real(), low.imag(), high.imag(), w, 0, out);
+            }
+        }
+
+    private:
+        const Expr& f;
+        Expr::VarTable vars;
+        const ComplexPlot::SampledField& field;
+        double pixel; //plane units
+        std::vector<Sample> contour;
+
+        static int winding(double turned)
+        {
+            double w = turned / (2 * M_PI);
+            return std::isfinite(w) ? (int)std::lround(w) : 0;
+        }
+
+        //f at z, stepped slightly off exact zeros and poles so arg f is defined. the same z always gives the same
+        //value, so neighbouring cells see the same contour along their shared edge. with_rate also takes f'
+        Sample value(Complex z, bool with_rate)
+        {
+            Sample s = {z, 0, 0};
+            for(int k = 0; k < 4; k++)
+            {
+                vars['z'] = s.z;
+                if(with_rate)
+                {
+                    auto [v, dv] = f.evaluate_with_derivative(vars);
+                    s.f = v;
+                    s.rate = std::abs(dv / v); //NaN when f isn't holomorphic, which leaves only the turn test
+                }
+                else
+                    s.f = f.evaluate_table(vars);
+                if(usable(s.f)) break;
+                s.z += Complex(0.0137, 0.0071) * pixel;
+            }
+            return s;
+        }
+
+        Sample sample(int row, int col)
+        {
+            Complex v = field.values[(std::size_t)row * field.width + col];
+            return usable(v) ? Sample{field.position(row, col), v, 0} : value(field.position(row, col), false);
+        }
+
+        //change in arg f from a to b, split where f turns too fast for the samples to be trusted. a turn by more than
+        //2pi - max_turn looks small once wrapped, which only the rate catches: near a root of order m, rate is m / distance
+        double turn(const Sample& a, const Sample& b, int splits)
+        {
+            //a root exactly on the segment turns f by pi either way. take the same way whichever end the segment is
+            //walked from, so the cells on both sides still add up
+            double d = std::arg(b.f) - std::arg(a.f);
+            if(d > M_PI) d -= 2 * M_PI;
+            else if(d < -M_PI) d += 2 * M_PI;
+            if(std::abs(d) == M_PI)
+                d = std::make_pair(a.z.real(), a.z.imag()) < std::make_pair(b.z.real(), b.z.imag()) ? M_PI : -M_PI;
+
+            double h = std::abs(b.z - a.z);
+            bool unresolved = std::abs(d) > max_turn || a.rate * h > max_turn || b.rate * h > max_turn;
+            if(unresolved && splits < max_splits)
+            {
+                Sample m = value(0.5 * (a.z + b.z), a.rate > 0 || b.rate > 0);
+                return turn(a, m, splits + 1) + turn(m, b, splits + 1);
+            }
+            return d;
+        }
+
+        int cell_winding(double x0, double x1, double y0, double y1)
+        {
+            const Complex corner[5] = {{x0, y0}, {x1, y0}, {x1, y1}, {x0, y1}, {x0, y0}};
+            double sum = 0;
+            Sample a = value(corner[0], true);
+            for(int side = 0; side < 4; side++)
+                for(int k = 1; k <= edge_samples; k++)
+                {
+                    Sample b = value(corner[side] + (corner[side + 1] - corner[side]) * (double(k) / edge_samples), true);
+                    sum += turn(a, b, 0);
+                    a = b;
+                }
+            return winding(sum);
+        }
+
+        //split off centre, so roots on lines of symmetry of the view don't sit on the cut
+        void subdivide(double x0, double x1, double y0, double y1, int w, int depth, std::vector<ComplexPlot::Root>& out)
+        {
+            if((x1 - x0 < 0.25 * pixel && y1 - y0 < 0.25 * pixel) || depth == max_depth)
+            {
+                out.push_back(polish({0.5 * (x0 + x1), 0.5 * (y0 + y1)}, w));
+                return;
+            }
+
+            double xs = x0 + 0.4937 * (x1 - x0), ys = y0 + 0.5063 * (y1 - y0);
+            const double cells[4][4] = {{x0, xs, y0, ys}, {xs, x1, y0, ys}, {x0, xs, ys, y1}, {xs, x1, ys, y1}};
+            bool found = false;
+            for(auto& c : cells)
+            {
+                int cw = cell_winding(c[0], c[1], c[2], c[3]);
+                if(cw == 0) continue;
+                subdivide(c[0], c[1], c[2], c[3], cw, depth + 1, out);
+                found = true;
+            }
+            if(!found) //the winding split into parts that cancel at this scale
+                out.push_back(polish({0.5 * (x0 + x1), 0.5 * (y0 + y1)}, w));
+        }
+
+        //newton for a root of multiplicity m: z - m f/f' converges quadratically on a zero, z + m f/f' on a pole.
+        //gives up, keeping the cell centre, when f isn't holomorphic or the iteration leaves the cell's pixel
+        ComplexPlot::Root polish(Complex start, int order)
+        {
+            double m = std::abs(order);
+            Complex z = start;
+            for(int i = 0; i < newton_iterations; i++)
+            {
+                vars['z'] = z;
+                auto [v, dv] = f.evaluate_with_derivative(vars);
+                if(order < 0 && !std::isfinite(std::abs(v))) return {z, order, true}; //landed on the pole
+                if(order > 0 && v == Complex(0)) return {z, order, true};
+
+                Complex step = m * v / dv;
+                if(!std::isfinite(step.real()) || !std::isfinite(step.imag()))
+                    break;
+                z = order > 0 ? z - step : z + step;
+                if(std::abs(z - start) > 2 * pixel)
+                    break;
+                if(std::abs(step) < 1e-6 * pixel || std::abs(step) <= 4e-16 * std::abs(z))
+                    return {z, order, true};
+            }
+            return {start, order, false};
+        }
+    };
+}
+
+std::vector<ComplexPlot::Root> ComplexPlot::locate_roots(const Expr& f, const Expr::VarTable& vars, const SampledField& field,
+                                                         int cell, unsigned int nthreads)
+{
+    std::vector<Root> roots;
+    if(field.width < 2 || field.height < 2 || cell < 1) return roots;
+
+    //blocks share their edges, so together they cover every pixel centre of the frame
+    int blocks_x = (field.width - 2) / cell + 1, blocks_y = (field.height - 2) / cell + 1;
+    int blocks = blocks_x * blocks_y;
+    nthreads = std::max(1u, std::min({nthreads, std::thread::hardware_concurrency(), (unsigned)blocks}));
+
+    std::atomic<int> next{0};
+    std::vector<std::vector<Root>> found(nthreads);
+    std::vector<std::thread> threads;
+    for(unsigned int i = 0; i < nthreads; i++)
+        threads.emplace_back([&, i]()
+        {
+            Locator locator(f, vars, field);
+            for(int b; (b = next++) < blocks;)
+            {
+                int r0 = (b / blocks_x) * cell, c0 = (b % blocks_x) * cell;
+                locator.block(r0, std::min(r0 + cell, field.height - 1), c0, std::min(c0 + cell, field.width - 1), found[i]);
+            }
+        });
+    for(auto& t : threads)
+        t.join();
+
+    for(auto& part : found)
+        roots.insert(roots.end(), part.begin(), part.end());
+    std::sort(roots.begin(), roots.end(), [](const Root& a, const Root& b)
+    {
+        return a.z.real() != b.z.real() ? a.z.real() < b.z.real() : a.z.imag() < b.z.imag();
+    });
+
+    //a multiple root on the edge between blocks can have its winding split between them, and both parts converge on it
+    std::vector<Root> merged;
+    for(const Root& root : roots)
+    {
+        auto same = std::find_if(merged.begin(), merged.end(), [&](const Root& m)
+        {
+            return m.refined && root.refined && (m.order > 0) == (root.order > 0) && std::abs(m.z - root.z) < 0.01 / field.pixel_per_int;
+        });
+        if(same != merged.end()) same->order += root.order;
+        else merged.push_back(root);
+    }
+    return merged;
+}
@@ -0,0 +1,419 @@
+#include "tile_farm.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+//every message is a type and a payload length, both 32 bit big endian, then the payload.
+//integers in payloads are 32 bit big endian, doubles travel as %a text so they arrive bit exact
+enum MessageType : uint32_t
+{
+    JobMessage = 1,    //coordinator to worker: job id, viewport, size, grid, variables, expression
+    TileMessage = 2,   //coordinator to worker: job id, col, row, width, height
+    ResultMessage = 3, //worker to coordinator: the tile message's fields then packed RGB rows
+    ErrorMessage = 4   //worker to coordinator: job id then why it can't be rendered, sent once per job
+};
+
+static constexpr uint32_t max_payload = 64u << 20;
+
+static bool write_full(int fd, const void* data, std::size_t size)
+{
+    const char* p = (const char*)data;
+    while(size)
+    {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool read_full(int fd, void* data, std::size_t size)
+{
+    char* p = (char*)data;
+    while(size)
+    {
+        ssize_t n = recv(fd, p, size, 0);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+static void put_u32(std::string& out, uint32_t v)
+{
+    v = htonl(v);
+    out.append((const char*)&v, 4);
+}
+
+static uint32_t get_u32(const unsigned char* p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return ntohl(v);
+}
+
+static bool send_message(int fd, uint32_t type, const std::string& payload)
+{
+    std::string head;
+    put_u32(head, type);
+    put_u32(head, payload.size());
+    return write_full(fd, head.data(), head.size()) && write_full(fd, payload.data(), payload.size());
+}
+
+static bool read_message(int fd, uint32_t& type, std::vector<unsigned char>& payload)
+{
+    unsigned char head[8];
+    if(!read_full(fd, head, 8)) return false;
+
+    type = get_u32(head);
+    uint32_t size = get_u32(head + 4);
+    if(size > max_payload) return false;
+
+    payload.resize(size);
+    return read_full(fd, payload.data(), size);
+}
+
+ComplexPlot::TileCoordinator::TileCoordinator(int port, const std::string& bind_address)
+{
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(inet_pton(AF_INET, bind_address.c_str(), &addr.sin_addr) != 1)
+        throw std::runtime_error("Bad bind address " + bind_address);
+
+    listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int yes = 1;
+    if(listen_fd >= 0)
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    if(listen_fd < 0 || bind(listen_fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 64) != 0)
+    {
+        if(listen_fd >= 0) close(listen_fd);
+        throw std::runtime_error("Could not listen on " + bind_address + ":" + std::to_string(port));
+    }
+
+    socklen_t len = sizeof(addr);
+    getsockname(listen_fd, (sockaddr*)&addr, &len);
+    bound_port = ntohs(addr.sin_port);
+}
+
+ComplexPlot::TileCoordinator::~TileCoordinator()
+{
+    for(auto& p : peers)
+        close(p.fd); //workers exit when they see the connection close
+    close(listen_fd);
+}
+
+void ComplexPlot::TileCoordinator::accept_workers()
+{
+    while(true)
+    {
+        pollfd pfd = {listen_fd, POLLIN, 0};
+        if(poll(&pfd, 1, 0) <= 0) return;
+
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if(fd < 0) return;
+
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        timeval timeout = {10, 0}; //a worker that stops halfway through a message counts as dead
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        peers.push_back({fd});
+    }
+}
+
+bool ComplexPlot::TileCoordinator::wait_for_workers(std::size_t n, int timeout_ms)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while(peers.size() < n)
+    {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if(left <= 0) return false;
+
+        pollfd pfd = {listen_fd, POLLIN, 0};
+        if(poll(&pfd, 1, left) > 0)
+            accept_workers();
+    }
+    return true;
+}
+
+void ComplexPlot::TileCoordinator::drop(std::size_t index, std::vector<Tile>& pending, FarmStats& stats)
+{
+    Peer& p = peers[index];
+    stats.retried += p.in_flight.size();
+    stats.workers_lost++;
+    pending.insert(pending.end(), p.in_flight.begin(), p.in_flight.end()); //pending is popped from the back
+
+    close(p.fd);
+    peers.erase(peers.begin() + index);
+}
+
+ComplexPlot::FarmStats ComplexPlot::TileCoordinator::render(const FarmJob& job, const TileSink& sink)
+{
+    if(!(job.view.extent > 0)) throw std::invalid_argument("Viewport extent must be positive");
+    if(job.width < 1 || job.height < 1) throw std::invalid_argument("Image size must be positive");
+    if(job.tile < 32 || job.tile % 32) throw std::invalid_argument("Tile size must be a multiple of 32");
+
+    auto start = std::chrono::steady_clock::now();
+    FarmStats stats;
+    job_id++;
+
+    char numbers[256];
+    std::snprintf(numbers, sizeof(numbers), "%a %a %a %d %d %d %zu\n", job.view.centre.real(), job.view.centre.imag(), job.view.extent,
+                  job.width, job.height, (int)job.grid, job.variables.size());
+    std::string job_payload;
+    put_u32(job_payload, job_id);
+    job_payload += numbers;
+    for(auto& [name, value] : job.variables)
+    {
+        std::snprintf(numbers, sizeof(numbers), "%c %a %a\n", name, value.real(), value.imag());
+        job_payload += numbers;
+    }
+    job_payload += job.expr;
+
+    //the back of pending goes out first, so push the top rows last
+    std::vector<Tile> pending;
+    for(int row = (job.height - 1) / job.tile * job.tile; row >= 0; row -= job.tile)
+        for(int col = (job.width - 1) / job.tile * job.tile; col >= 0; col -= job.tile)
+            pending.push_back({col, row, std::min(job.tile, job.width - col), std::min(job.tile, job.height - row), {}});
+    std::size_t remaining = pending.size();
+    stats.tiles = remaining;
+
+    auto alone_since = std::chrono::steady_clock::now();
+    std::vector<unsigned char> payload;
+    std::vector<pollfd> fds;
+
+    while(remaining)
+    {
+        accept_workers();
+        auto now = std::chrono::steady_clock::now();
+
+        if(peers.empty())
+        {
+            if(now - alone_since > std::chrono::milliseconds(no_worker_timeout_ms))
+                throw std::runtime_error("No workers connected, " + std::to_string(remaining) + " tiles left");
+        }
+        else
+            alone_since = now;
+
+        for(std::size_t i = 0; i < peers.size(); ++i)
+        {
+            Peer& p = peers[i];
+            bool ok = true;
+            if(p.job != job_id)
+            {
+                ok = send_message(p.fd, JobMessage, job_payload);
+                p.job = job_id;
+                p.in_flight.clear();
+                p.slot = -1;
+            }
+
+            while(ok && (int)p.in_flight.size() < tiles_in_flight && !pending.empty())
+            {
+                Tile t = pending.back();
+                t.sent = now;
+                std::string msg;
+                for(uint32_t v : {(uint32_t)job_id, (uint32_t)t.col, (uint32_t)t.row, (uint32_t)t.width, (uint32_t)t.height})
+                    put_u32(msg, v);
+                if(!(ok = send_message(p.fd, TileMessage, msg))) break;
+                pending.pop_back();
+                p.in_flight.push_back(t);
+            }
+
+            bool stalled = !p.in_flight.empty() && now - p.in_flight.front().sent > std::chrono::milliseconds(tile_timeout_ms);
+            if(!ok || stalled)
+                drop(i--, pending, stats);
+        }
+
+        fds.assign(1, {listen_fd, POLLIN, 0});
+        for(auto& p : peers)
+            fds.push_back({p.fd, POLLIN, 0});
+        if(poll(fds.data(), fds.size(), 200) <= 0) continue;
+
+        //walk backwards so dropping a peer doesn't shift the ones still to be checked
+        for(std::size_t k = fds.size() - 1; k >= 1; --k)
+        {
+            if(!fds[k].revents) continue;
+            std::size_t i = k - 1;
+            Peer& p = peers[i];
+
+            uint32_t type;
+            if(!read_message(p.fd, type, payload))
+            {
+                drop(i, pending, stats);
+                continue;
+            }
+
+            if(type == ErrorMessage && payload.size() >= 4 && get_u32(payload.data()) == job_id)
+            {
+                //every worker would say the same, forget the job everywhere so stale tiles are ignored
+                for(auto& q : peers)
+                    q.in_flight.clear();
+                throw std::invalid_argument(std::string(payload.begin() + 4, payload.end()));
+            }
+            if(type != ResultMessage || payload.size() < 20 || get_u32(payload.data()) != job_id)
+                continue; //a late answer from an earlier job
+
+            int col = get_u32(payload.data() + 4), row = get_u32(payload.data() + 8);
+            auto it = std::find_if(p.in_flight.begin(), p.in_flight.end(), [&](const Tile& t) { return t.col == col && t.row == row; });
+            if(it == p.in_flight.end() || payload.size() != 20 + 3 * (std::size_t)it->width * it->height)
+            {
+                drop(i, pending, stats);
+                continue;
+            }
+
+            if(p.slot < 0)
+            {
+                p.slot = stats.tiles_per_worker.size();
+                stats.tiles_per_worker.push_back(0);
+            }
+            stats.tiles_per_worker[p.slot]++;
+
+            sink(it->col, it->row, it->width, it->height, payload.data() + 20);
+            p.in_flight.erase(it);
+            remaining--;
+        }
+    }
+
+    stats.workers_used = stats.tiles_per_worker.size();
+    stats.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    return stats;
+}
+
+static int connect_to(const std::string& host, int port, int timeout_ms)
+{
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    addrinfo hints{}, *found = nullptr;
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &found) != 0 || !found)
+        throw std::runtime_error("Unknown host " + host);
+
+    while(true)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd >= 0 && connect(fd, found->ai_addr, found->ai_addrlen) == 0)
+        {
+            freeaddrinfo(found);
+            int yes = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+            return fd;
+        }
+        if(fd >= 0) close(fd);
+
+        if(std::chrono::steady_clock::now() > deadline)
+        {
+            freeaddrinfo(found);
+            throw std::runtime_error("Could not connect to " + host + ":" + std::to_string(port));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+}
+
+unsigned long ComplexPlot::run_tile_worker(const std::string& host, int port, unsigned int threads, int connect_timeout_ms)
+{
+    int fd = connect_to(host, port, connect_timeout_ms);
+
+    BitMap bitmap(256, 256);
+    uint32_t job = 0;
+    Viewport view;
+    int full_width = 0, full_height = 0, grid = 1;
+    std::string expr, error;
+    bool reported = false; //the error has been sent for this job, its other tiles go unanswered
+    unsigned long rendered = 0;
+
+    uint32_t type;
+    std::vector<unsigned char> payload;
+    while(read_message(fd, type, payload))
+    {
+        if(type == JobMessage && payload.size() >= 4)
+        {
+            job = get_u32(payload.data());
+            std::string text(payload.begin() + 4, payload.end());
+            double re, im;
+            std::size_t nvars = 0;
+            int used = 0;
+            error.clear();
+            reported = false;
+            bitmap.clear_variables();
+
+            const char* p = text.c_str();
+            if(std::sscanf(p, "%la %la %la %d %d %d %zu\n%n", &re, &im, &view.extent, &full_width, &full_height, &grid, &nvars, &used) < 7)
+            {
+                error = "Malformed job";
+                continue;
+            }
+            view.centre = {re, im};
+            p += used;
+
+            try
+            {
+                for(std::size_t k = 0; k < nvars; ++k)
+                {
+                    char name;
+                    if(std::sscanf(p, "%c %la %la\n%n", &name, &re, &im, &used) < 3)
+                        throw std::invalid_argument("Malformed job");
+                    bitmap.set_variable(name, {re, im});
+                    p += used;
+                }
+                expr = p;
+            }
+            catch(std::invalid_argument& e)
+            {
+                error = e.what();
+            }
+        }
+        else if(type == TileMessage && payload.size() == 20 && get_u32(payload.data()) == job)
+        {
+            int col = get_u32(payload.data() + 4), row = get_u32(payload.data() + 8);
+            int w = get_u32(payload.data() + 12), h = get_u32(payload.data() + 16);
+
+            if(error.empty())
+            {
+                try
+                {
+                    bitmap.resize(w, h);
+                    bitmap.plot_complex_region(expr, view, full_width, full_height, col, row, grid, threads);
+                }
+                catch(std::invalid_argument& e)
+                {
+                    error = e.what();
+                }
+            }
+            if(!error.empty())
+            {
+                if(reported) continue;
+                std::string message;
+                put_u32(message, job);
+                if(!send_message(fd, ErrorMessage, message + error)) break;
+                reported = true;
+                continue;
+            }
+
+            auto front = bitmap.acquire_front();
+            std::string result(payload.begin(), payload.end());
+            result.append((const char*)front.data, 3 * (std::size_t)front.width * front.height);
+            if(!send_message(fd, ResultMessage, result)) break;
+            rendered++;
+        }
+    }
+
+    close(fd);
+    return rendered;
+}
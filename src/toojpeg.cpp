@@ -149,7 +149,8 @@ struct BitWriter
   void flush()
   {
     // at most seven set bits needed to "fill" the last byte: 0x7F = binary 0111 1111
-    *this << BitCode(0x7F, 7); // I should set buffer.numBits = 0 but since there are no single bits written after flush() I can safely ignore it
+    *this << BitCode(0x7F, 7);
+    buffer.numBits = 0; // progressive JPEGs have several scans, each one starts byte-aligned
   }
 
   // NOTE: all the following BitWriter functions IGNORE the BitBuffer and write straight to output !
@@ -248,9 +249,8 @@ void DCT(float block[8*8], uint8_t stride) // stride must be 1 (=horizontal) or
   block5 = z7 + z2; block3 = z7 - z2;
 }
 
-// run DCT, quantize and write Huffman bit codes
-int16_t encodeBlock(BitWriter& writer, float block[8][8], const float scaled[8*8], int16_t lastDC,
-                    const BitCode huffmanDC[256], const BitCode huffmanAC[256], const BitCode* codewords)
+// run DCT and quantize, the result is stored in zigzag order (quantized[0] is the DC coefficient)
+void quantizeBlock(float block[8][8], const float scaled[8*8], int16_t quantized[8*8])
 {
   // "linearize" the 8x8 block, treat it as a flat array of 64 floats
   auto block64 = (float*) block;
@@ -266,35 +266,66 @@ int16_t encodeBlock(BitWriter& writer, float block[8][8], const float scaled[8*8
   for (auto i = 0; i < 8*8; i++)
     block64[i] *= scaled[i];
 
-  // encode DC (the first coefficient is the "average color" of the 8x8 block)
-  auto DC = int(block64[0] + (block64[0] >= 0 ? +0.5f : -0.5f)); // C++11's nearbyint() achieves a similar effect
-
-  // quantize and zigzag the other 63 coefficients
-  auto posNonZero = 0; // find last coefficient which is not zero (because trailing zeros are encoded differently)
-  int16_t quantized[8*8];
-  for (auto i = 1; i < 8*8; i++) // start at 1 because block64[0]=DC was already processed
+  // quantize and zigzag all 64 coefficients (ZigZagInv[0] = 0, so the DC "average color" comes first)
+  for (auto i = 0; i < 8*8; i++)
   {
     auto value = block64[ZigZagInv[i]];
     // round to nearest integer
     quantized[i] = int(value + (value >= 0 ? +0.5f : -0.5f)); // C++11's nearbyint() achieves a similar effect
-    // remember offset of last non-zero coefficient
-    if (quantized[i] != 0)
-      posNonZero = i;
   }
+}
+
+// the entropy coder below either writes Huffman codes ...
+struct EncodeSink
+{
+  BitWriter&     writer;
+  const BitCode* huffmanDC;
+  const BitCode* huffmanAC;
 
-  // same "average color" as previous block ?
-  auto diff = DC - lastDC;
-  if (diff == 0)
-    writer << huffmanDC[0x00];   // yes, write a special short symbol
-  else
+  void dc(uint8_t symbol, const BitCode& bits) { writer << huffmanDC[symbol]; if (symbol != 0)    writer << bits; }
+  void ac(uint8_t symbol, const BitCode& bits) { writer << huffmanAC[symbol]; if (symbol & 0x0F) writer << bits; } // 0x00 and 0xF0 carry no extra bits
+};
+
+// ... or merely counts how often each symbol occurs (first pass of optimized Huffman tables)
+struct CountSink
+{
+  unsigned* frequencyDC;
+  unsigned* frequencyAC;
+
+  void dc(uint8_t symbol, const BitCode&) { frequencyDC[symbol]++; }
+  void ac(uint8_t symbol, const BitCode&) { frequencyAC[symbol]++; }
+};
+
+// entropy-code the coefficients from..to (zigzag positions) of a quantized block
+// from = 0 includes the DC difference, baseline JPEGs always use 0..63, progressive JPEGs split it into bands
+template <typename Sink>
+int16_t encodeQuantized(Sink& sink, const int16_t quantized[8*8], int16_t lastDC, int from, int to, const BitCode* codewords)
+{
+  if (from == 0)
   {
-    auto bits = codewords[diff]; // nope, encode the difference to previous block's average color
-    writer << huffmanDC[bits.numBits] << bits;
+    // same "average color" as previous block ?
+    auto diff = quantized[0] - lastDC;
+    if (diff == 0)
+      sink.dc(0x00, codewords[1]); // yes, write a special short symbol (the codeword is ignored)
+    else
+    {
+      auto bits = codewords[diff]; // nope, encode the difference to previous block's average color
+      sink.dc(bits.numBits, bits);
+    }
+    from = 1;
   }
+  if (to == 0)
+    return quantized[0];
 
-  // encode ACs (quantized[1..63])
+  // find last coefficient which is not zero (because trailing zeros are encoded differently)
+  auto posNonZero = from - 1;
+  for (auto i = from; i <= to; i++)
+    if (quantized[i] != 0)
+      posNonZero = i;
+
+  // encode ACs
   auto offset = 0; // upper 4 bits count the number of consecutive zeros
-  for (auto i = 1; i <= posNonZero; i++) // quantized[0] was already written, skip all trailing zeros, too
+  for (auto i = from; i <= posNonZero; i++) // skip all trailing zeros
   {
     // zeros are encoded in a special way
     while (quantized[i] == 0) // found another zero ?
@@ -303,7 +334,7 @@ int16_t encodeBlock(BitWriter& writer, float block[8][8], const float scaled[8*8
       // split into blocks of at most 16 consecutive zeros
       if (offset > 0xF0) // remember, the counter is in the upper 4 bits, 0xF = 15
       {
-        writer << huffmanAC[0xF0]; // 0xF0 is a special code for "16 zeros"
+        sink.ac(0xF0, codewords[1]); // 0xF0 is a special code for "16 zeros"
         offset = 0;
       }
       i++;
@@ -311,15 +342,26 @@ int16_t encodeBlock(BitWriter& writer, float block[8][8], const float scaled[8*8
 
     auto encoded = codewords[quantized[i]];
     // combine number of zeros with the number of bits of the next non-zero value
-    writer << huffmanAC[offset + encoded.numBits] << encoded; // and the value itself
+    sink.ac(offset + encoded.numBits, encoded); // and the value itself
     offset = 0;
   }
 
   // send end-of-block code (0x00), only needed if there are trailing zeros
-  if (posNonZero < 8*8 - 1) // = 63
-    writer << huffmanAC[0x00];
+  if (posNonZero < to)
+    sink.ac(0x00, codewords[1]);
+
+  return quantized[0];
+}
+
+// run DCT, quantize and write Huffman bit codes
+int16_t encodeBlock(BitWriter& writer, float block[8][8], const float scaled[8*8], int16_t lastDC,
+                    const BitCode huffmanDC[256], const BitCode huffmanAC[256], const BitCode* codewords)
+{
+  int16_t quantized[8*8];
+  quantizeBlock(block, scaled, quantized);
 
-  return DC;
+  EncodeSink sink = { writer, huffmanDC, huffmanAC };
+  return encodeQuantized(sink, quantized, lastDC, 0, 63, codewords);
 }
 
 // Jon's code includes the pre-generated Huffman codes
@@ -339,15 +381,110 @@ void generateHuffmanTable(const uint8_t numCodes[16], const uint8_t* values, Bit
   }
 }
 
+// derive a Huffman code from symbol frequencies, see JPEG standard Annex K.2 (same approach as libjpeg's jpeg_gen_optimal_table)
+// numCodes and values have the same layout as the static tables above, returns the number of values
+int optimalHuffmanTable(const unsigned frequencies[256], uint8_t numCodes[16], uint8_t values[256])
+{
+  long frequency[257];
+  int  codeSize [257];
+  int  others   [257]; // next symbol in the current branch of the tree
+  for (auto i = 0; i < 256; i++)
+    frequency[i] = frequencies[i];
+  frequency[256] = 1; // reserve one code point so that no code consists of 1-bits only
+  for (auto i = 0; i < 257; i++)
+  {
+    codeSize[i] = 0;
+    others  [i] = -1;
+  }
+
+  // repeatedly merge the two least frequent branches
+  while (true)
+  {
+    // c1 = least frequent symbol, ties are resolved in favor of the larger value
+    auto c1 = -1;
+    for (auto i = 0; i <= 256; i++)
+      if (frequency[i] != 0 && (c1 < 0 || frequency[i] <= frequency[c1]))
+        c1 = i;
+    // c2 = second least frequent symbol
+    auto c2 = -1;
+    for (auto i = 0; i <= 256; i++)
+      if (frequency[i] != 0 && i != c1 && (c2 < 0 || frequency[i] <= frequency[c2]))
+        c2 = i;
+    if (c2 < 0) // only one branch left
+      break;
+
+    frequency[c1] += frequency[c2];
+    frequency[c2]  = 0;
+
+    // every symbol of both branches becomes one bit longer
+    codeSize[c1]++;
+    while (others[c1] >= 0)
+    {
+      c1 = others[c1];
+      codeSize[c1]++;
+    }
+    others[c1] = c2; // chain c2's branch to c1's
+    codeSize[c2]++;
+    while (others[c2] >= 0)
+    {
+      c2 = others[c2];
+      codeSize[c2]++;
+    }
+  }
+
+  // count codes per length, lengths may exceed 16 bits for now
+  int bits[33] = { 0 };
+  for (auto i = 0; i <= 256; i++)
+    if (codeSize[i] > 0)
+      bits[codeSize[i] <= 32 ? codeSize[i] : 32]++;
+
+  // JPEG limits codes to 16 bits: move pairs of long codes up the tree (Annex K.3)
+  for (auto i = 32; i > 16; i--)
+    while (bits[i] > 0)
+    {
+      auto j = i - 2;
+      while (bits[j] == 0)
+        j--;
+      bits[i]     -= 2;
+      bits[i - 1] += 1;
+      bits[j + 1] += 2;
+      bits[j]     -= 1;
+    }
+
+  // remove the reserved code point (it is always one of the longest codes)
+  auto longest = 16;
+  while (bits[longest] == 0)
+    longest--;
+  bits[longest]--;
+
+  for (auto i = 1; i <= 16; i++)
+    numCodes[i - 1] = uint8_t(bits[i]);
+
+  // symbols sorted by code length
+  auto numValues = 0;
+  for (auto length = 1; length <= 32; length++)
+    for (auto symbol = 0; symbol < 256; symbol++)
+      if (codeSize[symbol] == length)
+        values[numValues++] = uint8_t(symbol);
+  return numValues;
+}
+
 } // end of anonymous namespace
 
 // -------------------- externally visible code --------------------
 
 namespace TooJpeg
 {
-// the only exported function ...
+// the original interface, a single sequential scan with the standard Huffman tables
+bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels, unsigned short width, unsigned short height,
+               bool isRGB, unsigned char quality, bool downsample, const char* comment)
+{
+  return writeJpeg(output, pixels, width, height, isRGB, quality, downsample, comment, false, false);
+}
+
 bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels_, unsigned short width, unsigned short height,
-               bool isRGB, unsigned char quality_, bool downsample, const char* comment)
+               bool isRGB, unsigned char quality_, bool downsample, const char* comment,
+               bool optimizeHuffman, bool progressive)
 {
   // reject invalid pointers
   if (output == nullptr || pixels_ == nullptr)
@@ -366,6 +503,9 @@ bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels_, unsigned short width,
   if (!isRGB)
     downsample = false;
 
+  // optimized tables and progressive scans need all coefficients before anything can be entropy-coded
+  const bool twoPass = optimizeHuffman || progressive;
+
   // wrapper for all output operations
   BitWriter bitWriter(output);
 
@@ -428,7 +568,8 @@ bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels_, unsigned short width,
 
   // ////////////////////////////////////////
   // write image infos (SOF0 - start of frame)
-  bitWriter.addMarker(0xC0, 2+6+3*numComponents); // length: 6 bytes general info + 3 per channel + 2 bytes for this length field
+  bitWriter.addMarker(progressive ? 0xC2 : 0xC0, 2+6+3*numComponents); // SOF2 for progressive, SOF0 for baseline
+                                                  // length: 6 bytes general info + 3 per channel + 2 bytes for this length field
 
   // 8 bits per channel
   bitWriter << 0x08
@@ -446,21 +587,35 @@ bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels_, unsigned short width,
 
   // ////////////////////////////////////////
   // Huffman tables
-  // DHT marker - define Huffman tables
-  bitWriter.addMarker(0xC4, isRGB ? (2+208+208) : (2+208));
-                            // 2 bytes for the length field, store chrominance only if needed
-                            //   1+16+12  for the DC luminance
-                            //   1+16+162 for the AC luminance   (208 = 1+16+12 + 1+16+162)
-                            //   1+16+12  for the DC chrominance
-                            //   1+16+162 for the AC chrominance (208 = 1+16+12 + 1+16+162, same as above)
-
-  // store luminance's DC+AC Huffman table definitions
-  bitWriter << 0x00 // highest 4 bits: 0 => DC, lowest 4 bits: 0 => Y (baseline)
-            << DcLuminanceCodesPerBitsize
-            << DcLuminanceValues;
-  bitWriter << 0x10 // highest 4 bits: 1 => AC, lowest 4 bits: 0 => Y (baseline)
-            << AcLuminanceCodesPerBitsize
-            << AcLuminanceValues;
+  // DHT marker - define Huffman tables (the two-pass encoder writes its own tables in front of each scan)
+  if (!twoPass)
+  {
+    bitWriter.addMarker(0xC4, isRGB ? (2+208+208) : (2+208));
+                              // 2 bytes for the length field, store chrominance only if needed
+                              //   1+16+12  for the DC luminance
+                              //   1+16+162 for the AC luminance   (208 = 1+16+12 + 1+16+162)
+                              //   1+16+12  for the DC chrominance
+                              //   1+16+162 for the AC chrominance (208 = 1+16+12 + 1+16+162, same as above)
+
+    // store luminance's DC+AC Huffman table definitions
+    bitWriter << 0x00 // highest 4 bits: 0 => DC, lowest 4 bits: 0 => Y (baseline)
+              << DcLuminanceCodesPerBitsize
+              << DcLuminanceValues;
+    bitWriter << 0x10 // highest 4 bits: 1 => AC, lowest 4 bits: 0 => Y (baseline)
+              << AcLuminanceCodesPerBitsize
+              << AcLuminanceValues;
+
+    if (isRGB)
+    {
+      // store chrominance's DC+AC Huffman table definitions
+      bitWriter << 0x01 // highest 4 bits: 0 => DC, lowest 4 bits: 1 => Cr,Cb (baseline)
+                << DcChrominanceCodesPerBitsize
+                << DcChrominanceValues;
+      bitWriter << 0x11 // highest 4 bits: 1 => AC, lowest 4 bits: 1 => Cr,Cb (baseline)
+                << AcChrominanceCodesPerBitsize
+                << AcChrominanceValues;
+    }
+  }
 
   // compute actual Huffman code tables (see Jon's code for precalculated tables)
   BitCode huffmanLuminanceDC[256];
@@ -473,14 +628,6 @@ bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels_, unsigned short width,
   BitCode huffmanChrominanceAC[256];
   if (isRGB)
   {
-    // store luminance's DC+AC Huffman table definitions
-    bitWriter << 0x01 // highest 4 bits: 0 => DC, lowest 4 bits: 1 => Cr,Cb (baseline)
-              << DcChrominanceCodesPerBitsize
-              << DcChrominanceValues;
-    bitWriter << 0x11 // highest 4 bits: 1 => AC, lowest 4 bits: 1 => Cr,Cb (baseline)
-              << AcChrominanceCodesPerBitsize
-              << AcChrominanceValues;
-
     // compute actual Huffman code tables (see Jon's code for precalculated tables)
     generateHuffmanTable(DcChrominanceCodesPerBitsize, DcChrominanceValues, huffmanChrominanceDC);
     generateHuffmanTable(AcChrominanceCodesPerBitsize, AcChrominanceValues, huffmanChrominanceAC);
@@ -488,18 +635,21 @@ bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels_, unsigned short width,
 
   // ////////////////////////////////////////
   // start of scan (there is only a single scan for baseline JPEGs)
-  bitWriter.addMarker(0xDA, 2+1+2*numComponents+3); // 2 bytes for the length field, 1 byte for number of components,
-                                                    // then 2 bytes for each component and 3 bytes for spectral selection
-
-  // assign Huffman tables to each component
-  bitWriter << numComponents;
-  for (auto id = 1; id <= numComponents; id++)
-    // highest 4 bits: DC Huffman table, lowest 4 bits: AC Huffman table
-    bitWriter << id << (id == 1 ? 0x00 : 0x11); // Y: tables 0 for DC and AC; Cb + Cr: tables 1 for DC and AC
-
-  // constant values for our baseline JPEGs (which have a single sequential scan)
-  static const uint8_t Spectral[3] = { 0, 63, 0 }; // spectral selection: must be from 0 to 63; successive approximation must be 0
-  bitWriter << Spectral;
+  if (!twoPass)
+  {
+    bitWriter.addMarker(0xDA, 2+1+2*numComponents+3); // 2 bytes for the length field, 1 byte for number of components,
+                                                      // then 2 bytes for each component and 3 bytes for spectral selection
+
+    // assign Huffman tables to each component
+    bitWriter << numComponents;
+    for (auto id = 1; id <= numComponents; id++)
+      // highest 4 bits: DC Huffman table, lowest 4 bits: AC Huffman table
+      bitWriter << id << (id == 1 ? 0x00 : 0x11); // Y: tables 0 for DC and AC; Cb + Cr: tables 1 for DC and AC
+
+    // constant values for our baseline JPEGs (which have a single sequential scan)
+    static const uint8_t Spectral[3] = { 0, 63, 0 }; // spectral selection: must be from 0 to 63; successive approximation must be 0
+    bitWriter << Spectral;
+  }
 
   // ////////////////////////////////////////
   // adjust quantization tables with AAN scaling factors to simplify DCT
@@ -556,6 +706,21 @@ bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels_, unsigned short width,
   // convert from RGB to YCbCr
   float Y[8][8], Cb[8][8], Cr[8][8];
 
+  // two-pass mode: quantized blocks of each component, stored on a grid of blocks covering all MCUs
+  // (the only dynamic memory allocation, about 6 bytes per pixel for YCbCr 4:4:4)
+  const auto mcusX = (width  + mcuSize - 1) / mcuSize;
+  const auto mcusY = (height + mcuSize - 1) / mcuSize;
+  int      blocksX[3]      = { mcusX * sampling, mcusX, mcusX };
+  int      blocksY[3]      = { mcusY * sampling, mcusY, mcusY };
+  int16_t* coefficients[3] = { nullptr, nullptr, nullptr };
+  if (twoPass)
+    for (auto c = 0; c < numComponents; c++)
+      coefficients[c] = new int16_t[blocksX[c] * blocksY[c] * 8*8];
+  auto storeBlock = [&](int c, int blockX, int blockY, float block[8][8])
+  {
+    quantizeBlock(block, c == 0 ? scaledLuminance : scaledChrominance, coefficients[c] + (blockY * blocksX[c] + blockX) * 8*8);
+  };
+
   for (auto mcuY = 0; mcuY < height; mcuY += mcuSize) // each step is either 8 or 16 (=mcuSize)
     for (auto mcuX = 0; mcuX < width; mcuX += mcuSize)
     {
@@ -599,7 +764,10 @@ bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels_, unsigned short width,
           }
 
         // encode Y channel
-        lastYDC = encodeBlock(bitWriter, Y, scaledLuminance, lastYDC, huffmanLuminanceDC, huffmanLuminanceAC, codewords);
+        if (twoPass)
+          storeBlock(0, (mcuX + blockX) / 8, (mcuY + blockY) / 8, Y);
+        else
+          lastYDC = encodeBlock(bitWriter, Y, scaledLuminance, lastYDC, huffmanLuminanceDC, huffmanLuminanceAC, codewords);
         // Cb and Cr are encoded about 50 lines below
       }
 
@@ -651,10 +819,150 @@ bool writeJpeg(WRITE_ONE_BYTE output, const void* pixels_, unsigned short width,
         } // end of YCbCr420 code for Cb and Cr
 
       // encode Cb and Cr
+      if (twoPass)
+      {
+        storeBlock(1, mcuX / mcuSize, mcuY / mcuSize, Cb);
+        storeBlock(2, mcuX / mcuSize, mcuY / mcuSize, Cr);
+        continue;
+      }
       lastCbDC = encodeBlock(bitWriter, Cb, scaledChrominance, lastCbDC, huffmanChrominanceDC, huffmanChrominanceAC, codewords);
       lastCrDC = encodeBlock(bitWriter, Cr, scaledChrominance, lastCrDC, huffmanChrominanceDC, huffmanChrominanceAC, codewords);
     }
 
+  // ////////////////////////////////////////
+  // second pass: write all scans from the stored coefficients
+  if (twoPass)
+  {
+    // a scan covers a band of zigzag positions for one component or (DC / baseline) all components interleaved
+    struct Scan { int numComponents, first, from, to; };
+    Scan scans[1 + 3*2];
+    auto numScans = 0;
+    if (progressive)
+    {
+      // DC of all components first (a coarse preview), then low and high AC bands of each component
+      scans[numScans++] = { numComponents, 0, 0, 0 };
+      for (auto c = 0; c < numComponents; c++)
+      {
+        scans[numScans++] = { 1, c, 1,  5 };
+        scans[numScans++] = { 1, c, 6, 63 };
+      }
+    }
+    else
+      scans[numScans++] = { numComponents, 0, 0, 63 };
+
+    // non-interleaved scans only visit the blocks inside the component's own dimensions, not the MCU padding
+    int usedX[3] = { (width + 7) / 8, mcusX, mcusX };
+    int usedY[3] = { (height + 7) / 8, mcusY, mcusY };
+    if (numComponents == 1)
+    {
+      usedX[0] = blocksX[0];
+      usedY[0] = blocksY[0];
+    }
+
+    // visit all blocks of a scan in file order
+    auto forEachBlock = [&](const Scan& scan, const auto& process)
+    {
+      if (scan.numComponents > 1)
+      {
+        for (auto mcuRow = 0; mcuRow < mcusY; mcuRow++)
+          for (auto mcuColumn = 0; mcuColumn < mcusX; mcuColumn++)
+            for (auto c = 0; c < scan.numComponents; c++)
+            {
+              auto size = c == 0 ? sampling : 1;
+              for (auto blockY = 0; blockY < size; blockY++)
+                for (auto blockX = 0; blockX < size; blockX++)
+                  process(c, (mcuRow * size + blockY) * blocksX[c] + mcuColumn * size + blockX);
+            }
+      }
+      else
+        for (auto blockY = 0; blockY < usedY[scan.first]; blockY++)
+          for (auto blockX = 0; blockX < usedX[scan.first]; blockX++)
+            process(scan.first, blockY * blocksX[scan.first] + blockX);
+    };
+
+    for (auto s = 0; s < numScans; s++)
+    {
+      const auto& scan = scans[s];
+      int16_t lastDC[3] = { 0, 0, 0 };
+
+      // luminance uses tables 0, chrominance shares tables 1
+      BitCode* tablesDC[2] = { huffmanLuminanceDC, huffmanChrominanceDC };
+      BitCode* tablesAC[2] = { huffmanLuminanceAC, huffmanChrominanceAC };
+      BitCode  optimizedDC[2][256], optimizedAC[2][256];
+
+      if (optimizeHuffman)
+      {
+        // first pass over this scan: count symbols
+        unsigned frequencyDC[2][256] = { { 0 } }, frequencyAC[2][256] = { { 0 } };
+        CountSink counters[2] = { { frequencyDC[0], frequencyAC[0] }, { frequencyDC[1], frequencyAC[1] } };
+        forEachBlock(scan, [&](int c, int block)
+        {
+          lastDC[c] = encodeQuantized(counters[c > 0], coefficients[c] + block * 8*8, lastDC[c], scan.from, scan.to, codewords);
+        });
+        lastDC[0] = lastDC[1] = lastDC[2] = 0;
+
+        // build and store only the tables this scan refers to
+        uint8_t numCodes[4][16], values[4][256];
+        int     numValues[4], ids[4], numTables = 0, length = 2;
+        for (auto table = 0; table < 2; table++)
+        {
+          auto used = scan.numComponents > 1 ? (table == 0 || numComponents > 1) : ((scan.first > 0) == (table == 1));
+          if (!used)
+            continue;
+          for (auto ac = 0; ac < 2; ac++)
+          {
+            if ((ac == 0 && scan.from != 0) || (ac == 1 && scan.to == 0))
+              continue;
+            numValues[numTables] = optimalHuffmanTable(ac ? frequencyAC[table] : frequencyDC[table], numCodes[numTables], values[numTables]);
+            generateHuffmanTable(numCodes[numTables], values[numTables], ac ? optimizedAC[table] : optimizedDC[table]);
+            ids[numTables] = (ac << 4) | table;
+            length += 1 + 16 + numValues[numTables++];
+          }
+          tablesDC[table] = optimizedDC[table];
+          tablesAC[table] = optimizedAC[table];
+        }
+
+        bitWriter.addMarker(0xC4, length);
+        for (auto t = 0; t < numTables; t++)
+        {
+          bitWriter << ids[t] << numCodes[t];
+          for (auto v = 0; v < numValues[t]; v++)
+            bitWriter << values[t][v];
+        }
+      }
+      else if (s == 0)
+      {
+        // standard tables, defined once
+        bitWriter.addMarker(0xC4, isRGB ? (2+208+208) : (2+208));
+        bitWriter << 0x00 << DcLuminanceCodesPerBitsize << DcLuminanceValues
+                  << 0x10 << AcLuminanceCodesPerBitsize << AcLuminanceValues;
+        if (isRGB)
+          bitWriter << 0x01 << DcChrominanceCodesPerBitsize << DcChrominanceValues
+                    << 0x11 << AcChrominanceCodesPerBitsize << AcChrominanceValues;
+      }
+
+      // SOS marker, same layout as the baseline scan above
+      bitWriter.addMarker(0xDA, 2+1+2*scan.numComponents+3);
+      bitWriter << scan.numComponents;
+      for (auto c = 0; c < scan.numComponents; c++)
+      {
+        auto id = scan.numComponents > 1 ? c + 1 : scan.first + 1;
+        bitWriter << id << (id == 1 ? 0x00 : 0x11);
+      }
+      bitWriter << scan.from << scan.to << 0x00; // no successive approximation
+
+      EncodeSink sinks[2] = { { bitWriter, tablesDC[0], tablesAC[0] }, { bitWriter, tablesDC[1], tablesAC[1] } };
+      forEachBlock(scan, [&](int c, int block)
+      {
+        lastDC[c] = encodeQuantized(sinks[c > 0], coefficients[c] + block * 8*8, lastDC[c], scan.from, scan.to, codewords);
+      });
+      bitWriter.flush();
+    }
+
+    for (auto c = 0; c < numComponents; c++)
+      delete[] coefficients[c];
+  }
+
   bitWriter.flush(); // now image is completely encoded, write any bits still left in the buffer
 
   // ///////////////////////////